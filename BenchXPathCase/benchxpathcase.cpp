@@ -0,0 +1,285 @@
+#include "benchxpathcase.h"
+#include "phasetimer.h"
+#include "commandline.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <xercesc/parsers/XercesDOMParser.hpp>
+
+#include <xercesc/framework/MemBufInputSource.hpp>
+
+#include <xercesc/util/XMLUni.hpp>
+
+XERCES_CPP_NAMESPACE_USE
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+enum class DOMImplName
+{
+    XERCESC,
+    XQILLA
+};
+
+const XMLCh* DEFAULT_FEATURES = u"";
+const XMLCh* XPATH_FEATURES = u"XPath2";
+
+const short XPATH_CASE_1(1);
+const short XPATH_CASE_2(2);
+const short XPATH_CASE_3(3);
+const short XPATH_CASE_4(4);
+
+const short XPATH_CASES[] = { XPATH_CASE_1, XPATH_CASE_2, XPATH_CASE_3, XPATH_CASE_4 };
+const DOMImplName IMPL_NAMES[] = { DOMImplName::XERCESC, DOMImplName::XQILLA };
+
+// Number of <book> records of each generated document
+const size_t DOCUMENT_SIZES[] = { 100, 1000, 10000, 100000 };
+
+const long long MAX_ITERATIONS(1000000);
+
+struct CaseResult
+{
+    bool supported;
+    std::string error;
+    size_t matches;
+    PhaseTimer::Summary summary;
+};
+
+std::string GenerateBookstore(size_t books);
+
+DOMDocument* ParseString(const std::string& xml, DOMImplName implName);
+
+CaseResult RunCase(const std::string& xml, DOMImplName implName, short xpathCase, const std::string& xpath, size_t iterations);
+size_t EvaluateCase(DOMDocument* document, short xpathCase, const std::string& xpath);
+size_t EvaluateOn(DOMDocument* document, const DOMNode* contextNode, const std::string& xpath);
+
+const char* GetImplName(DOMImplName implName);
+
+int main(const int argc, const char* argv[])
+{
+    std::string xpathExpression("//book/title");
+    size_t iterations = 5;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string argument(argv[i]);
+
+            if (argument == "--iterations" && i + 1 < argc)
+                iterations = static_cast<size_t>(::ParseCount(argv[++i], 1, MAX_ITERATIONS));
+            else
+                xpathExpression = argument;
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        std::cout << "Usage: " << argv[0] << " [--iterations N] [xpath]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        // XQilla initializes Xerces-C as well, so both implementations are registered
+        XQillaPlatformUtils::initialize();
+    }
+    catch (const XMLException& eXerces)
+    {
+        std::cerr << "Error during Xerces-C initialisation.\n"
+              << "Xerces exception message: "
+              << UTF8(eXerces.getMessage()) << std::endl;
+        return 1;
+    }
+
+    std::cout << "XPath: " << xpathExpression << "\n"
+        << "Iterations: " << iterations << "\n"
+        << "Median XPath time in microseconds (matches), '-' if the back end rejects the expression\n\n";
+
+    std::cout << std::left << std::setw(10) << "books";
+    for (auto implName : IMPL_NAMES)
+        for (auto xpathCase : XPATH_CASES)
+            std::cout << std::setw(18) << (std::string(GetImplName(implName)) + " case " + std::to_string(xpathCase));
+    std::cout << std::endl;
+
+    for (auto books : DOCUMENT_SIZES)
+    {
+        std::string xml(GenerateBookstore(books));
+
+        std::cout << std::setw(10) << books;
+
+        for (auto implName : IMPL_NAMES)
+        {
+            for (auto xpathCase : XPATH_CASES)
+            {
+                CaseResult result = RunCase(xml, implName, xpathCase, xpathExpression, iterations);
+
+                std::ostringstream cell;
+                if (result.supported)
+                    cell << (result.summary.p50Ns / 1000) << " (" << result.matches << ")";
+                else
+                    cell << "-";
+
+                std::cout << std::setw(18) << cell.str() << std::flush;
+
+                if (!result.supported)
+                    std::cerr << GetImplName(implName) << " case " << xpathCase << ": " << result.error << std::endl;
+            }
+        }
+
+        std::cout << std::endl;
+    }
+
+    XQillaPlatformUtils::terminate();
+
+    return 0;
+}
+
+std::string GenerateBookstore(size_t books)
+{
+    std::ostringstream xml;
+
+    xml << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<bookstore>\n"
+        << "\t<onePerson>\n\t\t<name>Hello</name>\n\t</onePerson>\n";
+
+    for (size_t i = 0; i < books; i++)
+    {
+        xml << "\t<book id=\"" << (i + 1) << "\">\n"
+            << "\t  <title lang=\"en\">Title " << (i + 1) << "</title>\n"
+            << "\t  <price>" << (10 + i % 90) << ".99</price>\n"
+            << "\t</book>\n";
+    }
+
+    xml << "</bookstore>\n";
+
+    return xml.str();
+}
+
+const char* GetImplName(DOMImplName implName)
+{
+    switch (implName)
+    {
+        case DOMImplName::XERCESC:
+            return "XercesC";
+        case DOMImplName::XQILLA:
+            return "XQilla";
+    }
+
+    return "";
+}
+
+DOMDocument* ParseString(const std::string& xml, DOMImplName implName)
+{
+    XercesDOMParser parser;
+    parser.setValidationScheme(XercesDOMParser::Val_Auto);
+    parser.setDoNamespaces(true);
+
+    // The document implementation decides which XPath engine createExpression uses
+    parser.useImplementation(implName == DOMImplName::XQILLA ? XPATH_FEATURES : DEFAULT_FEATURES);
+
+    MemBufInputSource memInputSource(
+        reinterpret_cast<const XMLByte*>(xml.c_str()),
+        xml.size(),
+        "Generated bookstore",
+        false
+    );
+
+    parser.parse(memInputSource);
+
+    return parser.adoptDocument();
+}
+
+CaseResult RunCase(const std::string& xml, DOMImplName implName, short xpathCase, const std::string& xpath, size_t iterations)
+{
+    CaseResult caseResult;
+    caseResult.supported = true;
+    caseResult.matches = 0;
+
+    PhaseTimer timer;
+
+    for (size_t iteration = 0; iteration < iterations; iteration++)
+    {
+        // Cases 2 to 4 detach the root, so every iteration needs a fresh document
+        AutoRelease<DOMDocument> document(ParseString(xml, implName));
+
+        try
+        {
+            long long start(GetTimestampNanos());
+            caseResult.matches = EvaluateCase(document, xpathCase, xpath);
+            timer.Record("xpath", GetTimestampNanos() - start);
+        }
+        catch (const XQillaException& ex)
+        {
+            caseResult.error = UTF8(ex.getMessage());
+        }
+        catch (const DOMXPathException& ex)
+        {
+            caseResult.error = UTF8(ex.getMessage());
+        }
+        catch (const DOMException& ex)
+        {
+            caseResult.error = UTF8(ex.getMessage());
+        }
+
+        if (!caseResult.error.empty())
+        {
+            caseResult.supported = false;
+            return caseResult;
+        }
+    }
+
+    caseResult.summary = timer.Summarize("xpath");
+
+    return caseResult;
+}
+
+size_t EvaluateCase(DOMDocument* document, short xpathCase, const std::string& xpath)
+{
+    if (xpathCase == XPATH_CASE_1)
+        return EvaluateOn(document, document->getDocumentElement(), xpath);
+
+    DOMElement* root = document->getDocumentElement();
+    document->removeChild(root);
+
+    if (xpathCase == XPATH_CASE_2)
+        return EvaluateOn(document, root, xpath);
+
+    DOMDocumentFragment* docFragment = document->createDocumentFragment();
+    docFragment->appendChild(root);
+
+    if (xpathCase == XPATH_CASE_3)
+        return EvaluateOn(document, root, xpath);
+
+    return EvaluateOn(document, docFragment, xpath);
+}
+
+size_t EvaluateOn(DOMDocument* document, const DOMNode* contextNode, const std::string& xpath)
+{
+    AutoRelease<DOMXPathNSResolver> resolver(document->createNSResolver(contextNode));
+    AutoRelease<DOMXPathExpression> parsedExpression(document->createExpression(X(xpath.c_str()), resolver));
+
+    AutoRelease<DOMXPathResult> result(
+        parsedExpression->evaluate(
+            contextNode,
+            DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+            nullptr
+        )
+    );
+
+    size_t nLength = result->getSnapshotLength();
+
+    // Touch every node as the GetElementByXpath helpers do
+    for (size_t i = 0; i < nLength; i++)
+    {
+        result->snapshotItem(i);
+        result->getNodeValue();
+    }
+
+    return nLength;
+}
@@ -0,0 +1,117 @@
+#include "arenamemorymanager.h"
+
+#include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/util/OutOfMemoryException.hpp>
+
+#include <cstdlib>
+
+namespace
+{
+    const size_t ARENA_ALIGNMENT(alignof(std::max_align_t));
+
+    size_t AlignUp(size_t size)
+    {
+        return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    }
+}
+
+ArenaMemoryManager::ArenaMemoryManager(size_t chunkSize)
+    : _chunkSize(AlignUp(chunkSize)),
+      _cursor(nullptr),
+      _end(nullptr),
+      _totalBytes(0),
+      _allocations(0),
+      _currentBytes(0),
+      _chunkBytes(0),
+      _peakChunkBytes(0)
+{
+}
+
+ArenaMemoryManager::~ArenaMemoryManager()
+{
+    for (auto it = _chunks.begin(); it != _chunks.end(); it++)
+        std::free(it->first);
+}
+
+MemoryManager* ArenaMemoryManager::getExceptionMemoryManager()
+{
+    // Exceptions can outlive the arena
+    return XMLPlatformUtils::fgMemoryManager;
+}
+
+void* ArenaMemoryManager::allocate(XMLSize_t size)
+{
+    size_t alignedSize = AlignUp(size == 0 ? 1 : size);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (static_cast<size_t>(_end - _cursor) < alignedSize)
+        AddChunk(alignedSize);
+
+    void* p = _cursor;
+    _cursor += alignedSize;
+
+    _totalBytes += alignedSize;
+    _allocations++;
+    _currentBytes += alignedSize;
+
+    return p;
+}
+
+void ArenaMemoryManager::deallocate(void*)
+{
+    // Released in bulk by Reset()
+}
+
+void ArenaMemoryManager::Reset()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_chunks.empty())
+        return;
+
+    // Keep the first chunk, small documents then never touch malloc again
+    for (size_t i = 1; i < _chunks.size(); i++)
+        std::free(_chunks[i].first);
+
+    _chunks.resize(1);
+    _cursor = _chunks[0].first;
+    _end = _cursor + _chunks[0].second;
+
+    _currentBytes = 0;
+    _chunkBytes = _chunks[0].second;
+}
+
+ArenaMemoryManager::Statistics ArenaMemoryManager::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Statistics statistics;
+    statistics.totalBytes = _totalBytes;
+    statistics.allocations = _allocations;
+    statistics.currentBytes = _currentBytes;
+    statistics.chunkBytes = _chunkBytes;
+    statistics.peakChunkBytes = _peakChunkBytes;
+
+    return statistics;
+}
+
+void ArenaMemoryManager::AddChunk(size_t minimumSize)
+{
+    // Oversized requests get a chunk of their own
+    size_t size = minimumSize > _chunkSize ? minimumSize : _chunkSize;
+
+    char* chunk = static_cast<char*>(std::malloc(size));
+
+    if (chunk == nullptr)
+        throw OutOfMemoryException();
+
+    _chunks.emplace_back(chunk, size);
+    _chunkBytes += size;
+
+    if (_chunkBytes > _peakChunkBytes)
+        _peakChunkBytes = _chunkBytes;
+
+    _cursor = chunk;
+    _end = chunk + size;
+}
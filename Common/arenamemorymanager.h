@@ -0,0 +1,62 @@
+#pragma once
+
+#include <xercesc/framework/MemoryManager.hpp>
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Bump allocator for everything that belongs to one document: the parser,
+// the DOM nodes and strings of the document heap. deallocate() is a no-op and
+// Reset() hands every chunk back at once, so tearing down a document costs one
+// free per chunk instead of one per allocation.
+// Only pass it to parsers whose documents are released before Reset().
+class ArenaMemoryManager : public MemoryManager
+{
+public:
+    // Nothing is given back before Reset(), so the memory held is what the
+    // chunks take, not what is still in use.
+    struct Statistics
+    {
+        unsigned long long totalBytes;
+        unsigned long long allocations;
+        // Handed out since the last Reset()
+        size_t currentBytes;
+        size_t chunkBytes;
+        // Highest chunkBytes, over every Reset()
+        size_t peakChunkBytes;
+    };
+
+    explicit ArenaMemoryManager(size_t chunkSize = 1 << 20);
+    ~ArenaMemoryManager();
+
+    ArenaMemoryManager(const ArenaMemoryManager&) = delete;
+    ArenaMemoryManager& operator=(const ArenaMemoryManager&) = delete;
+
+    MemoryManager* getExceptionMemoryManager() override;
+    void* allocate(XMLSize_t size) override;
+    void deallocate(void* p) override;
+
+    // Frees every allocation made since the last Reset(), keeping the first chunk for reuse.
+    void Reset();
+
+    Statistics GetStatistics() const;
+
+private:
+    void AddChunk(size_t minimumSize);
+
+    const size_t _chunkSize;
+
+    mutable std::mutex _mutex;
+    std::vector<std::pair<char*, size_t>> _chunks;
+    char* _cursor;
+    char* _end;
+
+    unsigned long long _totalBytes;
+    unsigned long long _allocations;
+    size_t _currentBytes;
+    size_t _chunkBytes;
+    size_t _peakChunkBytes;
+};
@@ -0,0 +1,304 @@
+#include "chunkedinputsource.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+ChunkedByteStream::ChunkedByteStream(size_t chunkSize, size_t maxPendingChunks)
+    : _chunkSize(chunkSize > 0 ? chunkSize : 1), _maxPendingChunks(maxPendingChunks > 0 ? maxPendingChunks : 1),
+      _closed(false), _aborted(false), _currentOffset(0), _position(0)
+{
+}
+
+ChunkedByteStream::~ChunkedByteStream()
+{
+    ReleaseChunk(_current);
+
+    for (auto it = _pending.begin(); it != _pending.end(); it++)
+        ReleaseChunk(*it);
+}
+
+std::vector<XMLByte> ChunkedByteStream::AcquireBuffer()
+{
+    std::vector<XMLByte> buffer;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_freeBuffers.empty())
+        {
+            buffer.swap(_freeBuffers.back());
+            _freeBuffers.pop_back();
+        }
+    }
+
+    buffer.clear();
+    buffer.reserve(_chunkSize);
+
+    return buffer;
+}
+
+bool ChunkedByteStream::Push(std::vector<XMLByte>&& chunk)
+{
+    if (chunk.empty())
+        return !IsAborted();
+
+    Chunk item;
+    item.storage.swap(chunk);
+    item.data = item.storage.data();
+    item.size = item.storage.size();
+
+    return Enqueue(item);
+}
+
+bool ChunkedByteStream::Push(const XMLByte* data, size_t size, const ReleaseCallback& release)
+{
+    Chunk item;
+    item.data = data;
+    item.size = size;
+    item.release = release;
+
+    if (size == 0)
+    {
+        ReleaseChunk(item);
+        return !IsAborted();
+    }
+
+    return Enqueue(item);
+}
+
+bool ChunkedByteStream::Write(const void* data, size_t size)
+{
+    const XMLByte* bytes = static_cast<const XMLByte*>(data);
+
+    while (size > 0)
+    {
+        if (_writeBuffer.capacity() == 0)
+            _writeBuffer = AcquireBuffer();
+
+        size_t count = std::min(size, _chunkSize - _writeBuffer.size());
+        _writeBuffer.insert(_writeBuffer.end(), bytes, bytes + count);
+
+        bytes += count;
+        size -= count;
+
+        if (_writeBuffer.size() == _chunkSize && !Push(std::move(_writeBuffer)))
+            return false;
+    }
+
+    return true;
+}
+
+void ChunkedByteStream::Close()
+{
+    if (!_writeBuffer.empty())
+        Push(std::move(_writeBuffer));
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+    }
+
+    _notEmpty.notify_all();
+}
+
+void ChunkedByteStream::Abort()
+{
+    std::deque<Chunk> dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        dropped.swap(_pending);
+    }
+
+    _notEmpty.notify_all();
+    _notFull.notify_all();
+
+    for (auto it = dropped.begin(); it != dropped.end(); it++)
+        ReleaseChunk(*it);
+}
+
+bool ChunkedByteStream::IsAborted() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _aborted;
+}
+
+XMLSize_t ChunkedByteStream::Read(XMLByte* const toFill, const XMLSize_t maxToRead)
+{
+    XMLSize_t count = 0;
+
+    while (count < maxToRead)
+    {
+        if (_currentOffset == _current.size)
+        {
+            ReleaseChunk(_current);
+            _currentOffset = 0;
+
+            // Waits only while nothing was read, what already arrived goes to the scanner right away
+            if (!NextChunk(count == 0))
+                break;
+        }
+
+        XMLSize_t length = std::min(maxToRead - count, static_cast<XMLSize_t>(_current.size - _currentOffset));
+
+        std::memcpy(toFill + count, _current.data + _currentOffset, length);
+
+        count += length;
+        _currentOffset += length;
+    }
+
+    _position += count;
+
+    return count;
+}
+
+bool ChunkedByteStream::Enqueue(Chunk& chunk)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _notFull.wait(lock, [this]() { return _pending.size() < _maxPendingChunks || _aborted; });
+
+    if (_aborted)
+    {
+        lock.unlock();
+        ReleaseChunk(chunk);
+
+        return false;
+    }
+
+    _pending.push_back(std::move(chunk));
+    lock.unlock();
+
+    _notEmpty.notify_one();
+
+    return true;
+}
+
+bool ChunkedByteStream::NextChunk(bool wait)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (wait)
+        _notEmpty.wait(lock, [this]() { return !_pending.empty() || _closed || _aborted; });
+
+    if (_aborted || _pending.empty())
+        return false;
+
+    _current = std::move(_pending.front());
+    _pending.pop_front();
+    _currentOffset = 0;
+    lock.unlock();
+
+    _notFull.notify_one();
+
+    return true;
+}
+
+void ChunkedByteStream::ReleaseChunk(Chunk& chunk)
+{
+    if (chunk.release)
+    {
+        chunk.release();
+    }
+    else if (chunk.storage.capacity() > 0)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Enough buffers to refill every pending slot, the rest goes back to the heap
+        if (_freeBuffers.size() <= _maxPendingChunks)
+            _freeBuffers.push_back(std::move(chunk.storage));
+    }
+
+    chunk = Chunk();
+}
+
+ChunkedBinInputStream::ChunkedBinInputStream(const std::shared_ptr<ChunkedByteStream>& stream)
+    : _stream(stream)
+{
+}
+
+ChunkedBinInputStream::~ChunkedBinInputStream()
+{
+    _stream->Abort();
+}
+
+XMLFilePos ChunkedBinInputStream::curPos() const
+{
+    return _stream->GetPosition();
+}
+
+XMLSize_t ChunkedBinInputStream::readBytes(XMLByte* const toFill, const XMLSize_t maxToRead)
+{
+    return _stream->Read(toFill, maxToRead);
+}
+
+const XMLCh* ChunkedBinInputStream::getContentType() const
+{
+    return nullptr;
+}
+
+ChunkedInputSource::ChunkedInputSource(const std::shared_ptr<ChunkedByteStream>& stream, const std::string& systemId,
+                                       MemoryManager* const manager)
+    : InputSource(systemId.c_str(), manager), _stream(stream)
+{
+}
+
+BinInputStream* ChunkedInputSource::makeStream() const
+{
+    return new (getMemoryManager()) ChunkedBinInputStream(_stream);
+}
+
+size_t PumpDescriptor(int descriptor, ChunkedByteStream& stream)
+{
+    size_t total = 0;
+
+    try
+    {
+        while (true)
+        {
+            std::vector<XMLByte> buffer = stream.AcquireBuffer();
+            buffer.resize(stream.GetChunkSize());
+
+#ifdef _WIN32
+            int count = _read(descriptor, buffer.data(), static_cast<unsigned int>(buffer.size()));
+#else
+            ssize_t count = read(descriptor, buffer.data(), buffer.size());
+
+            if (count < 0 && errno == EINTR)
+                continue;
+#endif
+
+            if (count < 0)
+                throw std::runtime_error(std::string("Cannot read input: ") + std::strerror(errno));
+
+            if (count == 0)
+                break;
+
+            buffer.resize(static_cast<size_t>(count));
+            total += static_cast<size_t>(count);
+
+            // Nobody is parsing any more
+            if (!stream.Push(std::move(buffer)))
+                return total;
+        }
+    }
+    catch (...)
+    {
+        // A buffer that cannot be allocated must not leave the parser waiting for the next chunk
+        stream.Abort();
+        throw;
+    }
+
+    stream.Close();
+
+    return total;
+}
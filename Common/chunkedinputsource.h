@@ -0,0 +1,134 @@
+#pragma once
+
+#include <xercesc/sax/InputSource.hpp>
+#include <xercesc/util/BinInputStream.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Chunks of one XML message handed from a producer thread (a pipe reader, a
+// decompressor, a ring buffer...) to the parser while it is still arriving.
+// A chunk buffer changes hands without a copy: owned buffers are moved in and
+// recycled through AcquireBuffer(), borrowed memory is given back through its
+// release callback once the scanner has read it. At most maxPendingChunks wait
+// for the parser, Push() blocks beyond that, so memory stays bounded whatever
+// the size of the message.
+class ChunkedByteStream
+{
+public:
+    typedef std::function<void()> ReleaseCallback;
+
+    ChunkedByteStream(size_t chunkSize = 64 * 1024, size_t maxPendingChunks = 8);
+    ~ChunkedByteStream();
+
+    ChunkedByteStream(const ChunkedByteStream&) = delete;
+    ChunkedByteStream& operator=(const ChunkedByteStream&) = delete;
+
+    size_t GetChunkSize() const { return _chunkSize; }
+
+    // Empty buffer with room for one chunk, reused from the chunks already parsed.
+    std::vector<XMLByte> AcquireBuffer();
+
+    // Safe from any producer thread. Both return false once the stream was
+    // aborted, the chunk is dropped (and released) then.
+    bool Push(std::vector<XMLByte>&& chunk);
+    // data must stay valid until release is called, from the parsing thread.
+    bool Push(const XMLByte* data, size_t size, const ReleaseCallback& release);
+
+    // Copies into chunk sized buffers and pushes each one when it is full. For
+    // producers that get their bytes in small pieces, from a single thread.
+    // Bytes still held here would be overtaken by a Push(), use one or the other.
+    bool Write(const void* data, size_t size);
+
+    // End of the message, pushes what Write() still holds.
+    void Close();
+
+    // Drops the pending chunks and wakes both sides. A parse in progress sees
+    // the end of input and fails on the truncated document.
+    void Abort();
+
+    bool IsAborted() const;
+
+    // Parser side, see ChunkedBinInputStream
+    XMLSize_t Read(XMLByte* const toFill, const XMLSize_t maxToRead);
+    XMLFilePos GetPosition() const { return _position; }
+
+private:
+    struct Chunk
+    {
+        std::vector<XMLByte> storage;
+        const XMLByte* data = nullptr;
+        size_t size = 0;
+        ReleaseCallback release;
+    };
+
+    bool Enqueue(Chunk& chunk);
+    bool NextChunk(bool wait);
+    void ReleaseChunk(Chunk& chunk);
+
+    const size_t _chunkSize;
+    const size_t _maxPendingChunks;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::deque<Chunk> _pending;
+    std::vector<std::vector<XMLByte>> _freeBuffers;
+    bool _closed;
+    bool _aborted;
+
+    // Touched by the parsing thread only
+    Chunk _current;
+    size_t _currentOffset;
+    XMLFilePos _position;
+
+    // Touched by the Write() thread only
+    std::vector<XMLByte> _writeBuffer;
+};
+
+// Returns the bytes as soon as some are there instead of waiting for the
+// scanner's whole read request, so parsing keeps pace with the producer.
+class ChunkedBinInputStream : public BinInputStream
+{
+public:
+    ChunkedBinInputStream(const std::shared_ptr<ChunkedByteStream>& stream);
+    // Aborts the stream, a producer blocked on a parser that gave up is let go.
+    ~ChunkedBinInputStream();
+
+    XMLFilePos curPos() const override;
+    XMLSize_t readBytes(XMLByte* const toFill, const XMLSize_t maxToRead) override;
+    const XMLCh* getContentType() const override;
+
+    ChunkedBinInputStream(const ChunkedBinInputStream&) = delete;
+    ChunkedBinInputStream& operator=(const ChunkedBinInputStream&) = delete;
+
+private:
+    std::shared_ptr<ChunkedByteStream> _stream;
+};
+
+// One message, parsed once: makeStream() hands out the single consumer of the stream.
+class ChunkedInputSource : public InputSource
+{
+public:
+    ChunkedInputSource(const std::shared_ptr<ChunkedByteStream>& stream, const std::string& systemId = "Chunked Stream",
+                       MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
+
+    BinInputStream* makeStream() const override;
+
+private:
+    std::shared_ptr<ChunkedByteStream> _stream;
+};
+
+// Producer loop for pipes and sockets: reads the descriptor into recycled
+// chunk buffers until end of file, then closes the stream. Throws
+// std::runtime_error on a read error; the stream is aborted before any
+// exception leaves, so the parser is never left waiting.
+size_t PumpDescriptor(int descriptor, ChunkedByteStream& stream);
@@ -0,0 +1,17 @@
+#include "commandline.h"
+
+#include <stdexcept>
+
+long long ParseCount(const std::string& text, long long minimum, long long maximum)
+{
+    // std::stoll alone would skip white space and accept a sign
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        throw std::invalid_argument("Not a count: " + text);
+
+    long long value = std::stoll(text);
+
+    if (value < minimum || value > maximum)
+        throw std::out_of_range("Count out of range: " + text);
+
+    return value;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Decimal count given on the command line, like --threads N. Anything but
+// digits, a sign included, throws std::invalid_argument and a value outside
+// [minimum, maximum] throws std::out_of_range: both are std::logic_error, the
+// mode prints its usage.
+long long ParseCount(const std::string& text, long long minimum, long long maximum);
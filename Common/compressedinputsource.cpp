@@ -0,0 +1,378 @@
+#include "compressedinputsource.h"
+#include "mappedfileinputsource.h"
+#include "fasttranscode.h"
+
+#include <xercesc/util/XMLException.hpp>
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+    // Compressed bytes read from the file per step
+    const size_t INPUT_BLOCK_SIZE(256 * 1024);
+
+    // Decoded chunks the decoder may run ahead of the parser
+    const size_t PENDING_CHUNKS(4);
+
+    const char* GetCompressionName(Compression compression)
+    {
+        switch (compression)
+        {
+            case Compression::GZIP:
+                return "gzip";
+            case Compression::ZSTD:
+                return "zstd";
+            default:
+                return "none";
+        }
+    }
+
+    bool EndsWith(const std::string& text, const std::string& suffix)
+    {
+        return text.size() > suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Decoded bytes go out in recycled chunk buffers, a full one is pushed to the parser
+    class ChunkWriter
+    {
+    public:
+        ChunkWriter(ChunkedByteStream& output)
+            : _output(output)
+        {
+            Start();
+        }
+
+        XMLByte* GetSpace() { return _chunk.data() + _used; }
+        size_t GetSpaceSize() const { return _chunk.size() - _used; }
+
+        // False when nobody parses the stream any more
+        bool Commit(size_t count)
+        {
+            _used += count;
+
+            return _used < _chunk.size() || Flush();
+        }
+
+        bool Flush()
+        {
+            _chunk.resize(_used);
+
+            bool pushed = _output.Push(std::move(_chunk));
+
+            Start();
+
+            return pushed;
+        }
+
+    private:
+        void Start()
+        {
+            _chunk = _output.AcquireBuffer();
+            _chunk.resize(_output.GetChunkSize());
+            _used = 0;
+        }
+
+        ChunkedByteStream& _output;
+        std::vector<XMLByte> _chunk;
+        size_t _used;
+    };
+
+#ifdef HAVE_ZLIB
+    void DecodeGzip(const std::string& file, BinInputStream& input, ChunkedByteStream& output)
+    {
+        z_stream zs = z_stream();
+
+        // 15 + 32: largest window, gzip or zlib header detected
+        if (inflateInit2(&zs, 15 + 32) != Z_OK)
+            throw std::runtime_error("Cannot initialize the gzip decoder");
+
+        std::vector<XMLByte> block(INPUT_BLOCK_SIZE);
+        ChunkWriter writer(output);
+
+        int status = Z_OK;
+        bool needInput = true;
+
+        try
+        {
+            while (true)
+            {
+                if (zs.avail_in == 0 && needInput)
+                {
+                    zs.next_in = block.data();
+                    zs.avail_in = static_cast<uInt>(input.readBytes(block.data(), block.size()));
+
+                    if (zs.avail_in == 0)
+                        break;
+                }
+
+                // Concatenated gzip members decode as one stream
+                if (status == Z_STREAM_END)
+                    inflateReset(&zs);
+
+                zs.next_out = writer.GetSpace();
+                zs.avail_out = static_cast<uInt>(writer.GetSpaceSize());
+
+                status = inflate(&zs, Z_NO_FLUSH);
+
+                if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+                    throw std::runtime_error("Corrupt gzip data in " + file + ": " + (zs.msg != nullptr ? zs.msg : "inflate failed"));
+
+                // A full output chunk means inflate may hold more without new input
+                needInput = zs.avail_out != 0 || status == Z_STREAM_END;
+
+                if (!writer.Commit(writer.GetSpaceSize() - zs.avail_out))
+                {
+                    inflateEnd(&zs);
+                    return;
+                }
+            }
+
+            if (status != Z_STREAM_END)
+                throw std::runtime_error("Truncated gzip data in " + file);
+        }
+        catch (...)
+        {
+            inflateEnd(&zs);
+            throw;
+        }
+
+        inflateEnd(&zs);
+
+        if (writer.Flush())
+            output.Close();
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    void DecodeZstd(const std::string& file, BinInputStream& input, ChunkedByteStream& output)
+    {
+        std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream*)> stream(ZSTD_createDStream(), ZSTD_freeDStream);
+
+        if (!stream || ZSTD_isError(ZSTD_initDStream(stream.get())))
+            throw std::runtime_error("Cannot initialize the zstd decoder");
+
+        std::vector<XMLByte> block(INPUT_BLOCK_SIZE);
+        ChunkWriter writer(output);
+
+        ZSTD_inBuffer in = { block.data(), 0, 0 };
+
+        // 0 once a frame is decoded and flushed, the next frame starts by itself
+        size_t status = 0;
+        bool needInput = true;
+
+        while (true)
+        {
+            if (in.pos == in.size && needInput)
+            {
+                in.size = input.readBytes(block.data(), block.size());
+                in.pos = 0;
+
+                if (in.size == 0)
+                    break;
+            }
+
+            ZSTD_outBuffer out = { writer.GetSpace(), writer.GetSpaceSize(), 0 };
+
+            status = ZSTD_decompressStream(stream.get(), &out, &in);
+
+            if (ZSTD_isError(status))
+                throw std::runtime_error("Corrupt zstd data in " + file + ": " + ZSTD_getErrorName(status));
+
+            needInput = out.pos < out.size;
+
+            if (!writer.Commit(out.pos))
+                return;
+        }
+
+        if (status != 0)
+            throw std::runtime_error("Truncated zstd data in " + file);
+
+        if (writer.Flush())
+            output.Close();
+    }
+#endif
+
+    void DecodeFile(const std::string& file, Compression compression, ChunkedByteStream& output)
+    {
+        MappedFileInputSource fileInputSource(file);
+        std::unique_ptr<BinInputStream> input(fileInputSource.makeStream());
+
+        if (!input)
+            throw std::runtime_error("Cannot open " + file);
+
+        switch (compression)
+        {
+#ifdef HAVE_ZLIB
+            case Compression::GZIP:
+                DecodeGzip(file, *input, output);
+                break;
+#endif
+#ifdef HAVE_ZSTD
+            case Compression::ZSTD:
+                DecodeZstd(file, *input, output);
+                break;
+#endif
+            default:
+                throw std::runtime_error(std::string("This build cannot decode ") + GetCompressionName(compression) + ": " + file);
+        }
+    }
+
+    // The parser's end of a decoder thread
+    class DecodingBinInputStream : public BinInputStream
+    {
+    public:
+        DecodingBinInputStream(const std::string& file, Compression compression, size_t chunkSize)
+            : _stream(chunkSize, PENDING_CHUNKS)
+        {
+            _decoder = std::thread([this, file, compression]()
+            {
+                // Nothing may escape the thread, BinFileInputStream throws XMLPlatformUtilsException on I/O errors
+                try
+                {
+                    DecodeFile(file, compression, _stream);
+                }
+                catch (const std::exception& e)
+                {
+                    Fail(e.what());
+                }
+                catch (const XMLException& e)
+                {
+                    Fail(::ToUTF8(e.getMessage()));
+                }
+                catch (...)
+                {
+                    Fail("UNKNOWN error occurred while decoding " + file);
+                }
+            });
+        }
+
+        ~DecodingBinInputStream()
+        {
+            // Lets the decoder go when the parse stopped before the end
+            _stream.Abort();
+            _decoder.join();
+        }
+
+        XMLFilePos curPos() const override
+        {
+            return _stream.GetPosition();
+        }
+
+        XMLSize_t readBytes(XMLByte* const toFill, const XMLSize_t maxToRead) override
+        {
+            XMLSize_t count = _stream.Read(toFill, maxToRead);
+
+            if (count == 0)
+            {
+                std::lock_guard<std::mutex> lock(_errorMutex);
+
+                if (!_error.empty())
+                    throw std::runtime_error(_error);
+            }
+
+            return count;
+        }
+
+        const XMLCh* getContentType() const override
+        {
+            return nullptr;
+        }
+
+    private:
+        void Fail(const std::string& error)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_errorMutex);
+                _error = error;
+            }
+
+            _stream.Abort();
+        }
+
+        ChunkedByteStream _stream;
+        std::thread _decoder;
+
+        std::mutex _errorMutex;
+        std::string _error;
+    };
+}
+
+Compression DetectCompression(const std::string& file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    unsigned char magic[4] = { 0 };
+
+    if (stream.read(reinterpret_cast<char*>(magic), sizeof(magic)) || stream.gcount() >= 2)
+    {
+        if (magic[0] == 0x1F && magic[1] == 0x8B)
+            return Compression::GZIP;
+
+        if (magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+            return Compression::ZSTD;
+
+        return Compression::NONE;
+    }
+
+    if (EndsWith(file, ".gz"))
+        return Compression::GZIP;
+
+    if (EndsWith(file, ".zst"))
+        return Compression::ZSTD;
+
+    return Compression::NONE;
+}
+
+bool IsCompressionSupported(Compression compression)
+{
+    switch (compression)
+    {
+        case Compression::NONE:
+            return true;
+#ifdef HAVE_ZLIB
+        case Compression::GZIP:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case Compression::ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+CompressedFileInputSource::CompressedFileInputSource(const std::string& file, Compression compression, size_t chunkSize,
+                                                     MemoryManager* const manager)
+    : InputSource(file.c_str(), manager), _file(file), _compression(compression), _chunkSize(chunkSize)
+{
+}
+
+BinInputStream* CompressedFileInputSource::makeStream() const
+{
+    return new (getMemoryManager()) DecodingBinInputStream(_file, _compression, _chunkSize);
+}
+
+std::unique_ptr<InputSource> CreateFileInputSource(const std::string& file, MemoryManager* const manager)
+{
+    Compression compression = DetectCompression(file);
+
+    if (compression == Compression::NONE)
+        return std::unique_ptr<InputSource>(new MappedFileInputSource(file, manager));
+
+    if (!IsCompressionSupported(compression))
+        throw std::runtime_error(file + " is " + GetCompressionName(compression) + " compressed, this build cannot decode it");
+
+    return std::unique_ptr<InputSource>(new CompressedFileInputSource(file, compression, 256 * 1024, manager));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "chunkedinputsource.h"
+
+#include <xercesc/sax/InputSource.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <memory>
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+enum class Compression
+{
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// From the magic bytes of the file, or from its .gz / .zst extension when it
+// cannot be read.
+Compression DetectCompression(const std::string& file);
+
+// False when the library was not found at build time (HAVE_ZLIB, HAVE_ZSTD).
+bool IsCompressionSupported(Compression compression);
+
+// Decompresses a gzip or zstd file straight into the parser, no temporary
+// file. Each makeStream() starts a decoder thread that fills a
+// ChunkedByteStream while the scanner parses the chunks already decoded. A
+// corrupt or truncated file makes readBytes() throw std::runtime_error, which
+// comes out of the parse call.
+class CompressedFileInputSource : public InputSource
+{
+public:
+    CompressedFileInputSource(const std::string& file, Compression compression, size_t chunkSize = 256 * 1024,
+                              MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
+
+    BinInputStream* makeStream() const override;
+
+private:
+    std::string _file;
+    Compression _compression;
+    size_t _chunkSize;
+};
+
+// CompressedFileInputSource for compressed files, MappedFileInputSource for
+// the others. Throws std::runtime_error when the compression of the file is
+// not supported by this build.
+std::unique_ptr<InputSource> CreateFileInputSource(const std::string& file,
+                                                   MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
@@ -0,0 +1,104 @@
+#include "documentmerge.h"
+#include "fasttranscode.h"
+#include "mappedfileinputsource.h"
+
+#include <xercesc/util/XMLException.hpp>
+
+#include <stdexcept>
+
+namespace
+{
+    size_t CountFollowingSiblings(const DOMNode* first)
+    {
+        size_t count = 0;
+
+        for (const DOMNode* node = first; node != nullptr; node = node->getNextSibling())
+            count++;
+
+        return count;
+    }
+}
+
+void MergeFilesInto(DOMLSParserPool& pool, const std::vector<std::string>& files, DOMNode* target,
+                    MergeStatistics* statistics)
+{
+    auto parser = pool.Acquire(DOMLSParserConfig());
+    DOMLSInput* input = pool.GetImplementation()->createLSInput();
+
+    try
+    {
+        for (auto it = files.begin(); it != files.end(); it++)
+        {
+            DOMNode* lastChild = target->getLastChild();
+
+            MappedFileInputSource fileInputSource(*it);
+            input->setByteStream(&fileInputSource);
+
+            std::string error;
+
+            try
+            {
+                // The scanner creates the nodes with the target's document, nothing is copied afterwards
+                if (parser->parseWithContext(input, target, DOMLSParser::ACTION_APPEND_AS_CHILDREN) == nullptr)
+                    error = "parser returned no content";
+            }
+            catch (const DOMException& ex)
+            {
+                error = ::ToUTF8(ex.getMessage());
+            }
+            catch (const XMLException& ex)
+            {
+                error = ::ToUTF8(ex.getMessage());
+            }
+
+            input->setByteStream(nullptr);
+
+            if (!error.empty())
+                throw std::runtime_error("Cannot merge " + *it + ": " + error);
+
+            if (statistics != nullptr)
+            {
+                statistics->parts++;
+                statistics->movedNodes += CountFollowingSiblings(lastChild != nullptr ? lastChild->getNextSibling() : target->getFirstChild());
+            }
+        }
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
+
+    input->release();
+}
+
+void MergeDocumentInto(DOMDocument* source, DOMNode* target, MergeStatistics* statistics)
+{
+    DOMDocument* targetDocument = target->getOwnerDocument();
+
+    try
+    {
+        for (DOMNode* child = source->getFirstChild(); child != nullptr; child = child->getNextSibling())
+        {
+            if (child->getNodeType() == DOMNode::DOCUMENT_TYPE_NODE)
+                continue;
+
+            // adoptNode() returns nullptr for nodes allocated by another document
+            target->appendChild(targetDocument->importNode(child, true));
+
+            if (statistics != nullptr)
+                statistics->copiedNodes++;
+        }
+    }
+    catch (...)
+    {
+        source->release();
+        throw;
+    }
+
+    if (statistics != nullptr)
+        statistics->parts++;
+
+    // The whole heap of the source goes back at once instead of staying alive next to the copy
+    source->release();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "domlsparserpool.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Builds a composite document out of parts without deep-copying each part.
+//
+// Xerces-C nodes are allocated from the heap of their owner document and
+// adoptNode() refuses nodes of another document, so a subtree cannot move
+// between documents. Parts are parsed straight into the heap of the target
+// document instead. A part that already lives in another document is copied
+// once and that document is released at once, its heap goes back in one step.
+
+struct MergeStatistics
+{
+    size_t parts = 0;
+    // Top-level nodes that ended up under the target without a copy
+    size_t movedNodes = 0;
+    // Top-level nodes that had to be imported from another document
+    size_t copiedNodes = 0;
+};
+
+// Appends the top-level nodes of every file, in order, under target: an
+// element or fragment of the document being built. One pooled parser and
+// one DOMLSInput serve all the parts. Throws std::runtime_error naming the
+// part that failed, the parts before it stay merged.
+void MergeFilesInto(DOMLSParserPool& pool, const std::vector<std::string>& files, DOMNode* target,
+                    MergeStatistics* statistics = nullptr);
+
+// For parts parsed elsewhere: copies the children of source, another
+// document, under target and skips its document type. Takes ownership of
+// source and releases it as soon as the copy is made.
+void MergeDocumentInto(DOMDocument* source, DOMNode* target, MergeStatistics* statistics = nullptr);
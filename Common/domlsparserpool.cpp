@@ -0,0 +1,126 @@
+#include "domlsparserpool.h"
+#include "grammarpool.h"
+
+#include <xercesc/util/XMLUni.hpp>
+
+#include <stdexcept>
+#include <tuple>
+
+bool DOMLSParserConfig::operator<(const DOMLSParserConfig& other) const
+{
+    return std::tie(namespaces, validateIfSchema, userAdoptsDocument, elementContentWhitespace, validateWithGrammarPool) <
+        std::tie(other.namespaces, other.validateIfSchema, other.userAdoptsDocument, other.elementContentWhitespace,
+                 other.validateWithGrammarPool);
+}
+
+DOMLSParserPool::Lease::Lease(DOMLSParserPool& pool, const DOMLSParserConfig& config, DOMLSParser* parser)
+    : _pool(&pool), _config(config), _parser(parser)
+{
+}
+
+DOMLSParserPool::Lease::Lease(Lease&& other)
+    : _pool(other._pool), _config(other._config), _parser(other._parser)
+{
+    other._parser = nullptr;
+}
+
+DOMLSParserPool::Lease::~Lease()
+{
+    if (_parser != nullptr)
+        _pool->Release(_config, _parser);
+}
+
+DOMLSParserPool::DOMLSParserPool(DOMImplementation* impl, size_t maxIdlePerConfig, const SharedGrammarPool* grammarPool)
+    : _impl(impl), _maxIdlePerConfig(maxIdlePerConfig), _grammarPool(grammarPool), _createdCount(0), _reusedCount(0)
+{
+}
+
+DOMLSParserPool::~DOMLSParserPool()
+{
+    for (auto it = _idle.begin(); it != _idle.end(); it++)
+        for (auto parser = it->second.begin(); parser != it->second.end(); parser++)
+            (*parser)->release();
+}
+
+DOMLSParserPool::Lease DOMLSParserPool::Acquire(const DOMLSParserConfig& config)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _idle.find(config);
+        if (found != _idle.end() && !found->second.empty())
+        {
+            DOMLSParser* parser = found->second.back();
+            found->second.pop_back();
+            _reusedCount++;
+
+            return Lease(*this, config, parser);
+        }
+
+        _createdCount++;
+    }
+
+    return Lease(*this, config, Create(config));
+}
+
+size_t DOMLSParserPool::GetCreatedCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _createdCount;
+}
+
+size_t DOMLSParserPool::GetReusedCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _reusedCount;
+}
+
+DOMLSParser* DOMLSParserPool::Create(const DOMLSParserConfig& config)
+{
+    XMLGrammarPool* grammarPool = nullptr;
+
+    if (config.validateWithGrammarPool)
+    {
+        // An unlocked pool would take in the grammars of every parse, from several threads
+        if (_grammarPool == nullptr || !_grammarPool->IsLocked())
+            throw std::runtime_error("Validating parsers need a locked grammar pool");
+
+        grammarPool = _grammarPool->Get();
+    }
+
+    DOMLSParser* parser = _impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0, XMLPlatformUtils::fgMemoryManager, grammarPool);
+
+    DOMConfiguration* domConfig = parser->getDomConfig();
+    domConfig->setParameter(XMLUni::fgDOMNamespaces, config.namespaces);
+    domConfig->setParameter(XMLUni::fgDOMValidateIfSchema, config.validateIfSchema);
+    domConfig->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, config.userAdoptsDocument);
+    domConfig->setParameter(XMLUni::fgDOMElementContentWhitespace, config.elementContentWhitespace);
+
+    if (config.validateWithGrammarPool)
+        _grammarPool->Configure(domConfig);
+
+    return parser;
+}
+
+void DOMLSParserPool::Release(const DOMLSParserConfig& config, DOMLSParser* parser)
+{
+    // Drop per-call state so the next user starts from the pooled configuration
+    parser->getDomConfig()->setParameter(XMLUni::fgDOMErrorHandler, static_cast<const void*>(nullptr));
+
+    // Documents the parser still owns are done with once it comes back
+    if (!config.userAdoptsDocument)
+        parser->resetDocumentPool();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        std::vector<DOMLSParser*>& idle = _idle[config];
+        if (idle.size() < _maxIdlePerConfig)
+        {
+            idle.push_back(parser);
+            return;
+        }
+    }
+
+    parser->release();
+}
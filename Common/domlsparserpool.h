@@ -0,0 +1,82 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+class SharedGrammarPool;
+
+// DOMConfiguration parameters the parse helpers set on a fresh DOMLSParser.
+struct DOMLSParserConfig
+{
+    bool namespaces = true;
+    bool validateIfSchema = false;
+    bool userAdoptsDocument = true;
+    bool elementContentWhitespace = true;
+    // Validates against the pool's grammar pool instead of fgDOMValidateIfSchema
+    bool validateWithGrammarPool = false;
+
+    bool operator<(const DOMLSParserConfig& other) const;
+};
+
+// Thread-safe pool of configured DOMLSParser instances. A parser is created
+// and configured once, then handed out again with its scanner, grammar
+// resolver and string pool already allocated.
+class DOMLSParserPool
+{
+public:
+    // Returns the parser to the pool when it goes out of scope.
+    class Lease
+    {
+    public:
+        Lease(Lease&& other);
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        DOMLSParser* operator->() const { return _parser; }
+        DOMLSParser* Get() const { return _parser; }
+
+    private:
+        friend class DOMLSParserPool;
+
+        Lease(DOMLSParserPool& pool, const DOMLSParserConfig& config, DOMLSParser* parser);
+
+        DOMLSParserPool* _pool;
+        DOMLSParserConfig _config;
+        DOMLSParser* _parser;
+    };
+
+    // Parsers configured with validateWithGrammarPool share grammarPool, which must be locked.
+    DOMLSParserPool(DOMImplementation* impl, size_t maxIdlePerConfig = 8, const SharedGrammarPool* grammarPool = nullptr);
+    ~DOMLSParserPool();
+
+    DOMLSParserPool(const DOMLSParserPool&) = delete;
+    DOMLSParserPool& operator=(const DOMLSParserPool&) = delete;
+
+    Lease Acquire(const DOMLSParserConfig& config);
+
+    DOMImplementation* GetImplementation() const { return _impl; }
+
+    size_t GetCreatedCount() const;
+    size_t GetReusedCount() const;
+
+private:
+    DOMLSParser* Create(const DOMLSParserConfig& config);
+    void Release(const DOMLSParserConfig& config, DOMLSParser* parser);
+
+    DOMImplementation* _impl;
+    const size_t _maxIdlePerConfig;
+    const SharedGrammarPool* _grammarPool;
+
+    mutable std::mutex _mutex;
+    std::map<DOMLSParserConfig, std::vector<DOMLSParser*>> _idle;
+    size_t _createdCount;
+    size_t _reusedCount;
+};
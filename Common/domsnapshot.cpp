@@ -0,0 +1,529 @@
+#include "domsnapshot.h"
+#include "mappedfileinputsource.h"
+
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLUniDefs.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    typedef std::basic_string<XMLCh> XMLChString;
+
+    const char SNAPSHOT_MAGIC[8] = { 'X', 'D', 'O', 'M', 'S', 'N', 'P', '1' };
+
+    // Written in native byte order, a loader on the other endianness reads it back swapped
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    const uint32_t NONE = 0xFFFFFFFF;
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        uint32_t byteOrderMark;
+        uint32_t characterSize;
+        uint64_t nodeCount;
+        uint64_t nodeOffset;
+        uint64_t stringCount;
+        uint64_t stringOffset;
+        uint64_t characterCount;
+        uint64_t characterOffset;
+    };
+
+    // Node 0 is the document. Attributes of an element are chained from
+    // firstAttribute through nextSibling, like children from firstChild.
+    struct SnapshotNode
+    {
+        uint32_t type;
+        uint32_t name;
+        uint32_t namespaceURI;
+        uint32_t value;
+        uint32_t firstChild;
+        uint32_t firstAttribute;
+        uint32_t nextSibling;
+    };
+
+    struct SnapshotString
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    size_t AlignTo8(size_t offset)
+    {
+        return (offset + 7) & ~size_t(7);
+    }
+
+    class SnapshotWriter
+    {
+    public:
+        SnapshotWriter(const DOMDocument* document)
+        {
+            NewNode(DOMNode::DOCUMENT_NODE);
+
+            AppendDescendants(document);
+
+            std::memcpy(_header.magic, SNAPSHOT_MAGIC, sizeof(_header.magic));
+            _header.byteOrderMark = BYTE_ORDER_MARK;
+            _header.characterSize = sizeof(XMLCh);
+            _header.nodeCount = _nodes.size();
+            _header.nodeOffset = AlignTo8(sizeof(SnapshotHeader));
+            _header.stringCount = _strings.size();
+            _header.stringOffset = AlignTo8(_header.nodeOffset + _nodes.size() * sizeof(SnapshotNode));
+            _header.characterCount = _characters.size();
+            _header.characterOffset = AlignTo8(_header.stringOffset + _strings.size() * sizeof(SnapshotString));
+        }
+
+        size_t GetSize() const
+        {
+            return static_cast<size_t>(_header.characterOffset + _characters.size() * sizeof(XMLCh));
+        }
+
+        void Write(const std::string& file) const
+        {
+            std::ofstream stream(file, std::ios::binary | std::ios::trunc);
+
+            if (!stream)
+                throw std::runtime_error("Cannot open " + file + " for writing");
+
+            WriteAt(stream, 0, &_header, sizeof(_header));
+            WriteAt(stream, _header.nodeOffset, _nodes.data(), _nodes.size() * sizeof(SnapshotNode));
+            WriteAt(stream, _header.stringOffset, _strings.data(), _strings.size() * sizeof(SnapshotString));
+            WriteAt(stream, _header.characterOffset, _characters.data(), _characters.size() * sizeof(XMLCh));
+
+            stream.flush();
+
+            if (!stream)
+                throw std::runtime_error("Write failed: " + file);
+        }
+
+        // destination holds GetSize() zeroed bytes. The header goes in last so a
+        // reader of shared memory never sees the magic before the sections.
+        void CopyTo(XMLByte* destination) const
+        {
+            std::memcpy(destination + _header.nodeOffset, _nodes.data(), _nodes.size() * sizeof(SnapshotNode));
+            std::memcpy(destination + _header.stringOffset, _strings.data(), _strings.size() * sizeof(SnapshotString));
+            std::memcpy(destination + _header.characterOffset, _characters.data(), _characters.size() * sizeof(XMLCh));
+            std::memcpy(destination, &_header, sizeof(_header));
+        }
+
+    private:
+        static void WriteAt(std::ofstream& stream, uint64_t offset, const void* data, size_t size)
+        {
+            // Zero padding up to the aligned section start
+            static const char PADDING[8] = {};
+            std::streamoff position = stream.tellp();
+            stream.write(PADDING, static_cast<std::streamsize>(offset - position));
+
+            stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        }
+
+        uint32_t NewNode(DOMNode::NodeType type)
+        {
+            SnapshotNode node;
+            node.type = type;
+            node.name = NONE;
+            node.namespaceURI = NONE;
+            node.value = NONE;
+            node.firstChild = NONE;
+            node.firstAttribute = NONE;
+            node.nextSibling = NONE;
+
+            _nodes.push_back(node);
+
+            return static_cast<uint32_t>(_nodes.size() - 1);
+        }
+
+        uint32_t Intern(const XMLCh* text)
+        {
+            if (text == nullptr)
+                return NONE;
+
+            XMLChString key(text);
+
+            auto found = _stringIds.find(key);
+            if (found != _stringIds.end())
+                return found->second;
+
+            SnapshotString entry;
+            entry.offset = _characters.size();
+            entry.length = key.size();
+
+            _characters.insert(_characters.end(), key.begin(), key.end());
+            _characters.push_back(0);
+
+            uint32_t id = static_cast<uint32_t>(_strings.size());
+            _strings.push_back(entry);
+            _stringIds.emplace(std::move(key), id);
+
+            return id;
+        }
+
+        // Children of source still to add, linked after last under parent. The
+        // content of an entity reference is linked under the frame at owner.
+        struct Frame
+        {
+            const DOMNode* next;
+            uint32_t parent;
+            uint32_t last;
+            size_t owner;
+        };
+
+        // Adds the nodes in document order without recursion, a deeply nested
+        // document must not run out of stack. Entity references are replaced by
+        // their content.
+        void AppendDescendants(const DOMDocument* document)
+        {
+            std::vector<Frame> frames;
+            frames.push_back(Frame { document->getFirstChild(), 0, NONE, 0 });
+
+            while (!frames.empty())
+            {
+                const DOMNode* child = frames.back().next;
+
+                if (child == nullptr)
+                {
+                    frames.pop_back();
+                    continue;
+                }
+
+                frames.back().next = child->getNextSibling();
+
+                size_t owner = frames.back().owner;
+                DOMNode::NodeType type = child->getNodeType();
+
+                if (type == DOMNode::ENTITY_REFERENCE_NODE)
+                {
+                    frames.push_back(Frame { child->getFirstChild(), NONE, NONE, owner });
+                    continue;
+                }
+
+                if (type == DOMNode::DOCUMENT_TYPE_NODE)
+                    continue;
+
+                uint32_t index = AddNode(child);
+
+                // frames may have grown since owner was looked up, only indexes are kept
+                Frame& ownerFrame = frames[owner];
+
+                if (ownerFrame.last == NONE)
+                    _nodes[ownerFrame.parent].firstChild = index;
+                else
+                    _nodes[ownerFrame.last].nextSibling = index;
+
+                ownerFrame.last = index;
+
+                if (type == DOMNode::ELEMENT_NODE)
+                    frames.push_back(Frame { child->getFirstChild(), index, NONE, frames.size() });
+            }
+        }
+
+        // The node and its attributes, AppendDescendants adds the children.
+        // _nodes grows meanwhile, so nodes are only referred to by index.
+        uint32_t AddNode(const DOMNode* source)
+        {
+            uint32_t index = NewNode(source->getNodeType());
+
+            switch (source->getNodeType())
+            {
+                case DOMNode::ELEMENT_NODE:
+                {
+                    _nodes[index].name = Intern(source->getNodeName());
+                    _nodes[index].namespaceURI = Intern(source->getNamespaceURI());
+
+                    DOMNamedNodeMap* attributes = source->getAttributes();
+                    uint32_t lastAttribute = NONE;
+
+                    for (XMLSize_t i = 0; attributes != nullptr && i < attributes->getLength(); i++)
+                    {
+                        uint32_t attribute = AddNode(attributes->item(i));
+
+                        if (lastAttribute == NONE)
+                            _nodes[index].firstAttribute = attribute;
+                        else
+                            _nodes[lastAttribute].nextSibling = attribute;
+
+                        lastAttribute = attribute;
+                    }
+
+                    break;
+                }
+                case DOMNode::ATTRIBUTE_NODE:
+                {
+                    _nodes[index].name = Intern(source->getNodeName());
+                    _nodes[index].namespaceURI = Intern(source->getNamespaceURI());
+                    _nodes[index].value = Intern(source->getNodeValue());
+                    break;
+                }
+                case DOMNode::PROCESSING_INSTRUCTION_NODE:
+                {
+                    _nodes[index].name = Intern(source->getNodeName());
+                    _nodes[index].value = Intern(source->getNodeValue());
+                    break;
+                }
+                default:
+                {
+                    _nodes[index].value = Intern(source->getNodeValue());
+                    break;
+                }
+            }
+
+            return index;
+        }
+
+        SnapshotHeader _header;
+        std::vector<SnapshotNode> _nodes;
+        std::vector<SnapshotString> _strings;
+        std::vector<XMLCh> _characters;
+        std::unordered_map<XMLChString, uint32_t> _stringIds;
+    };
+
+    class SnapshotLoader
+    {
+    public:
+        SnapshotLoader(const XMLByte* data, uint64_t size)
+            : _view(data, static_cast<size_t>(size))
+        {
+        }
+
+        DOMDocument* Load(DOMImplementation* impl)
+        {
+            DOMDocument* document = impl->createDocument();
+
+            try
+            {
+                LoadDescendants(document);
+            }
+            catch (...)
+            {
+                document->release();
+                throw;
+            }
+
+            return document;
+        }
+
+    private:
+        DOMElement* CreateElement(DOMDocument* document, uint32_t node, size_t& visited) const
+        {
+            const XMLCh* name = _view.GetName(node);
+            const XMLCh* namespaceURI = _view.GetNamespaceURI(node);
+
+            // Documents parsed without namespaces keep prefixed names and no URI
+            DOMElement* element = namespaceURI == nullptr && XMLString::indexOf(name, chColon) != -1
+                ? document->createElement(name)
+                : document->createElementNS(namespaceURI, name);
+
+            for (uint32_t attribute = _view.GetFirstAttribute(node); attribute != NONE; attribute = _view.GetNextSibling(attribute))
+            {
+                Visit(visited);
+
+                const XMLCh* attributeName = _view.GetName(attribute);
+                const XMLCh* attributeNamespaceURI = _view.GetNamespaceURI(attribute);
+
+                if (attributeNamespaceURI == nullptr && XMLString::indexOf(attributeName, chColon) != -1)
+                    element->setAttribute(attributeName, _view.GetValue(attribute));
+                else
+                    element->setAttributeNS(attributeNamespaceURI, attributeName, _view.GetValue(attribute));
+            }
+
+            return element;
+        }
+
+        // Every node of the image is reached once, more visits than nodes
+        // means the links of a corrupt image run in a cycle
+        void Visit(size_t& visited) const
+        {
+            if (++visited >= _view.GetNodeCount())
+                throw std::runtime_error("DOM snapshot is corrupt");
+        }
+
+        // Document order without recursion, like SnapshotWriter::AppendDescendants
+        void LoadDescendants(DOMDocument* document) const
+        {
+            // Next node to create under each open parent
+            std::vector<std::pair<uint32_t, DOMNode*>> frames;
+            frames.push_back(std::make_pair(_view.GetFirstChild(0), static_cast<DOMNode*>(document)));
+
+            size_t visited = 0;
+
+            while (!frames.empty())
+            {
+                uint32_t node = frames.back().first;
+                DOMNode* parent = frames.back().second;
+
+                if (node == NONE)
+                {
+                    frames.pop_back();
+                    continue;
+                }
+
+                frames.back().first = _view.GetNextSibling(node);
+
+                Visit(visited);
+
+                DOMNode::NodeType type = _view.GetNodeType(node);
+                DOMNode* created;
+
+                switch (type)
+                {
+                    case DOMNode::ELEMENT_NODE:
+                        created = CreateElement(document, node, visited);
+                        break;
+                    case DOMNode::TEXT_NODE:
+                        created = document->createTextNode(_view.GetValue(node));
+                        break;
+                    case DOMNode::CDATA_SECTION_NODE:
+                        created = document->createCDATASection(_view.GetValue(node));
+                        break;
+                    case DOMNode::COMMENT_NODE:
+                        created = document->createComment(_view.GetValue(node));
+                        break;
+                    case DOMNode::PROCESSING_INSTRUCTION_NODE:
+                        created = document->createProcessingInstruction(_view.GetName(node), _view.GetValue(node));
+                        break;
+                    default:
+                        throw std::runtime_error("DOM snapshot is corrupt");
+                }
+
+                parent->appendChild(created);
+
+                if (type == DOMNode::ELEMENT_NODE)
+                    frames.push_back(std::make_pair(_view.GetFirstChild(node), created));
+            }
+        }
+
+        DOMSnapshotView _view;
+    };
+}
+
+void WriteDOMSnapshot(const DOMDocument* document, const std::string& file)
+{
+    SnapshotWriter writer(document);
+    writer.Write(file);
+}
+
+size_t WriteDOMSnapshot(const DOMDocument* document, const std::function<XMLByte*(size_t)>& allocate)
+{
+    SnapshotWriter writer(document);
+
+    size_t size = writer.GetSize();
+    writer.CopyTo(allocate(size));
+
+    return size;
+}
+
+DOMDocument* LoadDOMSnapshot(const std::string& file, DOMImplementation* impl)
+{
+    MappedFileBinInputStream mappedFile(file);
+
+    if (!mappedFile.IsMapped())
+        throw std::runtime_error("Cannot map " + file);
+
+    return ::LoadDOMSnapshot(mappedFile.GetData(), mappedFile.GetSize(), impl);
+}
+
+DOMDocument* LoadDOMSnapshot(const XMLByte* data, size_t size, DOMImplementation* impl)
+{
+    SnapshotLoader loader(data, size);
+
+    return loader.Load(impl);
+}
+
+const uint32_t DOMSnapshotView::NO_NODE;
+
+DOMSnapshotView::DOMSnapshotView(const XMLByte* data, size_t size)
+    : _data(data)
+{
+    if (size < sizeof(SnapshotHeader))
+        throw std::runtime_error("Not a DOM snapshot");
+
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data);
+
+    if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+        throw std::runtime_error("Not a DOM snapshot");
+
+    if (header->byteOrderMark != BYTE_ORDER_MARK || header->characterSize != sizeof(XMLCh))
+        throw std::runtime_error("DOM snapshot was written on another platform");
+
+    if (header->nodeCount == 0 ||
+        header->nodeOffset + header->nodeCount * sizeof(SnapshotNode) > size ||
+        header->stringOffset + header->stringCount * sizeof(SnapshotString) > size ||
+        header->characterOffset + header->characterCount * sizeof(XMLCh) > size)
+        throw std::runtime_error("DOM snapshot is truncated");
+
+    _nodeOffset = header->nodeOffset;
+    _nodeCount = header->nodeCount;
+    _stringOffset = header->stringOffset;
+    _stringCount = header->stringCount;
+    _characterOffset = header->characterOffset;
+    _characterCount = header->characterCount;
+}
+
+namespace
+{
+    const SnapshotNode& GetNode(const XMLByte* data, uint64_t nodeOffset, uint64_t nodeCount, uint32_t index)
+    {
+        if (index >= nodeCount)
+            throw std::runtime_error("DOM snapshot is corrupt");
+
+        return reinterpret_cast<const SnapshotNode*>(data + nodeOffset)[index];
+    }
+}
+
+// Strings are NUL terminated in the image, the DOM copies them straight from there
+const XMLCh* DOMSnapshotView::GetString(uint32_t id) const
+{
+    if (id == NONE)
+        return nullptr;
+
+    if (id >= _stringCount)
+        throw std::runtime_error("DOM snapshot is corrupt");
+
+    const SnapshotString& string = reinterpret_cast<const SnapshotString*>(_data + _stringOffset)[id];
+
+    if (string.offset + string.length >= _characterCount)
+        throw std::runtime_error("DOM snapshot is corrupt");
+
+    return reinterpret_cast<const XMLCh*>(_data + _characterOffset) + string.offset;
+}
+
+DOMNode::NodeType DOMSnapshotView::GetNodeType(uint32_t node) const
+{
+    return static_cast<DOMNode::NodeType>(GetNode(_data, _nodeOffset, _nodeCount, node).type);
+}
+
+const XMLCh* DOMSnapshotView::GetName(uint32_t node) const
+{
+    return GetString(GetNode(_data, _nodeOffset, _nodeCount, node).name);
+}
+
+const XMLCh* DOMSnapshotView::GetNamespaceURI(uint32_t node) const
+{
+    return GetString(GetNode(_data, _nodeOffset, _nodeCount, node).namespaceURI);
+}
+
+const XMLCh* DOMSnapshotView::GetValue(uint32_t node) const
+{
+    return GetString(GetNode(_data, _nodeOffset, _nodeCount, node).value);
+}
+
+uint32_t DOMSnapshotView::GetFirstChild(uint32_t node) const
+{
+    return GetNode(_data, _nodeOffset, _nodeCount, node).firstChild;
+}
+
+uint32_t DOMSnapshotView::GetFirstAttribute(uint32_t node) const
+{
+    return GetNode(_data, _nodeOffset, _nodeCount, node).firstAttribute;
+}
+
+uint32_t DOMSnapshotView::GetNextSibling(uint32_t node) const
+{
+    return GetNode(_data, _nodeOffset, _nodeCount, node).nextSibling;
+}
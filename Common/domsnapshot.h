@@ -0,0 +1,69 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Binary image of a parsed document, written once and loaded by many processes
+// without going through the XML scanner again. The file is mapped on load:
+//
+//   header     magic, byte order mark, node and string counts, section offsets
+//   nodes      fixed size records in document order, links are node indexes
+//   strings    offset and length of every distinct name, URI and value
+//   characters NUL terminated UTF-16 code units, handed to the DOM as they are
+//
+// Element and attribute names, namespace URIs and repeated text are interned.
+// Entity references are expanded and the document type is not kept.
+
+// Throws std::runtime_error when the file cannot be written.
+void WriteDOMSnapshot(const DOMDocument* document, const std::string& file);
+
+// Writes the snapshot to memory returned by allocate(size), which must be
+// zero filled. Returns the size.
+size_t WriteDOMSnapshot(const DOMDocument* document, const std::function<XMLByte*(size_t)>& allocate);
+
+// Rebuilds the document with impl, the caller owns the result. Throws
+// std::runtime_error when the file is missing, truncated, corrupt or from
+// another platform. Neither the writer nor the loader recurses, any depth works.
+DOMDocument* LoadDOMSnapshot(const std::string& file, DOMImplementation* impl);
+DOMDocument* LoadDOMSnapshot(const XMLByte* data, size_t size, DOMImplementation* impl);
+
+// Read-only access to a snapshot where it lies, for lookups that need no DOM.
+// Nodes are addressed by index in document order, 0 is the document and
+// NO_NODE ends a chain. Attributes of an element are chained from
+// GetFirstAttribute() through GetNextSibling(). Names are qualified names,
+// strings point into the image and are NUL terminated.
+class DOMSnapshotView
+{
+public:
+    static const uint32_t NO_NODE = 0xFFFFFFFF;
+
+    // Throws std::runtime_error when data is not a snapshot of this platform.
+    DOMSnapshotView(const XMLByte* data, size_t size);
+
+    size_t GetNodeCount() const { return static_cast<size_t>(_nodeCount); }
+
+    // Throw std::runtime_error on an index or string outside the image
+    DOMNode::NodeType GetNodeType(uint32_t node) const;
+    const XMLCh* GetName(uint32_t node) const;
+    const XMLCh* GetNamespaceURI(uint32_t node) const;
+    const XMLCh* GetValue(uint32_t node) const;
+    uint32_t GetFirstChild(uint32_t node) const;
+    uint32_t GetFirstAttribute(uint32_t node) const;
+    uint32_t GetNextSibling(uint32_t node) const;
+
+private:
+    const XMLCh* GetString(uint32_t id) const;
+
+    const XMLByte* _data;
+    uint64_t _nodeOffset;
+    uint64_t _nodeCount;
+    uint64_t _stringOffset;
+    uint64_t _stringCount;
+    uint64_t _characterOffset;
+    uint64_t _characterCount;
+};
@@ -0,0 +1,292 @@
+#include "fasttranscode.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FAST_TRANSCODE_SSE2
+#endif
+
+namespace
+{
+    const XMLCh REPLACEMENT_CHARACTER(0xFFFD);
+
+    const size_t CACHED_STRING_CAPACITY(4096);
+
+    // Copies the leading ASCII bytes of source, returns how many
+    size_t WidenAscii(const unsigned char* source, size_t length, XMLCh* target)
+    {
+        size_t i = 0;
+
+#ifdef FAST_TRANSCODE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+            if (_mm_movemask_epi8(bytes) != 0)
+                break;
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i + 8), _mm_unpackhi_epi8(bytes, zero));
+        }
+#else
+        for (; i + 8 <= length; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, source + i, sizeof(word));
+
+            if ((word & 0x8080808080808080ULL) != 0)
+                break;
+
+            for (size_t j = 0; j < 8; j++)
+                target[i + j] = source[i + j];
+        }
+#endif
+
+        for (; i < length && source[i] < 0x80; i++)
+            target[i] = source[i];
+
+        return i;
+    }
+
+    // Copies the leading ASCII code units of source, returns how many
+    size_t NarrowAscii(const XMLCh* source, size_t length, unsigned char* target)
+    {
+        size_t i = 0;
+
+#ifdef FAST_TRANSCODE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8));
+            __m128i outside = _mm_and_si128(_mm_or_si128(low, high), nonAscii);
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(outside, zero)) != 0xFFFF)
+                break;
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_packus_epi16(low, high));
+        }
+#endif
+
+        for (; i < length && source[i] < 0x80; i++)
+            target[i] = static_cast<unsigned char>(source[i]);
+
+        return i;
+    }
+
+    // Decodes one multi-byte sequence at source[i], returns its length or 0 when it is malformed
+    size_t DecodeSequence(const unsigned char* source, size_t length, size_t i, uint32_t& codePoint)
+    {
+        unsigned char lead = source[i];
+        size_t count;
+
+        if (lead < 0xC2)
+            return 0;
+        else if (lead < 0xE0)
+        {
+            count = 2;
+            codePoint = lead & 0x1F;
+        }
+        else if (lead < 0xF0)
+        {
+            count = 3;
+            codePoint = lead & 0x0F;
+        }
+        else if (lead < 0xF5)
+        {
+            count = 4;
+            codePoint = lead & 0x07;
+        }
+        else
+            return 0;
+
+        if (length - i < count)
+            return 0;
+
+        for (size_t j = 1; j < count; j++)
+        {
+            if ((source[i + j] & 0xC0) != 0x80)
+                return 0;
+
+            codePoint = (codePoint << 6) | (source[i + j] & 0x3F);
+        }
+
+        // Overlong forms, surrogates and values past U+10FFFF
+        if (count == 3 && (codePoint < 0x800 || (codePoint >= 0xD800 && codePoint <= 0xDFFF)))
+            return 0;
+
+        if (count == 4 && (codePoint < 0x10000 || codePoint > 0x10FFFF))
+            return 0;
+
+        return count;
+    }
+
+    struct ScratchBuffers
+    {
+        std::array<std::basic_string<XMLCh>, SCRATCH_BUFFER_COUNT> wide;
+        std::array<std::string, SCRATCH_BUFFER_COUNT> narrow;
+        size_t nextWide = 0;
+        size_t nextNarrow = 0;
+    };
+
+    thread_local ScratchBuffers scratchBuffers;
+
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, std::basic_string<XMLCh>> cachedStrings;
+}
+
+void TranscodeUTF8(const char* text, size_t length, std::basic_string<XMLCh>& result)
+{
+    // Never more code units than bytes, a 4 byte sequence becomes a surrogate pair
+    result.resize(length);
+
+    const unsigned char* source = reinterpret_cast<const unsigned char*>(text);
+    XMLCh* target = &result[0];
+    size_t i = 0;
+    size_t written = 0;
+
+    while (i < length)
+    {
+        size_t ascii = WidenAscii(source + i, length - i, target + written);
+        i += ascii;
+        written += ascii;
+
+        if (i == length)
+            break;
+
+        uint32_t codePoint;
+        size_t count = DecodeSequence(source, length, i, codePoint);
+
+        if (count == 0)
+        {
+            target[written++] = REPLACEMENT_CHARACTER;
+            i++;
+        }
+        else if (codePoint >= 0x10000)
+        {
+            codePoint -= 0x10000;
+            target[written++] = static_cast<XMLCh>(0xD800 + (codePoint >> 10));
+            target[written++] = static_cast<XMLCh>(0xDC00 + (codePoint & 0x3FF));
+            i += count;
+        }
+        else
+        {
+            target[written++] = static_cast<XMLCh>(codePoint);
+            i += count;
+        }
+    }
+
+    result.resize(written);
+}
+
+void TranscodeXMLCh(const XMLCh* text, size_t length, std::string& result)
+{
+    // At most 3 bytes per code unit, a surrogate pair takes 4 bytes for 2 units
+    result.resize(length * 3);
+
+    unsigned char* target = reinterpret_cast<unsigned char*>(&result[0]);
+    size_t i = 0;
+    size_t written = 0;
+
+    while (i < length)
+    {
+        size_t ascii = NarrowAscii(text + i, length - i, target + written);
+        i += ascii;
+        written += ascii;
+
+        if (i == length)
+            break;
+
+        uint32_t codePoint = text[i++];
+
+        if (codePoint >= 0xD800 && codePoint <= 0xDBFF && i < length && text[i] >= 0xDC00 && text[i] <= 0xDFFF)
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (text[i++] - 0xDC00);
+        else if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+            codePoint = REPLACEMENT_CHARACTER;
+
+        if (codePoint < 0x800)
+        {
+            target[written++] = static_cast<unsigned char>(0xC0 | (codePoint >> 6));
+        }
+        else if (codePoint < 0x10000)
+        {
+            target[written++] = static_cast<unsigned char>(0xE0 | (codePoint >> 12));
+            target[written++] = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3F));
+        }
+        else
+        {
+            target[written++] = static_cast<unsigned char>(0xF0 | (codePoint >> 18));
+            target[written++] = static_cast<unsigned char>(0x80 | ((codePoint >> 12) & 0x3F));
+            target[written++] = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3F));
+        }
+
+        target[written++] = static_cast<unsigned char>(0x80 | (codePoint & 0x3F));
+    }
+
+    result.resize(written);
+}
+
+std::string ToUTF8(const XMLCh* text)
+{
+    std::string result;
+
+    if (text != nullptr)
+        TranscodeXMLCh(text, std::char_traits<XMLCh>::length(text), result);
+
+    return result;
+}
+
+const XMLCh* ScratchXMLCh(const std::string& text)
+{
+    std::basic_string<XMLCh>& buffer = scratchBuffers.wide[scratchBuffers.nextWide];
+    scratchBuffers.nextWide = (scratchBuffers.nextWide + 1) % SCRATCH_BUFFER_COUNT;
+
+    TranscodeUTF8(text.data(), text.size(), buffer);
+
+    return buffer.c_str();
+}
+
+const char* ScratchUTF8(const XMLCh* text)
+{
+    std::string& buffer = scratchBuffers.narrow[scratchBuffers.nextNarrow];
+    scratchBuffers.nextNarrow = (scratchBuffers.nextNarrow + 1) % SCRATCH_BUFFER_COUNT;
+
+    if (text == nullptr)
+        buffer.clear();
+    else
+        TranscodeXMLCh(text, std::char_traits<XMLCh>::length(text), buffer);
+
+    return buffer.c_str();
+}
+
+const XMLCh* CachedXMLCh(const std::string& text)
+{
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        // Map nodes do not move on rehash, the pointers handed out stay valid
+        auto found = cachedStrings.find(text);
+
+        if (found != cachedStrings.end())
+            return found->second.c_str();
+
+        if (cachedStrings.size() < CACHED_STRING_CAPACITY)
+        {
+            std::basic_string<XMLCh>& converted = cachedStrings[text];
+            TranscodeUTF8(text.data(), text.size(), converted);
+
+            return converted.c_str();
+        }
+    }
+
+    return ScratchXMLCh(text);
+}
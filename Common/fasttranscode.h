@@ -0,0 +1,33 @@
+#pragma once
+
+#include <xercesc/util/XercesDefs.hpp>
+
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+// UTF-8 <-> XMLCh (UTF-16) conversion without the Xerces transcoding service.
+// Runs of ASCII, which is nearly everything in XPath texts, names and error
+// messages, are widened or narrowed 16 bytes at a time with SSE2 where the
+// target has it. Malformed input is replaced with U+FFFD instead of throwing.
+
+// Replace the content of result, its capacity is kept.
+void TranscodeUTF8(const char* text, size_t length, std::basic_string<XMLCh>& result);
+void TranscodeXMLCh(const XMLCh* text, size_t length, std::string& result);
+
+// nullptr gives an empty string.
+std::string ToUTF8(const XMLCh* text);
+
+// Conversions into a small ring of thread-local buffers, no allocation once
+// the buffers have grown. A result stays valid on the calling thread until
+// SCRATCH_BUFFER_COUNT more conversions of the same direction, enough for
+// the arguments of one call.
+const size_t SCRATCH_BUFFER_COUNT(4);
+
+const XMLCh* ScratchXMLCh(const std::string& text);
+const char* ScratchUTF8(const XMLCh* text);
+
+// Process-wide cache for strings converted again and again, XPath texts,
+// encoding and attribute names. Entries are never evicted, the result is
+// valid until exit. Once full, new strings get a scratch buffer instead.
+const XMLCh* CachedXMLCh(const std::string& text);
@@ -0,0 +1,79 @@
+#include "grammarpool.h"
+
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/internal/XMLGrammarPoolImpl.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <xercesc/validators/common/Grammar.hpp>
+
+#include <stdexcept>
+
+namespace
+{
+    bool IsDTD(const std::string& file)
+    {
+        const std::string DTD_EXTENSION(".dtd");
+
+        return file.size() > DTD_EXTENSION.size() &&
+            file.compare(file.size() - DTD_EXTENSION.size(), DTD_EXTENSION.size(), DTD_EXTENSION) == 0;
+    }
+}
+
+SharedGrammarPool::SharedGrammarPool(MemoryManager* const manager)
+    : _manager(manager), _pool(new XMLGrammarPoolImpl(manager)), _grammarCount(0), _locked(false)
+{
+}
+
+SharedGrammarPool::~SharedGrammarPool()
+{
+}
+
+void SharedGrammarPool::Load(const std::vector<std::string>& files)
+{
+    if (_locked)
+        throw std::runtime_error("The grammar pool is locked, grammars must be loaded before Lock()");
+
+    XercesDOMParser parser(nullptr, _manager, _pool.get());
+    parser.setDoNamespaces(true);
+    parser.setDoSchema(true);
+    parser.setHandleMultipleImports(true);
+    parser.setValidationSchemaFullChecking(true);
+
+    for (auto it = files.begin(); it != files.end(); it++)
+    {
+        Grammar::GrammarType type = IsDTD(*it) ? Grammar::DTDGrammarType : Grammar::SchemaGrammarType;
+
+        // toCache puts the compiled grammar, and the schemas it imports, into the pool
+        Grammar* grammar = parser.loadGrammar(it->c_str(), type, true);
+
+        if (grammar == nullptr || parser.getErrorCount() > 0)
+            throw std::runtime_error("Cannot compile grammar " + *it);
+
+        _grammarCount++;
+    }
+}
+
+void SharedGrammarPool::Lock()
+{
+    if (_locked)
+        return;
+
+    _pool->lockPool();
+    _locked = true;
+}
+
+void SharedGrammarPool::Configure(XercesDOMParser& parser) const
+{
+    parser.setValidationScheme(XercesDOMParser::Val_Always);
+    parser.setDoNamespaces(true);
+    parser.setDoSchema(true);
+    parser.useCachedGrammarInParse(true);
+    parser.setLoadSchema(false);
+}
+
+void SharedGrammarPool::Configure(DOMConfiguration* domConfig) const
+{
+    domConfig->setParameter(XMLUni::fgDOMValidate, true);
+    domConfig->setParameter(XMLUni::fgXercesSchema, true);
+    domConfig->setParameter(XMLUni::fgXercesUseCachedGrammarInParse, true);
+    domConfig->setParameter(XMLUni::fgXercesLoadSchema, false);
+}
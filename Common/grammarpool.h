@@ -0,0 +1,50 @@
+#pragma once
+
+#include <xercesc/framework/XMLGrammarPool.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Schemas and DTDs compiled once and shared by every parser of the process.
+// Grammars are loaded while the pool is still private to one thread, then
+// Lock() makes it read-only: parsers use the compiled grammars and the
+// synchronized string pool, nothing is added or recompiled any more, so any
+// number of threads can validate against it at once.
+class SharedGrammarPool
+{
+public:
+    SharedGrammarPool(MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
+    ~SharedGrammarPool();
+
+    SharedGrammarPool(const SharedGrammarPool&) = delete;
+    SharedGrammarPool& operator=(const SharedGrammarPool&) = delete;
+
+    // .dtd files are compiled as DTDs, everything else as XML Schema. Throws
+    // std::runtime_error naming the grammar that does not compile, or when
+    // the pool is already locked.
+    void Load(const std::vector<std::string>& files);
+
+    void Lock();
+    bool IsLocked() const { return _locked; }
+
+    size_t GetGrammarCount() const { return _grammarCount; }
+
+    // For the parser constructors and createLSParser()
+    XMLGrammarPool* Get() const { return _pool.get(); }
+
+    // Validates every document against the pooled grammars only: schemaLocation
+    // hints are not loaded and a document without a matching grammar is an error.
+    void Configure(XercesDOMParser& parser) const;
+    void Configure(DOMConfiguration* domConfig) const;
+
+private:
+    MemoryManager* const _manager;
+    std::unique_ptr<XMLGrammarPool> _pool;
+    size_t _grammarCount;
+    bool _locked;
+};
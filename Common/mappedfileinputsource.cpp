@@ -0,0 +1,161 @@
+#include "mappedfileinputsource.h"
+
+#include <xercesc/util/BinFileInputStream.hpp>
+#include <xercesc/util/XMLString.hpp>
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Pages behind the read position are handed back to the kernel in steps of
+    // this size, so resident memory stays flat on multi-GB files
+    const XMLSize_t RELEASE_WINDOW(64 * 1024 * 1024);
+}
+
+MappedFileInputSource::MappedFileInputSource(const std::string& file, MemoryManager* const manager)
+    : InputSource(file.c_str(), manager), _file(file)
+{
+}
+
+BinInputStream* MappedFileInputSource::makeStream() const
+{
+    MappedFileBinInputStream* mappedStream = new (getMemoryManager()) MappedFileBinInputStream(_file);
+
+    if (mappedStream->IsMapped())
+        return mappedStream;
+
+    delete mappedStream;
+
+    BinFileInputStream* fileStream = new (getMemoryManager()) BinFileInputStream(_file.c_str(), getMemoryManager());
+
+    if (fileStream->getIsOpen())
+        return fileStream;
+
+    delete fileStream;
+
+    return nullptr;
+}
+
+#ifdef _WIN32
+
+MappedFileBinInputStream::MappedFileBinInputStream(const std::string& file)
+    : _data(nullptr), _size(0), _position(0), _releasedUpTo(0), _fileHandle(INVALID_HANDLE_VALUE), _mappingHandle(nullptr)
+{
+    _fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (_fileHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(_fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        return;
+
+    _mappingHandle = CreateFileMappingA(_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (_mappingHandle == nullptr)
+        return;
+
+    _data = static_cast<const XMLByte*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    _size = static_cast<XMLSize_t>(fileSize.QuadPart);
+}
+
+MappedFileBinInputStream::~MappedFileBinInputStream()
+{
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+
+    if (_mappingHandle != nullptr)
+        CloseHandle(_mappingHandle);
+
+    if (_fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(_fileHandle);
+}
+
+void MappedFileBinInputStream::ReleaseConsumedPages()
+{
+    // The view is released as a whole on Windows, FILE_FLAG_SEQUENTIAL_SCAN already limits the cache footprint
+}
+
+#else
+
+MappedFileBinInputStream::MappedFileBinInputStream(const std::string& file)
+    : _data(nullptr), _size(0), _position(0), _releasedUpTo(0)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    struct stat info;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+
+            _data = static_cast<const XMLByte*>(data);
+            _size = static_cast<XMLSize_t>(info.st_size);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFileBinInputStream::~MappedFileBinInputStream()
+{
+    if (_data != nullptr)
+        munmap(const_cast<XMLByte*>(_data), _size);
+}
+
+void MappedFileBinInputStream::ReleaseConsumedPages()
+{
+    if (_position - _releasedUpTo < RELEASE_WINDOW)
+        return;
+
+    // _releasedUpTo stays page aligned because RELEASE_WINDOW is a multiple of the page size
+    XMLSize_t length = (_position - _releasedUpTo) / RELEASE_WINDOW * RELEASE_WINDOW;
+
+    madvise(const_cast<XMLByte*>(_data) + _releasedUpTo, length, MADV_DONTNEED);
+    _releasedUpTo += length;
+}
+
+#endif
+
+XMLFilePos MappedFileBinInputStream::curPos() const
+{
+    return _position;
+}
+
+XMLSize_t MappedFileBinInputStream::readBytes(XMLByte* const toFill, const XMLSize_t maxToRead)
+{
+    XMLSize_t count = _size - _position;
+
+    if (count > maxToRead)
+        count = maxToRead;
+
+    std::memcpy(toFill, _data + _position, count);
+    _position += count;
+
+    ReleaseConsumedPages();
+
+    return count;
+}
+
+const XMLCh* MappedFileBinInputStream::getContentType() const
+{
+    return nullptr;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <xercesc/sax/InputSource.hpp>
+#include <xercesc/util/BinInputStream.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Reads a file through a read-only memory mapping with a sequential access
+// hint, so the scanner copies straight out of the page cache instead of going
+// through buffered reads. Falls back to BinFileInputStream, the stream used by
+// LocalFileInputSource, when the file cannot be mapped (empty files, pipes...).
+class MappedFileInputSource : public InputSource
+{
+public:
+    MappedFileInputSource(const std::string& file, MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
+
+    BinInputStream* makeStream() const override;
+
+private:
+    std::string _file;
+};
+
+class MappedFileBinInputStream : public BinInputStream
+{
+public:
+    // Check IsMapped() before use, a failed mapping leaves the stream empty.
+    MappedFileBinInputStream(const std::string& file);
+    ~MappedFileBinInputStream();
+
+    bool IsMapped() const { return _data != nullptr; }
+
+    // The whole mapped file, for callers that scan the bytes themselves.
+    const XMLByte* GetData() const { return _data; }
+    XMLSize_t GetSize() const { return _size; }
+
+    XMLFilePos curPos() const override;
+    XMLSize_t readBytes(XMLByte* const toFill, const XMLSize_t maxToRead) override;
+    const XMLCh* getContentType() const override;
+
+    MappedFileBinInputStream(const MappedFileBinInputStream&) = delete;
+    MappedFileBinInputStream& operator=(const MappedFileBinInputStream&) = delete;
+
+private:
+    void ReleaseConsumedPages();
+
+    const XMLByte* _data;
+    XMLSize_t _size;
+    XMLSize_t _position;
+    XMLSize_t _releasedUpTo;
+
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#endif
+};
@@ -0,0 +1,609 @@
+#include "parallelrecordparser.h"
+#include "mappedfileinputsource.h"
+
+#include <xercesc/sax/InputSource.hpp>
+#include <xercesc/util/BinInputStream.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    long long GetNanos()
+    {
+        auto duration = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    struct Segment
+    {
+        const XMLByte* data;
+        XMLSize_t size;
+    };
+
+    // Bytes of one chunk: the prolog and root start tag, the records, the root end tag
+    struct RecordChunk
+    {
+        Segment segments[3];
+        size_t segmentCount;
+    };
+
+    class RecordChunkBinInputStream : public BinInputStream
+    {
+    public:
+        RecordChunkBinInputStream(const RecordChunk& chunk)
+            : _chunk(chunk), _segment(0), _offset(0), _position(0)
+        {
+        }
+
+        XMLFilePos curPos() const override
+        {
+            return _position;
+        }
+
+        XMLSize_t readBytes(XMLByte* const toFill, const XMLSize_t maxToRead) override
+        {
+            XMLSize_t count = 0;
+
+            while (count < maxToRead && _segment < _chunk.segmentCount)
+            {
+                const Segment& segment = _chunk.segments[_segment];
+                XMLSize_t length = std::min(maxToRead - count, segment.size - _offset);
+
+                std::memcpy(toFill + count, segment.data + _offset, length);
+
+                count += length;
+                _offset += length;
+
+                if (_offset == segment.size)
+                {
+                    _segment++;
+                    _offset = 0;
+                }
+            }
+
+            _position += count;
+
+            return count;
+        }
+
+        const XMLCh* getContentType() const override
+        {
+            return nullptr;
+        }
+
+    private:
+        const RecordChunk& _chunk;
+        size_t _segment;
+        XMLSize_t _offset;
+        XMLFilePos _position;
+    };
+
+    class RecordChunkInputSource : public InputSource
+    {
+    public:
+        RecordChunkInputSource(const std::string& systemId, const RecordChunk& chunk)
+            : InputSource(systemId.c_str()), _chunk(chunk)
+        {
+        }
+
+        BinInputStream* makeStream() const override
+        {
+            return new (getMemoryManager()) RecordChunkBinInputStream(_chunk);
+        }
+
+    private:
+        const RecordChunk& _chunk;
+    };
+
+    struct RecordLayout
+    {
+        size_t contentBegin = 0;
+        size_t nameBegin = 0;
+        size_t nameEnd = 0;
+        std::vector<size_t> boundaries;
+    };
+
+    struct ChunkResult
+    {
+        bool done = false;
+        DOMDocument* document = nullptr;
+        std::exception_ptr error;
+    };
+
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    bool StartsWith(const char* data, size_t size, size_t pos, const char* token)
+    {
+        size_t length = std::strlen(token);
+        return pos + length <= size && std::memcmp(data + pos, token, length) == 0;
+    }
+
+    // Position just past token, npos when it does not occur
+    size_t SkipPast(const char* data, size_t size, size_t pos, const char* token)
+    {
+        size_t length = std::strlen(token);
+
+        while (pos + length <= size)
+        {
+            const void* found = std::memchr(data + pos, token[0], size - pos - length + 1);
+
+            if (found == nullptr)
+                break;
+
+            pos = static_cast<const char*>(found) - data;
+
+            if (std::memcmp(data + pos, token, length) == 0)
+                return pos + length;
+
+            pos++;
+        }
+
+        return std::string::npos;
+    }
+
+    // Position of the '>' closing the tag that starts at pos, quoted attribute values may contain '>'
+    size_t FindTagEnd(const char* data, size_t size, size_t pos)
+    {
+        char quote = 0;
+
+        for (; pos < size; pos++)
+        {
+            char c = data[pos];
+
+            if (quote != 0)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '"' || c == '\'')
+                quote = c;
+            else if (c == '>')
+                return pos;
+        }
+
+        return std::string::npos;
+    }
+
+    // Finds the root start tag and, while walking the content, one record end
+    // tag past every target offset. Returns false when the document cannot be
+    // split safely, the caller then parses it in one piece.
+    bool ScanRecords(const char* data, size_t size, size_t chunkCount, RecordLayout& layout)
+    {
+        // UTF-16 and UTF-32 documents start with a BOM or a zero byte
+        if (size < 4 || data[0] == 0 || data[1] == 0 || static_cast<unsigned char>(data[0]) == 0xFE || static_cast<unsigned char>(data[0]) == 0xFF)
+            return false;
+
+        size_t pos = StartsWith(data, size, 0, "\xEF\xBB\xBF") ? 3 : 0;
+
+        // Prolog
+        for (;;)
+        {
+            while (pos < size && IsSpace(data[pos]))
+                pos++;
+
+            if (StartsWith(data, size, pos, "<?"))
+                pos = SkipPast(data, size, pos, "?>");
+            else if (StartsWith(data, size, pos, "<!--"))
+                pos = SkipPast(data, size, pos, "-->");
+            else if (StartsWith(data, size, pos, "<!"))
+                return false;
+            else if (pos < size && data[pos] == '<')
+                break;
+            else
+                return false;
+
+            if (pos == std::string::npos)
+                return false;
+        }
+
+        layout.nameBegin = pos + 1;
+        layout.nameEnd = layout.nameBegin;
+
+        while (layout.nameEnd < size && !IsSpace(data[layout.nameEnd]) && data[layout.nameEnd] != '/' && data[layout.nameEnd] != '>')
+            layout.nameEnd++;
+
+        size_t tagEnd = FindTagEnd(data, size, layout.nameEnd);
+
+        if (tagEnd == std::string::npos || data[tagEnd - 1] == '/')
+            return false;
+
+        layout.contentBegin = tagEnd + 1;
+
+        // Content, only record boundaries are of interest so text is skipped with memchr
+        size_t target = size / chunkCount;
+        size_t depth = 0;
+
+        pos = layout.contentBegin;
+
+        for (;;)
+        {
+            const void* found = pos < size ? std::memchr(data + pos, '<', size - pos) : nullptr;
+
+            if (found == nullptr)
+                return false;
+
+            pos = static_cast<const char*>(found) - data;
+
+            bool recordEnd = false;
+
+            if (StartsWith(data, size, pos, "<!--"))
+                pos = SkipPast(data, size, pos, "-->");
+            else if (StartsWith(data, size, pos, "<![CDATA["))
+                pos = SkipPast(data, size, pos, "]]>");
+            else if (StartsWith(data, size, pos, "<?"))
+                pos = SkipPast(data, size, pos, "?>");
+            else if (StartsWith(data, size, pos, "<!"))
+                return false;
+            else if (StartsWith(data, size, pos, "</"))
+            {
+                // The root end tag, the rest of the file belongs to the last chunk
+                if (depth == 0)
+                    break;
+
+                pos = FindTagEnd(data, size, pos);
+                if (pos != std::string::npos)
+                    pos++;
+
+                recordEnd = --depth == 0;
+            }
+            else
+            {
+                pos = FindTagEnd(data, size, pos);
+
+                if (pos != std::string::npos)
+                {
+                    if (data[pos - 1] == '/')
+                        recordEnd = depth == 0;
+                    else
+                        depth++;
+
+                    pos++;
+                }
+            }
+
+            if (pos == std::string::npos)
+                return false;
+
+            if (recordEnd && pos >= target && layout.boundaries.size() + 1 < chunkCount)
+            {
+                layout.boundaries.push_back(pos);
+                target = size / chunkCount * (layout.boundaries.size() + 1);
+            }
+        }
+
+        return !layout.boundaries.empty();
+    }
+
+    DOMDocument* ParseChunk(DOMLSParserPool& pool, const DOMLSParserConfig& config, const std::string& systemId, const RecordChunk& chunk)
+    {
+        auto parser = pool.Acquire(config);
+
+        DOMLSInput* input = pool.GetImplementation()->createLSInput();
+
+        RecordChunkInputSource chunkInputSource(systemId, chunk);
+        input->setByteStream(&chunkInputSource);
+
+        DOMDocument* document = nullptr;
+
+        try
+        {
+            document = parser->parse(input);
+        }
+        catch (...)
+        {
+            input->release();
+            throw;
+        }
+
+        input->release();
+
+        if (document == nullptr || document->getDocumentElement() == nullptr)
+        {
+            if (document != nullptr)
+                document->release();
+
+            throw std::runtime_error("The Xml file format is not well formed or encoded incorrectly: " + systemId);
+        }
+
+        return document;
+    }
+
+    // Copies the records of a later chunk under the root of the first one. Xerces-C
+    // cannot move nodes between documents, so importNode() deep-copies every record
+    // on the calling thread: this serial copy is what limits the scaling. Parsing
+    // the chunks into the first document instead (ParseChunkInto) is not an option
+    // for the workers, the heap of a document is not thread safe.
+    void AppendRecords(DOMDocument* document, DOMDocument* chunkDocument)
+    {
+        DOMElement* root = document->getDocumentElement();
+        DOMElement* chunkRoot = chunkDocument->getDocumentElement();
+
+        for (DOMNode* child = chunkRoot->getFirstChild(); child != nullptr; child = child->getNextSibling())
+            root->appendChild(document->importNode(child, true));
+
+        // Comments and processing instructions after the root, only the last chunk has them
+        for (DOMNode* sibling = chunkRoot->getNextSibling(); sibling != nullptr; sibling = sibling->getNextSibling())
+            document->appendChild(document->importNode(sibling, true));
+    }
+
+    // Parses a later chunk into a fragment allocated by document and moves its
+    // records under the root, the nodes never leave the heap they were created in.
+    // Must not run concurrently with anything else touching document.
+    void ParseChunkInto(DOMLSParserPool& pool, const DOMLSParserConfig& config, const std::string& systemId, const RecordChunk& chunk, DOMDocument* document)
+    {
+        auto parser = pool.Acquire(config);
+
+        DOMLSInput* input = pool.GetImplementation()->createLSInput();
+
+        RecordChunkInputSource chunkInputSource(systemId, chunk);
+        input->setByteStream(&chunkInputSource);
+
+        DOMDocumentFragment* fragment = document->createDocumentFragment();
+
+        try
+        {
+            parser->parseWithContext(input, fragment, DOMLSParser::ACTION_APPEND_AS_CHILDREN);
+        }
+        catch (...)
+        {
+            input->release();
+            fragment->release();
+            throw;
+        }
+
+        input->release();
+
+        // The prolog comments, the repeated root and, in the last chunk, what follows the root
+        DOMNode* chunkRoot = fragment->getFirstChild();
+
+        while (chunkRoot != nullptr && chunkRoot->getNodeType() != DOMNode::ELEMENT_NODE)
+            chunkRoot = chunkRoot->getNextSibling();
+
+        if (chunkRoot == nullptr)
+        {
+            fragment->release();
+            throw std::runtime_error("The Xml file format is not well formed or encoded incorrectly: " + systemId);
+        }
+
+        DOMElement* root = document->getDocumentElement();
+
+        // appendChild() unlinks the node from the repeated root, nothing is copied
+        while (DOMNode* child = chunkRoot->getFirstChild())
+            root->appendChild(child);
+
+        while (DOMNode* sibling = chunkRoot->getNextSibling())
+            document->appendChild(sibling);
+
+        fragment->release();
+    }
+
+    DOMDocument* ParseSequentially(const std::string& file, DOMLSParserPool& pool, const DOMLSParserConfig& config)
+    {
+        auto parser = pool.Acquire(config);
+
+        DOMLSInput* input = pool.GetImplementation()->createLSInput();
+
+        MappedFileInputSource fileInputSource(file);
+        input->setByteStream(&fileInputSource);
+
+        DOMDocument* document = nullptr;
+
+        try
+        {
+            document = parser->parse(input);
+        }
+        catch (...)
+        {
+            input->release();
+            throw;
+        }
+
+        input->release();
+
+        return document;
+    }
+}
+
+DOMDocument* ParseRecordsInParallel(const std::string& file, DOMLSParserPool& pool, const ParallelParseOptions& options, ParallelParseStatistics* statistics)
+{
+    ParallelParseStatistics localStatistics;
+    if (statistics == nullptr)
+        statistics = &localStatistics;
+
+    *statistics = ParallelParseStatistics();
+
+    DOMLSParserConfig config;
+    config.validateWithGrammarPool = options.validateWithGrammarPool;
+
+    MappedFileBinInputStream mappedFile(file);
+
+    unsigned threadCount = options.threadCount > 0 ? options.threadCount : std::thread::hardware_concurrency();
+    size_t chunkCount = std::min<size_t>(std::max(1u, threadCount), mappedFile.GetSize() / std::max<size_t>(1, options.minChunkBytes));
+
+    const char* data = reinterpret_cast<const char*>(mappedFile.GetData());
+    const size_t size = mappedFile.GetSize();
+
+    RecordLayout layout;
+
+    long long scanStart(GetNanos());
+    bool splittable = mappedFile.IsMapped() && chunkCount > 1 && ScanRecords(data, size, chunkCount, layout);
+    statistics->scanNs = GetNanos() - scanStart;
+
+    if (!splittable)
+    {
+        statistics->chunks = 1;
+        return ParseSequentially(file, pool, config);
+    }
+
+    // Every chunk is a complete document, later chunks repeat the prolog and root start tag
+    const XMLByte* bytes = mappedFile.GetData();
+    std::string rootEndTag("</" + std::string(data + layout.nameBegin, layout.nameEnd - layout.nameBegin) + ">");
+    const Segment endTagSegment = { reinterpret_cast<const XMLByte*>(rootEndTag.data()), rootEndTag.size() };
+
+    std::vector<RecordChunk> chunks(layout.boundaries.size() + 1);
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        size_t begin = i == 0 ? 0 : layout.boundaries[i - 1];
+        size_t end = i + 1 < chunks.size() ? layout.boundaries[i] : size;
+
+        RecordChunk& chunk = chunks[i];
+        chunk.segmentCount = 0;
+
+        if (i > 0)
+            chunk.segments[chunk.segmentCount++] = { bytes, layout.contentBegin };
+
+        chunk.segments[chunk.segmentCount++] = { bytes + begin, end - begin };
+
+        if (i + 1 < chunks.size())
+            chunk.segments[chunk.segmentCount++] = endTagSegment;
+    }
+
+    statistics->chunks = chunks.size();
+
+    if (options.stitchWithContext)
+    {
+        DOMDocument* document = ParseChunk(pool, config, file + "#chunk0", chunks[0]);
+
+        long long stitchStart(GetNanos());
+
+        try
+        {
+            for (size_t i = 1; i < chunks.size(); i++)
+                ParseChunkInto(pool, config, file + "#chunk" + std::to_string(i), chunks[i], document);
+        }
+        catch (...)
+        {
+            document->release();
+            throw;
+        }
+
+        statistics->stitchNs = GetNanos() - stitchStart;
+
+        return document;
+    }
+
+    statistics->parallel = true;
+
+    std::vector<ChunkResult> results(chunks.size());
+    std::mutex resultMutex;
+    std::condition_variable resultReady;
+
+    std::vector<std::thread> workers;
+
+    auto joinWorkers = [&]()
+    {
+        for (auto it = workers.begin(); it != workers.end(); it++)
+            it->join();
+    };
+
+    try
+    {
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            workers.emplace_back([&, i]()
+            {
+                DOMDocument* document = nullptr;
+                std::exception_ptr error;
+
+                try
+                {
+                    document = ParseChunk(pool, config, file + "#chunk" + std::to_string(i), chunks[i]);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(resultMutex);
+                    results[i].document = document;
+                    results[i].error = error;
+                    results[i].done = true;
+                }
+
+                resultReady.notify_all();
+            });
+        }
+    }
+    catch (...)
+    {
+        // A thread could not be started, the running ones must not be destroyed while joinable
+        joinWorkers();
+
+        for (auto it = results.begin(); it != results.end(); it++)
+            if (it->document != nullptr)
+                it->document->release();
+
+        throw;
+    }
+
+    // Stitch in document order while the later chunks are still parsing
+    DOMDocument* document = nullptr;
+    std::exception_ptr failure;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        std::unique_lock<std::mutex> lock(resultMutex);
+        resultReady.wait(lock, [&]() { return results[i].done; });
+
+        DOMDocument* chunkDocument = results[i].document;
+        std::exception_ptr error = results[i].error;
+
+        lock.unlock();
+
+        if (failure == nullptr)
+            failure = error;
+
+        if (failure != nullptr)
+        {
+            if (chunkDocument != nullptr)
+                chunkDocument->release();
+            continue;
+        }
+
+        if (i == 0)
+        {
+            document = chunkDocument;
+            continue;
+        }
+
+        long long stitchStart(GetNanos());
+
+        try
+        {
+            AppendRecords(document, chunkDocument);
+        }
+        catch (...)
+        {
+            failure = std::current_exception();
+        }
+
+        chunkDocument->release();
+
+        statistics->stitchNs += GetNanos() - stitchStart;
+    }
+
+    joinWorkers();
+
+    if (failure != nullptr)
+    {
+        if (document != nullptr)
+            document->release();
+
+        std::rethrow_exception(failure);
+    }
+
+    return document;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "domlsparserpool.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+struct ParallelParseOptions
+{
+    // 0 uses std::thread::hardware_concurrency()
+    unsigned threadCount = 0;
+
+    // Files with less than two chunks of this size are parsed on the calling thread
+    size_t minChunkBytes = 4 * 1024 * 1024;
+
+    // DOMLSParserConfig::validateWithGrammarPool for every parse. A chunk is
+    // validated on its own, so the root must accept any run of records and
+    // identity constraints are only checked inside a chunk.
+    bool validateWithGrammarPool = false;
+
+    // Parse the later chunks with parseWithContext() straight into the first
+    // chunk's document instead of copying their records over. The heap of a
+    // document is not thread safe, so every chunk is then parsed on the calling
+    // thread, one after another; kept to measure the copy against.
+    bool stitchWithContext = false;
+};
+
+struct ParallelParseStatistics
+{
+    size_t chunks = 0;
+    bool parallel = false;
+    long long scanNs = 0;
+    // With stitchWithContext the parse of every chunk after the first
+    long long stitchNs = 0;
+};
+
+// Parses a record-oriented document (a root holding many sibling records) on
+// several threads. The mapped bytes are scanned for the end tags of top-level
+// records, every chunk is parsed as a small document that repeats the prolog
+// and root start tag, so namespace declarations of the root stay in scope,
+// and the records are appended under the first chunk's root in document order.
+//
+// Falls back to a single parse when the file cannot be mapped, is not in an
+// ASCII compatible encoding, has a DOCTYPE (entities and default attributes
+// cannot be split) or is too small to be worth it.
+DOMDocument* ParseRecordsInParallel(const std::string& file, DOMLSParserPool& pool, const ParallelParseOptions& options = ParallelParseOptions(), ParallelParseStatistics* statistics = nullptr);
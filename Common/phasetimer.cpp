@@ -0,0 +1,141 @@
+#include "phasetimer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+    // Nearest-rank percentile of sorted samples
+    long long Percentile(const std::vector<long long>& sorted, double percent)
+    {
+        size_t rank = static_cast<size_t>(percent / 100.0 * sorted.size() + 0.999999);
+        rank = std::max<size_t>(1, std::min(rank, sorted.size()));
+
+        return sorted[rank - 1];
+    }
+}
+
+long long GetTimestampNanos()
+{
+    auto duration = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+PhaseTimer::Scope::Scope(PhaseTimer& timer, const std::string& phase)
+    : _timer(timer), _phase(phase), _start(GetTimestampNanos())
+{
+}
+
+PhaseTimer::Scope::~Scope()
+{
+    _timer.Record(_phase, GetTimestampNanos() - _start);
+}
+
+void PhaseTimer::Record(const std::string& phase, long long nanoseconds)
+{
+    for (auto it = _phases.begin(); it != _phases.end(); it++)
+    {
+        if (it->first == phase)
+        {
+            it->second.push_back(nanoseconds);
+            return;
+        }
+    }
+
+    _phases.emplace_back(phase, std::vector<long long>(1, nanoseconds));
+}
+
+std::vector<std::string> PhaseTimer::GetPhases() const
+{
+    std::vector<std::string> phases;
+
+    for (auto it = _phases.begin(); it != _phases.end(); it++)
+        phases.push_back(it->first);
+
+    return phases;
+}
+
+PhaseTimer::Summary PhaseTimer::Summarize(const std::string& phase) const
+{
+    for (auto it = _phases.begin(); it != _phases.end(); it++)
+    {
+        if (it->first != phase)
+            continue;
+
+        std::vector<long long> sorted(it->second);
+        std::sort(sorted.begin(), sorted.end());
+
+        Summary summary;
+        summary.samples = sorted.size();
+        summary.minNs = sorted.front();
+        summary.p50Ns = Percentile(sorted, 50);
+        summary.p95Ns = Percentile(sorted, 95);
+        summary.p99Ns = Percentile(sorted, 99);
+        summary.maxNs = sorted.back();
+        summary.meanNs = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+
+        return summary;
+    }
+
+    throw std::runtime_error("No samples for phase " + phase);
+}
+
+void PhaseTimer::WriteJson(std::ostream& out) const
+{
+    out << "{";
+
+    for (auto it = _phases.begin(); it != _phases.end(); it++)
+    {
+        Summary summary = Summarize(it->first);
+
+        if (it != _phases.begin())
+            out << ",";
+
+        out << "\n    \"" << EscapeJson(it->first) << "\": {"
+            << "\"samples\": " << summary.samples
+            << ", \"min_ns\": " << summary.minNs
+            << ", \"p50_ns\": " << summary.p50Ns
+            << ", \"p95_ns\": " << summary.p95Ns
+            << ", \"p99_ns\": " << summary.p99Ns
+            << ", \"max_ns\": " << summary.maxNs
+            << ", \"mean_ns\": " << static_cast<long long>(summary.meanNs)
+            << "}";
+    }
+
+    out << "\n  }";
+}
+
+std::string EscapeJson(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+
+    for (auto it = text.begin(); it != text.end(); it++)
+    {
+        unsigned char c = static_cast<unsigned char>(*it);
+
+        switch (c)
+        {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+            {
+                if (c < 0x20)
+                {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    escaped += buffer;
+                }
+                else
+                    escaped.push_back(static_cast<char>(c));
+            }
+        }
+    }
+
+    return escaped;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Monotonic nanosecond timestamp, unaffected by wall clock changes.
+long long GetTimestampNanos();
+
+// Collects per-phase samples over repeated iterations and summarizes them.
+class PhaseTimer
+{
+public:
+    struct Summary
+    {
+        size_t samples;
+        long long minNs;
+        long long p50Ns;
+        long long p95Ns;
+        long long p99Ns;
+        long long maxNs;
+        double meanNs;
+    };
+
+    class Scope
+    {
+    public:
+        Scope(PhaseTimer& timer, const std::string& phase);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        PhaseTimer& _timer;
+        const std::string _phase;
+        long long _start;
+    };
+
+    void Record(const std::string& phase, long long nanoseconds);
+
+    // Phases in the order they were first recorded.
+    std::vector<std::string> GetPhases() const;
+    Summary Summarize(const std::string& phase) const;
+
+    // Writes {"<phase>": {"samples": .., "min_ns": .., "p50_ns": .., ...}, ...}
+    void WriteJson(std::ostream& out) const;
+
+private:
+    std::vector<std::pair<std::string, std::vector<long long>>> _phases;
+};
+
+std::string EscapeJson(const std::string& text);
@@ -0,0 +1,249 @@
+#include "shareddocumentstore.h"
+#include "domsnapshot.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include <mutex>
+#include <unordered_map>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::string MakeObjectName(const std::string& name)
+    {
+#ifdef _WIN32
+        return "Local\\" + name;
+#else
+        return "/" + name;
+#endif
+    }
+
+#ifdef _WIN32
+    // A section goes away with its last handle, these keep the ones published by
+    // this process alive after their store is destroyed, until Remove()
+    std::mutex publishedMutex;
+    std::unordered_map<std::string, HANDLE> publishedSections;
+#endif
+}
+
+SharedDocumentStore::SharedDocumentStore()
+    : _data(nullptr), _size(0)
+#ifdef _WIN32
+    , _mappingHandle(nullptr)
+#endif
+{
+}
+
+DOMSnapshotView SharedDocumentStore::GetView() const
+{
+    return DOMSnapshotView(_data, _size);
+}
+
+DOMDocument* SharedDocumentStore::Load(DOMImplementation* impl) const
+{
+    return ::LoadDOMSnapshot(_data, _size, impl);
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<SharedDocumentStore> SharedDocumentStore::Publish(const std::string& name, const DOMDocument* document)
+{
+    std::unique_ptr<SharedDocumentStore> store(new SharedDocumentStore());
+    std::string objectName(MakeObjectName(name));
+
+    // Drops this process' hold on the previous version, the name is free unless a worker still has it open
+    Remove(name);
+
+    // Pagefile backed sections start zero filled
+    ::WriteDOMSnapshot(document, [&](size_t size) -> XMLByte*
+    {
+        unsigned long long mappingSize = size;
+
+        store->_mappingHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                                   static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize),
+                                                   objectName.c_str());
+
+        if (store->_mappingHandle == nullptr)
+            throw std::runtime_error("Cannot create shared document " + name);
+
+        // The existing section is opened instead, with its old size and content
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+            throw std::runtime_error("Shared document " + name + " is still attached, it cannot be replaced");
+
+        store->_data = static_cast<XMLByte*>(MapViewOfFile(store->_mappingHandle, FILE_MAP_WRITE, 0, 0, size));
+
+        if (store->_data == nullptr)
+            throw std::runtime_error("Cannot map shared document " + name);
+
+        store->_size = size;
+
+        return store->_data;
+    });
+
+    // The publisher only reads from here on, like the workers
+    DWORD oldProtection;
+    VirtualProtect(store->_data, store->_size, PAGE_READONLY, &oldProtection);
+
+    HANDLE published;
+
+    if (!DuplicateHandle(GetCurrentProcess(), store->_mappingHandle, GetCurrentProcess(), &published, 0, FALSE, DUPLICATE_SAME_ACCESS))
+        throw std::runtime_error("Cannot keep shared document " + name);
+
+    std::lock_guard<std::mutex> lock(publishedMutex);
+    publishedSections[name] = published;
+
+    return store;
+}
+
+std::unique_ptr<SharedDocumentStore> SharedDocumentStore::Attach(const std::string& name)
+{
+    std::unique_ptr<SharedDocumentStore> store(new SharedDocumentStore());
+
+    store->_mappingHandle = OpenFileMappingA(FILE_MAP_READ, FALSE, MakeObjectName(name).c_str());
+
+    if (store->_mappingHandle == nullptr)
+        throw std::runtime_error("No shared document " + name);
+
+    store->_data = static_cast<XMLByte*>(MapViewOfFile(store->_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+
+    if (store->_data == nullptr)
+        throw std::runtime_error("Cannot map shared document " + name);
+
+    // The view is rounded up to whole pages, the snapshot header has the exact section bounds
+    MEMORY_BASIC_INFORMATION information;
+    VirtualQuery(store->_data, &information, sizeof(information));
+    store->_size = information.RegionSize;
+
+    return store;
+}
+
+void SharedDocumentStore::Remove(const std::string& name)
+{
+    HANDLE published = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(publishedMutex);
+
+        auto found = publishedSections.find(name);
+
+        if (found != publishedSections.end())
+        {
+            published = found->second;
+            publishedSections.erase(found);
+        }
+    }
+
+    // The section goes away once the stores still open on it are destroyed
+    if (published != nullptr)
+        CloseHandle(published);
+}
+
+SharedDocumentStore::~SharedDocumentStore()
+{
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+
+    if (_mappingHandle != nullptr)
+        CloseHandle(_mappingHandle);
+}
+
+#else
+
+std::unique_ptr<SharedDocumentStore> SharedDocumentStore::Publish(const std::string& name, const DOMDocument* document)
+{
+    std::unique_ptr<SharedDocumentStore> store(new SharedDocumentStore());
+    std::string objectName(MakeObjectName(name));
+
+    // Workers attached to a previous version keep their mapping, new ones get this one
+    shm_unlink(objectName.c_str());
+
+    int fd = shm_open(objectName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+    if (fd < 0)
+        throw std::runtime_error("Cannot create shared document " + name);
+
+    try
+    {
+        // ftruncate zero fills the region
+        ::WriteDOMSnapshot(document, [&](size_t size) -> XMLByte*
+        {
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+                throw std::runtime_error("Cannot size shared document " + name);
+
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (data == MAP_FAILED)
+                throw std::runtime_error("Cannot map shared document " + name);
+
+            store->_data = static_cast<XMLByte*>(data);
+            store->_size = size;
+
+            return store->_data;
+        });
+    }
+    catch (...)
+    {
+        close(fd);
+        shm_unlink(objectName.c_str());
+        throw;
+    }
+
+    close(fd);
+
+    // The publisher only reads from here on, like the workers
+    mprotect(store->_data, store->_size, PROT_READ);
+
+    return store;
+}
+
+std::unique_ptr<SharedDocumentStore> SharedDocumentStore::Attach(const std::string& name)
+{
+    std::unique_ptr<SharedDocumentStore> store(new SharedDocumentStore());
+
+    int fd = shm_open(MakeObjectName(name).c_str(), O_RDONLY, 0);
+
+    if (fd < 0)
+        throw std::runtime_error("No shared document " + name);
+
+    struct stat info;
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            store->_data = static_cast<XMLByte*>(data);
+            store->_size = static_cast<size_t>(info.st_size);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    if (store->_data == nullptr)
+        throw std::runtime_error("Cannot map shared document " + name);
+
+    return store;
+}
+
+void SharedDocumentStore::Remove(const std::string& name)
+{
+    shm_unlink(MakeObjectName(name).c_str());
+}
+
+SharedDocumentStore::~SharedDocumentStore()
+{
+    if (_data != nullptr)
+        munmap(_data, _size);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "domsnapshot.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <memory>
+#include <string>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Named shared memory region holding the DOM snapshot (see domsnapshot.h) of
+// a document. One process parses and publishes it, worker processes on the
+// same host attach read-only: the pages are shared through the page cache and
+// nobody parses the XML text again.
+//
+// Xerces DOM nodes live in a per-document heap full of process local pointers,
+// so a DOM cannot be shared. GetView() reads the image in place: lookups built
+// on it (SnapshotIndex in TestXqilla) answer without a private copy of the
+// document. Load() rebuilds a full private DOM for everything else, at the
+// memory cost of a parse.
+class SharedDocumentStore
+{
+public:
+    // Creates or replaces the region, which outlives the publisher until
+    // Remove(). Workers attached to a replaced region keep the old one. On
+    // Windows a region cannot be replaced while another process has it open,
+    // Publish() then throws std::runtime_error.
+    static std::unique_ptr<SharedDocumentStore> Publish(const std::string& name, const DOMDocument* document);
+
+    // Throws std::runtime_error when nothing is published under name.
+    static std::unique_ptr<SharedDocumentStore> Attach(const std::string& name);
+
+    // Attached stores stay valid until they are destroyed. On POSIX new
+    // Attach() calls fail at once. On Windows the region goes away with the
+    // last store open on it, and only one published by this process can be
+    // removed.
+    static void Remove(const std::string& name);
+
+    ~SharedDocumentStore();
+
+    SharedDocumentStore(const SharedDocumentStore&) = delete;
+    SharedDocumentStore& operator=(const SharedDocumentStore&) = delete;
+
+    size_t GetSize() const { return _size; }
+
+    // The shared image, valid as long as the store.
+    DOMSnapshotView GetView() const;
+
+    // Builds a queryable document from the shared image, the caller owns it.
+    DOMDocument* Load(DOMImplementation* impl) const;
+
+private:
+    SharedDocumentStore();
+
+    XMLByte* _data;
+    size_t _size;
+
+#ifdef _WIN32
+    void* _mappingHandle;
+#endif
+};
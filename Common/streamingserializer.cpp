@@ -0,0 +1,284 @@
+#include "streamingserializer.h"
+
+#include <xercesc/util/XMLUni.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+GrowableBufferFormatTarget::GrowableBufferFormatTarget(std::vector<XMLByte>& buffer)
+    : _buffer(buffer)
+{
+}
+
+void GrowableBufferFormatTarget::writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const)
+{
+    _buffer.insert(_buffer.end(), toWrite, toWrite + count);
+}
+
+FileDescriptorFormatTarget::FileDescriptorFormatTarget(int fd, size_t blockSize)
+    : _fd(fd), _block(blockSize), _used(0)
+{
+}
+
+FileDescriptorFormatTarget::~FileDescriptorFormatTarget()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception&)
+    {
+    }
+}
+
+void FileDescriptorFormatTarget::writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const)
+{
+    if (_used + count > _block.size())
+    {
+        flush();
+
+        // Larger than the block, no point copying it first
+        if (count >= _block.size())
+        {
+            WriteAll(toWrite, count);
+            return;
+        }
+    }
+
+    std::memcpy(_block.data() + _used, toWrite, count);
+    _used += count;
+}
+
+void FileDescriptorFormatTarget::flush()
+{
+    size_t used = _used;
+    _used = 0;
+
+    WriteAll(_block.data(), used);
+}
+
+void FileDescriptorFormatTarget::WriteAll(const XMLByte* data, size_t size)
+{
+    while (size > 0)
+    {
+#ifdef _WIN32
+        int written = _write(_fd, data, static_cast<unsigned int>(size > 0x40000000 ? 0x40000000 : size));
+#else
+        ssize_t written = write(_fd, data, size);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+#endif
+
+        if (written <= 0)
+            throw std::runtime_error(std::string("Cannot write serialized output: ") + std::strerror(errno));
+
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+MappedFileFormatTarget::MappedFileFormatTarget(const std::string& file, size_t initialSize)
+    : _file(file), _data(nullptr), _capacity(0), _length(0)
+#ifdef _WIN32
+    , _fileHandle(INVALID_HANDLE_VALUE), _mappingHandle(nullptr)
+#else
+    , _fd(-1)
+#endif
+{
+#ifdef _WIN32
+    _fileHandle = CreateFileA(file.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (_fileHandle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot create " + file);
+#else
+    _fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (_fd < 0)
+        throw std::runtime_error("Cannot create " + file);
+#endif
+
+    try
+    {
+        Map(initialSize > 0 ? initialSize : 4096);
+    }
+    catch (...)
+    {
+        Close();
+        throw;
+    }
+}
+
+MappedFileFormatTarget::~MappedFileFormatTarget()
+{
+    Close();
+}
+
+void MappedFileFormatTarget::writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const)
+{
+    if (_length + count > _capacity)
+    {
+        size_t capacity = _capacity * 2;
+
+        while (capacity < _length + count)
+            capacity *= 2;
+
+        Unmap();
+        Map(capacity);
+    }
+
+    std::memcpy(_data + _length, toWrite, count);
+    _length += count;
+}
+
+#ifdef _WIN32
+
+void MappedFileFormatTarget::Map(size_t capacity)
+{
+    unsigned long long mappingSize = capacity;
+
+    _mappingHandle = CreateFileMappingA(_fileHandle, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), nullptr);
+
+    if (_mappingHandle == nullptr)
+        throw std::runtime_error("Cannot grow " + _file);
+
+    _data = static_cast<XMLByte*>(MapViewOfFile(_mappingHandle, FILE_MAP_WRITE, 0, 0, capacity));
+
+    if (_data == nullptr)
+        throw std::runtime_error("Cannot map " + _file);
+
+    _capacity = capacity;
+}
+
+void MappedFileFormatTarget::Unmap()
+{
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+
+    if (_mappingHandle != nullptr)
+        CloseHandle(_mappingHandle);
+
+    _data = nullptr;
+    _mappingHandle = nullptr;
+}
+
+void MappedFileFormatTarget::Close()
+{
+    if (_fileHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    Unmap();
+
+    // The mapping grew the file to its capacity
+    LARGE_INTEGER length;
+    length.QuadPart = static_cast<LONGLONG>(_length);
+    SetFilePointerEx(_fileHandle, length, nullptr, FILE_BEGIN);
+    SetEndOfFile(_fileHandle);
+
+    CloseHandle(_fileHandle);
+    _fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+void MappedFileFormatTarget::Map(size_t capacity)
+{
+    if (ftruncate(_fd, static_cast<off_t>(capacity)) != 0)
+        throw std::runtime_error("Cannot grow " + _file);
+
+    void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + _file);
+
+    _data = static_cast<XMLByte*>(data);
+    _capacity = capacity;
+}
+
+void MappedFileFormatTarget::Unmap()
+{
+    if (_data != nullptr)
+        munmap(_data, _capacity);
+
+    _data = nullptr;
+}
+
+void MappedFileFormatTarget::Close()
+{
+    if (_fd < 0)
+        return;
+
+    Unmap();
+
+    // The mapping grew the file to its capacity
+    if (ftruncate(_fd, static_cast<off_t>(_length)) != 0)
+    {
+        // Leaves zero padding at the end, the content before it is complete
+    }
+
+    close(_fd);
+    _fd = -1;
+}
+
+#endif
+
+StreamingSerializer::StreamingSerializer(DOMImplementation* impl, bool prettyPrint, DOMErrorHandler* errorHandler)
+    : _serializer(impl->createLSSerializer()), _output(impl->createLSOutput()), _target(nullptr)
+{
+    _output->setEncoding(XMLUni::fgUTF8EncodingString);
+
+    DOMConfiguration* serializerConfig = _serializer->getDomConfig();
+
+    if (errorHandler != nullptr)
+        serializerConfig->setParameter(XMLUni::fgDOMErrorHandler, errorHandler);
+
+    SetPrettyPrint(prettyPrint);
+}
+
+StreamingSerializer::~StreamingSerializer()
+{
+    _output->release();
+    _serializer->release();
+}
+
+void StreamingSerializer::SetTarget(XMLFormatTarget* target)
+{
+    _target = target;
+    _output->setByteStream(target);
+}
+
+void StreamingSerializer::SetPrettyPrint(bool prettyPrint)
+{
+    DOMConfiguration* serializerConfig = _serializer->getDomConfig();
+
+    if (serializerConfig->canSetParameter(XMLUni::fgDOMWRTFormatPrettyPrint, prettyPrint))
+        serializerConfig->setParameter(XMLUni::fgDOMWRTFormatPrettyPrint, prettyPrint);
+}
+
+void StreamingSerializer::Write(const DOMNode* node)
+{
+    if (_target == nullptr)
+        throw std::runtime_error("No serializer target");
+
+    if (!_serializer->write(node, _output))
+        throw std::runtime_error("Cannot serialize node");
+}
+
+void StreamingSerializer::Flush()
+{
+    if (_target != nullptr)
+        _target->flush();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/framework/XMLFormatTarget.hpp>
+
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Appends to a buffer owned by the caller. Clearing the buffer between uses
+// keeps its capacity, so steady state serialization does not allocate.
+class GrowableBufferFormatTarget : public XMLFormatTarget
+{
+public:
+    GrowableBufferFormatTarget(std::vector<XMLByte>& buffer);
+
+    void writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const formatter) override;
+
+private:
+    std::vector<XMLByte>& _buffer;
+};
+
+// Writes to an open file descriptor, a file, pipe or socket, through a fixed
+// block so the descriptor sees few large writes. The descriptor stays open.
+// Throws std::runtime_error when a write fails.
+class FileDescriptorFormatTarget : public XMLFormatTarget
+{
+public:
+    FileDescriptorFormatTarget(int fd, size_t blockSize = 64 * 1024);
+    ~FileDescriptorFormatTarget();
+
+    FileDescriptorFormatTarget(const FileDescriptorFormatTarget&) = delete;
+    FileDescriptorFormatTarget& operator=(const FileDescriptorFormatTarget&) = delete;
+
+    void writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const formatter) override;
+    void flush() override;
+
+private:
+    void WriteAll(const XMLByte* data, size_t size);
+
+    int _fd;
+    std::vector<XMLByte> _block;
+    size_t _used;
+};
+
+// Writes into a memory mapped output file that grows by doubling, then cut
+// to the written length by Close() or the destructor. Throws
+// std::runtime_error when the file cannot be created or grown.
+class MappedFileFormatTarget : public XMLFormatTarget
+{
+public:
+    MappedFileFormatTarget(const std::string& file, size_t initialSize = 1024 * 1024);
+    ~MappedFileFormatTarget();
+
+    MappedFileFormatTarget(const MappedFileFormatTarget&) = delete;
+    MappedFileFormatTarget& operator=(const MappedFileFormatTarget&) = delete;
+
+    void writeChars(const XMLByte* const toWrite, const XMLSize_t count, XMLFormatter* const formatter) override;
+
+    size_t GetLength() const { return _length; }
+
+    // Writes again from the start of the file, the mapping is kept
+    void Rewind() { _length = 0; }
+
+    void Close();
+
+private:
+    void Map(size_t capacity);
+    void Unmap();
+
+    std::string _file;
+    XMLByte* _data;
+    size_t _capacity;
+    size_t _length;
+
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#else
+    int _fd;
+#endif
+};
+
+// DOMLSSerializer and DOMLSOutput created and configured once, then reused
+// for every node written. The target can change between calls and is not
+// owned. Throws std::runtime_error when the serializer reports a failure.
+class StreamingSerializer
+{
+public:
+    StreamingSerializer(DOMImplementation* impl, bool prettyPrint = false, DOMErrorHandler* errorHandler = nullptr);
+    ~StreamingSerializer();
+
+    StreamingSerializer(const StreamingSerializer&) = delete;
+    StreamingSerializer& operator=(const StreamingSerializer&) = delete;
+
+    void SetTarget(XMLFormatTarget* target);
+    void SetPrettyPrint(bool prettyPrint);
+
+    void Write(const DOMNode* node);
+
+    // Nodes go out one by one, the target sees the output of each as it is produced
+    template <typename Iterator>
+    void Write(Iterator begin, Iterator end)
+    {
+        for (Iterator it = begin; it != end; it++)
+            Write(*it);
+    }
+
+    void Flush();
+
+private:
+    DOMLSSerializer* _serializer;
+    DOMLSOutput* _output;
+    XMLFormatTarget* _target;
+};
@@ -0,0 +1,376 @@
+#include "generatexmlcorpus.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+enum class CorpusEncoding
+{
+    UTF8,
+    UTF16LE
+};
+
+struct CorpusOptions
+{
+    std::string output;
+    unsigned long long books = 1000;
+    unsigned long long targetBytes = 0;
+    unsigned depth = 0;
+    double attributeDensity = 0.5;
+    size_t textSize = 16;
+    bool namespaces = false;
+    CorpusEncoding encoding = CorpusEncoding::UTF8;
+    unsigned long long seed = 1;
+};
+
+// Buffered writer that transcodes the generated UTF-8 text on the way out.
+// Memory use is the size of the buffer whatever the size of the document.
+class CorpusWriter
+{
+public:
+    CorpusWriter(const std::string& file, CorpusEncoding encoding);
+    ~CorpusWriter();
+
+    void Write(const std::string& utf8);
+    void Flush();
+
+    unsigned long long GetBytesWritten() const { return _bytesWritten; }
+
+private:
+    void Put(unsigned char byte);
+
+    FILE* _file;
+    CorpusEncoding _encoding;
+    std::vector<unsigned char> _buffer;
+    size_t _used;
+    unsigned long long _bytesWritten;
+};
+
+// splitmix64, so the same seed gives the same document on every platform and standard library
+class CorpusRandom
+{
+public:
+    explicit CorpusRandom(unsigned long long seed) : _state(seed) {}
+
+    uint64_t Next()
+    {
+        uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t Below(uint64_t bound) { return Next() % bound; }
+    bool Chance(double probability) { return (Next() >> 11) * (1.0 / 9007199254740992.0) < probability; }
+
+private:
+    uint64_t _state;
+};
+
+const size_t WRITE_BUFFER_SIZE(1 << 20);
+
+const char* const WORDS[] = {
+    "harry", "potter", "learning", "xml", "everyday", "italian", "xquery", "kick", "start",
+    "café", "naïve", "résumé", "日本語", "über", "smörgåsbord", "the", "of", "and", "guide", "complete"
+};
+
+const char* const LANGUAGES[] = { "en", "fr", "de", "ja", "it" };
+const char* const CATEGORIES[] = { "cooking", "children", "web", "fiction", "science" };
+
+const char* const NAMESPACE_PREFIX = "bk:";
+const char* const NAMESPACE_URI = "urn:example:bookstore";
+
+bool ParseArguments(const int argc, const char* argv[], CorpusOptions& options);
+bool ParseOption(const std::string& argument, const std::string& value, CorpusOptions& options);
+unsigned long long ParseSize(const std::string& text);
+
+void GenerateCorpus(const CorpusOptions& options);
+void WriteBook(CorpusWriter& writer, CorpusRandom& random, const CorpusOptions& options, unsigned long long index);
+void WriteSections(CorpusWriter& writer, CorpusRandom& random, const CorpusOptions& options, unsigned level, const std::string& indent);
+std::string MakeText(CorpusRandom& random, size_t size);
+
+int main(const int argc, const char* argv[])
+{
+    CorpusOptions options;
+
+    if (!ParseArguments(argc, argv, options))
+    {
+        std::cout << "Usage: " << argv[0] << " <output.xml>\n"
+            << "    [--books N]           number of <book> records (default 1000)\n"
+            << "    [--bytes SIZE]        keep adding records until SIZE is reached, e.g. 512K, 100M, 20G\n"
+            << "    [--depth N]           nested <section> levels inside each book (default 0)\n"
+            << "    [--attributes P]      probability 0..1 of each optional attribute (default 0.5)\n"
+            << "    [--text-size N]       approximate bytes of text per title (default 16)\n"
+            << "    [--namespaces]        put the book content in the " << NAMESPACE_URI << " namespace\n"
+            << "    [--encoding E]        UTF-8 (default) or UTF-16LE\n"
+            << "    [--seed N]            random seed, the same seed gives the same document (default 1)\n";
+        return 1;
+    }
+
+    try
+    {
+        GenerateCorpus(options);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool ParseArguments(const int argc, const char* argv[], CorpusOptions& options)
+{
+    if (argc < 2)
+        return false;
+
+    options.output = argv[1];
+
+    for (int i = 2; i < argc; i++)
+    {
+        std::string argument(argv[i]);
+
+        if (argument == "--namespaces")
+        {
+            options.namespaces = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        std::string value(argv[++i]);
+
+        // A value that is not a number, or a size with an unknown unit, shows the usage
+        try
+        {
+            if (!ParseOption(argument, value, options))
+                return false;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ParseOption(const std::string& argument, const std::string& value, CorpusOptions& options)
+{
+    if (argument == "--books")
+        options.books = std::stoull(value);
+    else if (argument == "--bytes")
+        options.targetBytes = ParseSize(value);
+    else if (argument == "--depth")
+        options.depth = static_cast<unsigned>(std::stoul(value));
+    else if (argument == "--attributes")
+        options.attributeDensity = std::stod(value);
+    else if (argument == "--text-size")
+        options.textSize = std::stoul(value);
+    else if (argument == "--seed")
+        options.seed = std::stoull(value);
+    else if (argument == "--encoding" && (value == "UTF-8" || value == "utf-8"))
+        options.encoding = CorpusEncoding::UTF8;
+    else if (argument == "--encoding" && (value == "UTF-16LE" || value == "utf-16le"))
+        options.encoding = CorpusEncoding::UTF16LE;
+    else
+        return false;
+
+    return true;
+}
+
+unsigned long long ParseSize(const std::string& text)
+{
+    size_t end = 0;
+    unsigned long long size = std::stoull(text, &end);
+
+    std::string unit(text.substr(end));
+
+    if (unit.empty() || unit == "B")
+        return size;
+    if (unit == "K" || unit == "KB")
+        return size << 10;
+    if (unit == "M" || unit == "MB")
+        return size << 20;
+    if (unit == "G" || unit == "GB")
+        return size << 30;
+
+    throw std::runtime_error("Unknown size unit: " + unit);
+}
+
+void GenerateCorpus(const CorpusOptions& options)
+{
+    CorpusWriter writer(options.output, options.encoding);
+    CorpusRandom random(options.seed);
+
+    writer.Write("<?xml version=\"1.0\" encoding=\"");
+    writer.Write(options.encoding == CorpusEncoding::UTF8 ? "UTF-8" : "UTF-16LE");
+    writer.Write("\"?>\n\n<bookstore");
+
+    if (options.namespaces)
+        writer.Write(std::string(" xmlns:bk=\"") + NAMESPACE_URI + "\"");
+
+    writer.Write(">\n\n\t<onePerson>\n\t\t<name>Hello</name>\n\t</onePerson>\n");
+
+    // With --bytes the record count is open-ended, the closing tag is small enough to ignore
+    unsigned long long index = 0;
+
+    while (options.targetBytes > 0 ? writer.GetBytesWritten() < options.targetBytes : index < options.books)
+        WriteBook(writer, random, options, index++);
+
+    writer.Write("\n</bookstore>\n");
+    writer.Flush();
+
+    std::cout << "Wrote " << index << " books, " << writer.GetBytesWritten() << " bytes to " << options.output << std::endl;
+}
+
+void WriteBook(CorpusWriter& writer, CorpusRandom& random, const CorpusOptions& options, unsigned long long index)
+{
+    std::string ns(options.namespaces ? NAMESPACE_PREFIX : "");
+
+    std::string book("\n\t<" + ns + "book id=\"" + std::to_string(index + 1) + "\"");
+
+    if (random.Chance(options.attributeDensity))
+        book += std::string(" category=\"") + CATEGORIES[random.Below(5)] + "\"";
+    if (random.Chance(options.attributeDensity))
+        book += " year=\"" + std::to_string(1950 + random.Below(75)) + "\"";
+    if (random.Chance(options.attributeDensity))
+        book += " edition=\"" + std::to_string(1 + random.Below(9)) + "\"";
+    if (options.namespaces && random.Chance(options.attributeDensity))
+        book += " bk:isbn=\"978" + std::to_string(1000000000ULL + random.Below(9000000000ULL)) + "\"";
+
+    book += ">\n\t  <" + ns + "title lang=\"" + LANGUAGES[random.Below(5)] + "\">" + MakeText(random, options.textSize) + "</" + ns + "title>\n";
+    book += "\t  <" + ns + "price>" + std::to_string(1 + random.Below(99)) + "." + std::to_string(10 + random.Below(90)) + "</" + ns + "price>\n";
+
+    writer.Write(book);
+
+    WriteSections(writer, random, options, 0, "\t  ");
+
+    writer.Write("\t</" + ns + "book>\n");
+}
+
+void WriteSections(CorpusWriter& writer, CorpusRandom& random, const CorpusOptions& options, unsigned level, const std::string& indent)
+{
+    if (level >= options.depth)
+        return;
+
+    std::string ns(options.namespaces ? NAMESPACE_PREFIX : "");
+
+    std::string section(indent + "<" + ns + "section level=\"" + std::to_string(level + 1) + "\"");
+    if (random.Chance(options.attributeDensity))
+        section += std::string(" lang=\"") + LANGUAGES[random.Below(5)] + "\"";
+    section += ">\n" + indent + "  <" + ns + "para>" + MakeText(random, options.textSize) + "</" + ns + "para>\n";
+
+    writer.Write(section);
+
+    WriteSections(writer, random, options, level + 1, indent + "  ");
+
+    writer.Write(indent + "</" + ns + "section>\n");
+}
+
+std::string MakeText(CorpusRandom& random, size_t size)
+{
+    std::string text;
+
+    while (text.size() < size || text.empty())
+    {
+        if (!text.empty())
+            text.push_back(' ');
+
+        text += WORDS[random.Below(sizeof(WORDS) / sizeof(WORDS[0]))];
+    }
+
+    return text;
+}
+
+CorpusWriter::CorpusWriter(const std::string& file, CorpusEncoding encoding)
+    : _file(std::fopen(file.c_str(), "wb")),
+      _encoding(encoding),
+      _buffer(WRITE_BUFFER_SIZE),
+      _used(0),
+      _bytesWritten(0)
+{
+    if (_file == nullptr)
+        throw std::runtime_error("Cannot open " + file + " for writing");
+}
+
+CorpusWriter::~CorpusWriter()
+{
+    if (_file != nullptr)
+    {
+        if (_used > 0)
+            std::fwrite(_buffer.data(), 1, _used, _file);
+
+        std::fclose(_file);
+    }
+}
+
+void CorpusWriter::Write(const std::string& utf8)
+{
+    if (_encoding == CorpusEncoding::UTF8)
+    {
+        for (size_t i = 0; i < utf8.size();)
+        {
+            if (_used == _buffer.size())
+                Flush();
+
+            size_t length = std::min(utf8.size() - i, _buffer.size() - _used);
+            std::memcpy(_buffer.data() + _used, utf8.data() + i, length);
+
+            _used += length;
+            _bytesWritten += length;
+            i += length;
+        }
+        return;
+    }
+
+    // UTF-8 to UTF-16LE, the generated text only contains BMP characters
+    for (size_t i = 0; i < utf8.size();)
+    {
+        unsigned char lead = static_cast<unsigned char>(utf8[i]);
+        unsigned codePoint;
+
+        if (lead < 0x80)
+        {
+            codePoint = lead;
+            i += 1;
+        }
+        else if ((lead & 0xE0) == 0xC0)
+        {
+            codePoint = ((lead & 0x1Fu) << 6) | (utf8[i + 1] & 0x3Fu);
+            i += 2;
+        }
+        else
+        {
+            codePoint = ((lead & 0x0Fu) << 12) | ((utf8[i + 1] & 0x3Fu) << 6) | (utf8[i + 2] & 0x3Fu);
+            i += 3;
+        }
+
+        Put(static_cast<unsigned char>(codePoint & 0xFF));
+        Put(static_cast<unsigned char>(codePoint >> 8));
+    }
+}
+
+void CorpusWriter::Put(unsigned char byte)
+{
+    if (_used == _buffer.size())
+        Flush();
+
+    _buffer[_used++] = byte;
+    _bytesWritten++;
+}
+
+void CorpusWriter::Flush()
+{
+    if (_used > 0 && std::fwrite(_buffer.data(), 1, _used, _file) != _used)
+        throw std::runtime_error("Write failed");
+
+    _used = 0;
+}
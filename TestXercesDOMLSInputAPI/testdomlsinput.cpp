@@ -1,4 +1,11 @@
 #include "testdomlsinput.h"
+#include "mappedfileinputsource.h"
+#include "domlsparserpool.h"
+#include "grammarpool.h"
+#include "documentmerge.h"
+#include "chunkedinputsource.h"
+#include "compressedinputsource.h"
+#include "commandline.h"
 
 #include <xercesc/dom/DOM.hpp>
 
@@ -30,6 +37,12 @@ XERCES_CPP_NAMESPACE_USE
 #include <sstream>
 #include <stdexcept>
 #include <list>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <new>
 
 #include <chrono>
 
@@ -37,7 +50,7 @@ XERCES_CPP_NAMESPACE_USE
 
 long long GetTimestamp()
 {
-    auto duration = std::chrono::system_clock::now().time_since_epoch();
+    auto duration = std::chrono::steady_clock::now().time_since_epoch();
     long long millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
     return millis;
 }
@@ -147,6 +160,67 @@ private:
     std::string _error;
 };
 
+// Installed as the platform memory manager, so every document, parser and
+// temporary copy is counted. Lets a benchmark report the bytes it held at peak.
+class TrackingMemoryManager : public MemoryManager
+{
+public:
+    TrackingMemoryManager() : _currentBytes(0), _peakBytes(0) {}
+
+    MemoryManager* getExceptionMemoryManager() override
+    {
+        return this;
+    }
+
+    void* allocate(XMLSize_t size) override
+    {
+        char* block;
+
+        try
+        {
+            // The size goes in front of the block, keeping the alignment of any type
+            block = static_cast<char*>(::operator new(size + HEADER_SIZE));
+        }
+        catch (const std::bad_alloc&)
+        {
+            throw OutOfMemoryException();
+        }
+
+        *reinterpret_cast<size_t*>(block) = size;
+
+        size_t current = _currentBytes += size;
+        size_t peak = _peakBytes;
+
+        while (current > peak && !_peakBytes.compare_exchange_weak(peak, current))
+            ;
+
+        return block + HEADER_SIZE;
+    }
+
+    void deallocate(void* p) override
+    {
+        if (p == nullptr)
+            return;
+
+        char* block = static_cast<char*>(p) - HEADER_SIZE;
+
+        _currentBytes -= *reinterpret_cast<size_t*>(block);
+        ::operator delete(block);
+    }
+
+    size_t GetCurrentBytes() const { return _currentBytes; }
+    size_t GetPeakBytes() const { return _peakBytes; }
+
+    // The next peak is measured from what is held now
+    void ResetPeak() { _peakBytes = _currentBytes.load(); }
+
+private:
+    static const size_t HEADER_SIZE = alignof(std::max_align_t);
+
+    std::atomic<size_t> _currentBytes;
+    std::atomic<size_t> _peakBytes;
+};
+
 DOMDocument* ParseFile(const std::string& file);
 void PrintDOMElements(const std::list<DOMElement*>& elementsList);
 
@@ -158,12 +232,15 @@ DOMDocumentFragment* ParseFileIntoExistingDomDocument(const std::string& file, D
 DOMDocumentFragment* ParseFileThanManuallyAddIntoExistingDomDocument(const std::string& file, DOMDocument* document);
 
 DOMDocument* ParseStringWithDOMLSInput(const std::string& string);
+DOMDocument* ParseChunkedStreamWithDOMLSInput(const std::shared_ptr<ChunkedByteStream>& stream);
 
 DOMImplementation* GetDOMImplementation();
 
 void PrintNodeType(const DOMNode::NodeType& nodeType);
 
 int mainDOMLSInputTest(const int argc, const char* argv[]);
+int mainMergeBenchmark(const int argc, const char* argv[]);
+int mainChunkedStreamTest(const int argc, const char* argv[]);
 
 void Initialize();
 void Terminate();
@@ -188,6 +265,18 @@ const short XPATH_CASE_4(4);
 
 const short TEST_XPATH_CASE = XPATH_CASE_1;
 
+// Limits of the counts taken from the command line
+const long long MAX_MERGE_PARTS(100000);
+const long long MAX_CHUNK_SIZE(64LL * 1024 * 1024);
+
+// Validate the whole-document parse helpers against grammars compiled once in Initialize()
+const bool VALIDATE_WITH_GRAMMAR_POOL = false;
+const std::vector<std::string> PRELOADED_GRAMMARS = { RESOURCES_DIR "sample.xsd" };
+
+TrackingMemoryManager trackingMemoryManager;
+std::unique_ptr<SharedGrammarPool> sharedGrammarPool;
+std::unique_ptr<DOMLSParserPool> domLSParserPool;
+
 DOMImplementation* GetDOMImplementation()
 {
     switch (CURRENT_IMPL_NAME)
@@ -219,7 +308,16 @@ int main(const int argc, const char* argv[])
         return 1;
     }
 
-    int result = ::mainDOMLSInputTest(argc, argv);
+    std::string mode(argc > 1 ? argv[1] : "");
+
+    int result;
+
+    if (mode == "--merge")
+        result = ::mainMergeBenchmark(argc, argv);
+    else if (mode == "--stdin")
+        result = ::mainChunkedStreamTest(argc, argv);
+    else
+        result = ::mainDOMLSInputTest(argc, argv);
 
     ::Terminate();
 
@@ -233,20 +331,35 @@ void Initialize()
         case DOMImplName::XERCESC:
         {
             std::cout << "Initialize XERCESC" << std::endl;
-            XMLPlatformUtils::Initialize();
+            XMLPlatformUtils::Initialize(XMLUni::fgXercescDefaultLocale, nullptr, nullptr, &trackingMemoryManager);
             break;
         }
         case DOMImplName::XQILLA:
         {
             std::cout << "Initialize XQILLA" << std::endl;
-            XQillaPlatformUtils::initialize();
+            XQillaPlatformUtils::initialize(&trackingMemoryManager);
             break;
         }
     }
+
+    if (VALIDATE_WITH_GRAMMAR_POOL)
+    {
+        sharedGrammarPool.reset(new SharedGrammarPool());
+        sharedGrammarPool->Load(PRELOADED_GRAMMARS);
+        sharedGrammarPool->Lock();
+
+        std::cout << "Grammar pool: " << sharedGrammarPool->GetGrammarCount() << " grammars" << std::endl;
+    }
+
+    domLSParserPool.reset(new DOMLSParserPool(::GetDOMImplementation(), 8, sharedGrammarPool.get()));
 }
 
 void Terminate()
 {
+    // Pooled parsers must be released before the platform is terminated, they hold on to the grammar pool
+    domLSParserPool.reset();
+    sharedGrammarPool.reset();
+
     switch (CURRENT_IMPL_NAME)
     {
         case DOMImplName::XERCESC:
@@ -339,33 +452,217 @@ int mainDOMLSInputTest(const int argc, const char* argv[])
     return returnCode;
 }
 
+int mainMergeBenchmark(const int argc, const char* argv[])
+{
+    // TestXercesDOMLSInputAPI --merge <part.xml> [parts]
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " --merge <part.xml> [parts]" << std::endl;
+        return 1;
+    }
+
+    std::string partFile(argv[2]);
+    size_t parts = 100;
+
+    try
+    {
+        if (argc > 3)
+            parts = static_cast<size_t>(::ParseCount(argv[3], 1, MAX_MERGE_PARTS));
+    }
+    catch (const std::logic_error&)
+    {
+        std::cout << "Usage: " << argv[0] << " --merge <part.xml> [parts]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        DOMImplementation* impl = ::GetDOMImplementation();
+
+        // Baseline: every part parsed into a temporary document, then deep-copied with importNode()
+        {
+            DOMDocument* composite = impl->createDocument(nullptr, X("Composite"), nullptr);
+            DOMElement* root = composite->getDocumentElement();
+
+            trackingMemoryManager.ResetPeak();
+            size_t startBytes = trackingMemoryManager.GetCurrentBytes();
+
+            long long startTime(GetTimestamp());
+
+            for (size_t i = 0; i < parts; i++)
+                root->appendChild(::ParseFileThanManuallyAddIntoExistingDomDocument(partFile, composite));
+
+            std::cout << "ParseFileThanManuallyAddIntoExistingDomDocument: " << parts << " parts in "
+                << (GetTimestamp() - startTime) << ", peak "
+                << (trackingMemoryManager.GetPeakBytes() - startBytes) << " bytes" << std::endl;
+
+            composite->release();
+        }
+
+        // Every part parsed straight under the composite root with one leased parser
+        {
+            DOMDocument* composite = impl->createDocument(nullptr, X("Composite"), nullptr);
+            DOMElement* root = composite->getDocumentElement();
+
+            MergeStatistics statistics;
+
+            trackingMemoryManager.ResetPeak();
+            size_t startBytes = trackingMemoryManager.GetCurrentBytes();
+
+            long long startTime(GetTimestamp());
+
+            ::MergeFilesInto(*domLSParserPool, std::vector<std::string>(parts, partFile), root, &statistics);
+
+            std::cout << "MergeFilesInto: " << statistics.parts << " parts, "
+                << statistics.movedNodes << " top-level nodes in "
+                << (GetTimestamp() - startTime) << ", peak "
+                << (trackingMemoryManager.GetPeakBytes() - startBytes) << " bytes" << std::endl;
+
+            composite->release();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int mainChunkedStreamTest(const int argc, const char* argv[])
+{
+    // TestXercesDOMLSInputAPI --stdin [chunk size in bytes] < file.xml
+    size_t chunkSize = 64 * 1024;
+
+    try
+    {
+        if (argc > 2)
+            chunkSize = static_cast<size_t>(::ParseCount(argv[2], 1, MAX_CHUNK_SIZE));
+    }
+    catch (const std::logic_error&)
+    {
+        std::cout << "Usage: " << argv[0] << " --stdin [chunk size in bytes] < file.xml" << std::endl;
+        return 1;
+    }
+
+    auto stream = std::make_shared<ChunkedByteStream>(chunkSize);
+
+    size_t bytesRead = 0;
+    std::string readError;
+
+    // The pipe is read while the parser already works on the first chunks
+    std::thread producer([&]()
+    {
+        try
+        {
+            bytesRead = ::PumpDescriptor(0, *stream);
+        }
+        catch (const std::exception& e)
+        {
+            stream->Abort();
+            readError = e.what();
+        }
+        catch (...)
+        {
+            stream->Abort();
+            readError = "UNKNOWN error occurred!!";
+        }
+    });
+
+    DOMDocument* document = nullptr;
+    int returnCode = 0;
+
+    try
+    {
+        long long startTime(GetTimestamp());
+
+        document = ::ParseChunkedStreamWithDOMLSInput(stream);
+
+        long long parseTime(GetTimestamp() - startTime);
+
+        producer.join();
+
+        if (!readError.empty())
+            throw std::runtime_error(readError);
+
+        if (document == nullptr || document->getDocumentElement() == nullptr)
+            throw std::runtime_error("Fail to load doc!");
+
+        std::cout << "Parsed " << bytesRead << " bytes in chunks of " << chunkSize << " in " << parseTime << std::endl;
+        std::cout << "Root element: " << UTF8(document->getDocumentElement()->getTagName()) << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        returnCode = 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        returnCode = 1;
+    }
+
+    // A parse that failed early aborted the stream, the producer is not blocked
+    if (producer.joinable())
+        producer.join();
+
+    if (document != nullptr)
+        document->release();
+
+    return returnCode;
+}
+
 DOMDocument* ParseFile(const std::string& file)
 {
-    XercesDOMParser parser;
+    XercesDOMParser parser(nullptr, XMLPlatformUtils::fgMemoryManager, sharedGrammarPool ? sharedGrammarPool->Get() : nullptr);
     parser.setValidationScheme(XercesDOMParser::Val_Auto);
     parser.setDoNamespaces(true);
+
+    if (sharedGrammarPool)
+        sharedGrammarPool->Configure(parser);
+
     parser.parse(file.c_str());
 
+    if (sharedGrammarPool && parser.getErrorCount() > 0)
+        throw std::runtime_error(file + " is not valid against the preloaded grammars");
+
     return parser.adoptDocument();
 }
 
 DOMDocument* ParseFileWithDOMLSInput(const std::string& file)
 {
     DOMImplementation* impl = ::GetDOMImplementation();
-    DOMLSParser* parser = impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMNamespaces, true);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMValidateIfSchema, false);
-    parser->getDomConfig()->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, true);
+
+    DOMLSParserConfig parserConfig;
+    parserConfig.validateWithGrammarPool = VALIDATE_WITH_GRAMMAR_POOL;
+
+    auto parser = domLSParserPool->Acquire(parserConfig);
+
+    // Throws before the input exists for an unsupported compression
+    auto fileInputSource = ::CreateFileInputSource(file);
 
     DOMLSInput* input = impl->createLSInput();
+    input->setByteStream(fileInputSource.get());
 
-    LocalFileInputSource fileInputSource(X(file.c_str()));
-    input->setByteStream(&fileInputSource);
+    DOMDocument* document = nullptr;
 
-    auto document = parser->parse(input);
+    try
+    {
+        document = parser->parse(input);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
 
     input->release();
-    parser->release();
 
     return document;
 }
@@ -375,15 +672,12 @@ DOMDocument* ParseStringWithDOMLSInput(const std::string& string)
     DOMParserErrorHandler errorHandler;
 
     DOMImplementation* impl = ::GetDOMImplementation();
-    DOMLSParser* parser = impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0);
+    DOMLSParserConfig parserConfig;
+    parserConfig.elementContentWhitespace = false;
 
-    auto config = parser->getDomConfig();
-    config->setParameter(XMLUni::fgDOMNamespaces, true);
-    config->setParameter(XMLUni::fgDOMValidateIfSchema, false);
-    config->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, true);
-    config->setParameter(XMLUni::fgDOMElementContentWhitespace, false);
+    auto parser = domLSParserPool->Acquire(parserConfig);
 
-    //config->setParameter(XMLUni::fgDOMErrorHandler, &errorHandler);
+    //parser->getDomConfig()->setParameter(XMLUni::fgDOMErrorHandler, &errorHandler);
 
     DOMLSInput* input = impl->createLSInput();
 
@@ -395,10 +689,50 @@ DOMDocument* ParseStringWithDOMLSInput(const std::string& string)
     );
     input->setByteStream(&memInputSource);
 
-    auto document = parser->parse(input);
+    DOMDocument* document = nullptr;
+
+    try
+    {
+        document = parser->parse(input);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
+
+    input->release();
+
+    return document;
+}
+
+DOMDocument* ParseChunkedStreamWithDOMLSInput(const std::shared_ptr<ChunkedByteStream>& stream)
+{
+    DOMImplementation* impl = ::GetDOMImplementation();
+
+    DOMLSParserConfig parserConfig;
+    parserConfig.validateWithGrammarPool = VALIDATE_WITH_GRAMMAR_POOL;
+
+    auto parser = domLSParserPool->Acquire(parserConfig);
+
+    DOMLSInput* input = impl->createLSInput();
+
+    ChunkedInputSource chunkedInputSource(stream);
+    input->setByteStream(&chunkedInputSource);
+
+    DOMDocument* document = nullptr;
+
+    try
+    {
+        document = parser->parse(input);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
 
     input->release();
-    parser->release();
 
     return document;
 }
@@ -408,20 +742,24 @@ DOMDocumentFragment* ParseFileIntoExistingDomDocument(const std::string& file, D
     auto fragment = document->createDocumentFragment();
 
     DOMImplementation* impl = ::GetDOMImplementation();
-    DOMLSParser* parser = impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMNamespaces, true);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMValidateIfSchema, false);
-    parser->getDomConfig()->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, true);
+    auto parser = domLSParserPool->Acquire(DOMLSParserConfig());
 
     DOMLSInput* input = impl->createLSInput();
 
-    LocalFileInputSource fileInputSource(X(file.c_str()));
+    MappedFileInputSource fileInputSource(file);
     input->setByteStream(&fileInputSource);
 
-    parser->parseWithContext(input, fragment, DOMLSParser::ACTION_APPEND_AS_CHILDREN);
+    try
+    {
+        parser->parseWithContext(input, fragment, DOMLSParser::ACTION_APPEND_AS_CHILDREN);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
 
     input->release();
-    parser->release();
 
     return fragment;
 }
@@ -431,30 +769,33 @@ DOMDocumentFragment* ParseFileThanManuallyAddIntoExistingDomDocument(const std::
     auto fragment = document->createDocumentFragment();
 
     DOMImplementation* impl = ::GetDOMImplementation();
-    DOMLSParser* parser = impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMNamespaces, true);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMValidateIfSchema, false);
-    //parser->getDomConfig()->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, true);
+    // The temporary document is ours, MergeDocumentInto releases it after the copy
+    auto parser = domLSParserPool->Acquire(DOMLSParserConfig());
 
     DOMLSInput* input = impl->createLSInput();
 
-    LocalFileInputSource fileInputSource(X(file.c_str()));
+    MappedFileInputSource fileInputSource(file);
     input->setByteStream(&fileInputSource);
 
-    auto tempDocument = parser->parse(input);
+    DOMDocument* tempDocument;
 
-    auto child = tempDocument->getFirstChild();
-
-    while (child != nullptr)
+    try
     {
-        auto imported = document->importNode(child, true);
-        fragment->appendChild(imported);
-
-        child = child->getNextSibling();
+        tempDocument = parser->parse(input);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
     }
 
     input->release();
-    parser->release();
+
+    if (tempDocument == nullptr)
+        throw std::runtime_error("Cannot parse " + file);
+
+    // importNode() deep-copies every top-level node into the heap of document
+    ::MergeDocumentInto(tempDocument, fragment);
 
     return fragment;
 }
@@ -467,7 +808,7 @@ void PrintDOMElements(const std::list<DOMElement*>& elementsList)
 
     // DOMLSOutput-----------------------------------------
     DOMLSOutput* theOutPut = domImpl->createLSOutput();
-    theOutPut->setEncoding(X("UTF-8"));
+    theOutPut->setEncoding(XMLUni::fgUTF8EncodingString);
     //-----------------------------------------------------
 
     // DOMLSSerializer-------------------------------------
@@ -520,7 +861,7 @@ void PrintDOMNode(DOMNode* node)
 
     // DOMLSOutput-----------------------------------------
     DOMLSOutput* theOutPut = domImpl->createLSOutput();
-    theOutPut->setEncoding(XMLString::transcode("UTF-8"));
+    theOutPut->setEncoding(XMLUni::fgUTF8EncodingString);
     //-----------------------------------------------------
 
     // DOMLSSerializer-------------------------------------
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Fixed capacity multi-producer multi-consumer queue. Push() blocks while the
+// queue is full, which is what holds a fast stage back to the pace of the
+// next one. Close() lets consumers drain what is left, Cancel() drops it.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity)
+        : _capacity(capacity > 0 ? capacity : 1), _closed(false), _cancelled(false)
+    {
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // False when the queue was cancelled, item is left untouched then.
+    bool Push(T& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this]() { return _items.size() < _capacity || _cancelled; });
+
+        if (_cancelled)
+            return false;
+
+        _items.push_back(std::move(item));
+        lock.unlock();
+
+        _notEmpty.notify_one();
+
+        return true;
+    }
+
+    // False once the queue is closed and empty, or cancelled.
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this]() { return !_items.empty() || _closed || _cancelled; });
+
+        if (_cancelled || _items.empty())
+            return false;
+
+        item = std::move(_items.front());
+        _items.pop_front();
+        lock.unlock();
+
+        _notFull.notify_one();
+
+        return true;
+    }
+
+    // No more pushes, consumers finish the remaining items.
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+
+        _notEmpty.notify_all();
+    }
+
+    // Wakes every waiter and destroys the queued items.
+    void Cancel()
+    {
+        std::deque<T> dropped;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cancelled = true;
+            dropped.swap(_items);
+        }
+
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+private:
+    const size_t _capacity;
+
+    std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::deque<T> _items;
+    bool _closed;
+    bool _cancelled;
+};
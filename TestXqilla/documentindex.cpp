@@ -0,0 +1,89 @@
+#include "documentindex.h"
+#include "xpathexpressioncache.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+DocumentIndex::DocumentIndex(DOMDocument* document, const std::vector<std::string>& indexedAttributes)
+    : _document(document), _index(ElementAccessor())
+{
+    DOMElement* root = document->getDocumentElement();
+
+    if (root == nullptr)
+        return;
+
+    auto bindings = XPathExpressionCache::CollectNamespaceBindings(root);
+
+    ElementIndexBase::Namespaces namespaces;
+
+    for (auto it = bindings.begin(); it != bindings.end(); it++)
+        namespaces[it->first] = X(it->second.c_str());
+
+    _index.Bind(namespaces, indexedAttributes);
+
+    // Pre-order walk, so every list is in document order
+    DOMElement* element = root;
+
+    while (element != nullptr)
+    {
+        _index.Add(element);
+
+        DOMElement* next = element->getFirstElementChild();
+
+        while (next == nullptr && element != root)
+        {
+            next = element->getNextElementSibling();
+
+            if (next == nullptr)
+                element = static_cast<DOMElement*>(element->getParentNode());
+        }
+
+        element = next;
+    }
+}
+
+bool DocumentIndex::TryEvaluate(const std::string& xpath, std::vector<DOMElement*>& resultList) const
+{
+    return _index.TryEvaluate(xpath, resultList);
+}
+
+DocumentIndex::Statistics DocumentIndex::GetStatistics() const
+{
+    return _index.GetStatistics();
+}
+
+const XMLCh* DocumentIndex::ElementAccessor::GetLocalName(DOMElement* element) const
+{
+    // Without namespace processing the local name is not set
+    return element->getLocalName() != nullptr ? element->getLocalName() : element->getTagName();
+}
+
+const XMLCh* DocumentIndex::ElementAccessor::GetNamespaceURI(DOMElement* element) const
+{
+    return element->getNamespaceURI();
+}
+
+const XMLCh* DocumentIndex::ElementAccessor::GetAttributeValue(DOMElement* element, const XMLChString& namespaceURI, const XMLCh* localName) const
+{
+    const DOMAttr* attribute = element->getAttributeNodeNS(namespaceURI.empty() ? nullptr : namespaceURI.c_str(), localName);
+
+    return attribute != nullptr ? attribute->getValue() : nullptr;
+}
+
+bool DocumentIndex::ElementAccessor::IsDocumentElement(DOMElement* element) const
+{
+    const DOMNode* parent = element->getParentNode();
+
+    return parent != nullptr && parent->getNodeType() == DOMNode::DOCUMENT_NODE;
+}
+
+bool DocumentIndex::ElementAccessor::GetParentElement(DOMElement* element, DOMElement*& parent) const
+{
+    DOMNode* node = element->getParentNode();
+
+    if (node == nullptr || node->getNodeType() != DOMNode::ELEMENT_NODE)
+        return false;
+
+    parent = static_cast<DOMElement*>(node);
+
+    return true;
+}
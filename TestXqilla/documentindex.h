@@ -0,0 +1,48 @@
+#pragma once
+
+#include "elementindex.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Element and attribute value lookup tables built in one pass over a parsed
+// document. Paths in the StreamingXPath subset whose last step has a name or
+// an indexed attribute value are answered from the tables instead of a tree
+// walk. The index is a snapshot, rebuild it after the document is modified.
+class DocumentIndex
+{
+public:
+    typedef ElementIndexBase::XMLChString XMLChString;
+    typedef ElementIndexBase::Statistics Statistics;
+
+    // indexedAttributes are attribute names, with a prefix bound on the root for namespaced ones
+    DocumentIndex(DOMDocument* document, const std::vector<std::string>& indexedAttributes);
+
+    DOMDocument* GetDocument() const { return _document; }
+
+    // Returns false when xpath is outside the shapes the index can answer, the
+    // caller then evaluates it with XQilla. Relative paths start at the root element.
+    bool TryEvaluate(const std::string& xpath, std::vector<DOMElement*>& resultList) const;
+
+    Statistics GetStatistics() const;
+
+private:
+    // The ElementIndex view of a DOM element
+    struct ElementAccessor
+    {
+        typedef DOMElement* Node;
+
+        const XMLCh* GetLocalName(DOMElement* element) const;
+        const XMLCh* GetNamespaceURI(DOMElement* element) const;
+        const XMLCh* GetAttributeValue(DOMElement* element, const XMLChString& namespaceURI, const XMLCh* localName) const;
+        bool IsDocumentElement(DOMElement* element) const;
+        bool GetParentElement(DOMElement* element, DOMElement*& parent) const;
+    };
+
+    DOMDocument* _document;
+    ElementIndex<ElementAccessor> _index;
+};
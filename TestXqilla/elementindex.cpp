@@ -0,0 +1,118 @@
+#include "elementindex.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <stdexcept>
+
+void ElementIndexBase::Bind(const Namespaces& namespaces, const std::vector<std::string>& indexedAttributes)
+{
+    _namespaces = namespaces;
+    _indexedAttributes.clear();
+
+    for (auto it = indexedAttributes.begin(); it != indexedAttributes.end(); it++)
+    {
+        size_t colon = it->find(':');
+        std::string prefix(colon == std::string::npos ? "" : it->substr(0, colon));
+        std::string localName(colon == std::string::npos ? *it : it->substr(colon + 1));
+
+        IndexedAttribute attribute;
+
+        if (!ResolvePrefix(prefix, attribute.namespaceURI))
+            throw std::runtime_error("Unbound prefix in indexed attribute " + *it);
+
+        attribute.localName = X(localName.c_str());
+        attribute.name = MakeName(attribute.namespaceURI.c_str(), attribute.localName.c_str());
+
+        _indexedAttributes.push_back(attribute);
+    }
+}
+
+bool ElementIndexBase::SameNamespace(const XMLCh* namespaceURI, const XMLChString& expected)
+{
+    if (namespaceURI == nullptr || *namespaceURI == 0)
+        return expected.empty();
+
+    return XMLString::equals(namespaceURI, expected.c_str());
+}
+
+bool ElementIndexBase::ResolvePrefix(const std::string& prefix, XMLChString& namespaceURI) const
+{
+    namespaceURI.clear();
+
+    if (prefix.empty())
+        return true;
+
+    auto found = _namespaces.find(prefix);
+
+    if (found == _namespaces.end())
+        return false;
+
+    namespaceURI = found->second;
+
+    return true;
+}
+
+bool ElementIndexBase::CanAnswer(const std::vector<StreamingXPath::Step>& steps) const
+{
+    XMLChString namespaceURI;
+
+    for (auto step = steps.begin(); step != steps.end(); step++)
+    {
+        if (!step->anyName && !ResolvePrefix(step->prefix, namespaceURI))
+            return false;
+
+        for (auto predicate = step->predicates.begin(); predicate != step->predicates.end(); predicate++)
+            if (predicate->kind == StreamingXPath::Predicate::POSITION || !ResolvePrefix(predicate->attributePrefix, namespaceURI))
+                return false;
+    }
+
+    return true;
+}
+
+bool ElementIndexBase::GetAttributeValueKey(const StreamingXPath::Step& last, XMLChString& key) const
+{
+    for (auto predicate = last.predicates.begin(); predicate != last.predicates.end(); predicate++)
+    {
+        if (predicate->kind != StreamingXPath::Predicate::ATTRIBUTE_EQUALS)
+            continue;
+
+        XMLChString namespaceURI;
+        ResolvePrefix(predicate->attributePrefix, namespaceURI);
+
+        XMLChString name(MakeName(namespaceURI.c_str(), predicate->attributeLocalName.c_str()));
+
+        for (auto it = _indexedAttributes.begin(); it != _indexedAttributes.end(); it++)
+        {
+            if (it->name == name)
+            {
+                key = MakeAttributeValue(name, predicate->attributeValue.c_str());
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+ElementIndexBase::XMLChString ElementIndexBase::MakeName(const XMLCh* namespaceURI, const XMLCh* localName)
+{
+    // {namespace-uri}local-name
+    XMLChString name(1, '{');
+
+    if (namespaceURI != nullptr)
+        name += namespaceURI;
+
+    name += '}';
+    name += localName;
+
+    return name;
+}
+
+ElementIndexBase::XMLChString ElementIndexBase::MakeAttributeValue(const XMLChString& name, const XMLCh* value)
+{
+    XMLChString key(name);
+    key += XMLCh(0);
+    key += value;
+
+    return key;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "streamingxpath.h"
+
+#include <xercesc/util/XMLString.hpp>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Element name and attribute value tables, and the matcher that checks the
+// candidates they return against a StreamingXPath path. DocumentIndex and
+// SnapshotIndex share them and only differ in how they reach the nodes.
+// ElementIndexBase holds what does not depend on the node type.
+class ElementIndexBase
+{
+public:
+    typedef StreamingXPath::XMLChString XMLChString;
+
+    // Prefix to namespace URI, the bindings of the root element
+    typedef std::unordered_map<std::string, XMLChString> Namespaces;
+
+    struct Statistics
+    {
+        size_t elements;
+        size_t names;
+        size_t attributeValues;
+    };
+
+    // indexedAttributes are attribute names, with a prefix bound in namespaces
+    // for namespaced ones. Throws std::runtime_error on an unbound prefix.
+    void Bind(const Namespaces& namespaces, const std::vector<std::string>& indexedAttributes);
+
+    // A null or empty namespaceURI is no namespace
+    static bool SameNamespace(const XMLCh* namespaceURI, const XMLChString& expected);
+
+protected:
+    struct IndexedAttribute
+    {
+        XMLChString namespaceURI;
+        XMLChString localName;
+        XMLChString name;
+    };
+
+    bool ResolvePrefix(const std::string& prefix, XMLChString& namespaceURI) const;
+
+    // Positions need the siblings, unbound prefixes must raise the XQilla error
+    bool CanAnswer(const std::vector<StreamingXPath::Step>& steps) const;
+
+    // The key of the first indexed attribute value the last step compares
+    // with, false when it compares none
+    bool GetAttributeValueKey(const StreamingXPath::Step& last, XMLChString& key) const;
+
+    static XMLChString MakeName(const XMLCh* namespaceURI, const XMLCh* localName);
+    static XMLChString MakeAttributeValue(const XMLChString& name, const XMLCh* value);
+
+    Namespaces _namespaces;
+    std::vector<IndexedAttribute> _indexedAttributes;
+};
+
+// NodeAccessor reads the elements where they are stored. Node is a handle
+// that is cheap to copy and the accessor provides:
+//   const XMLCh* GetLocalName(Node) const; the qualified name without namespace processing
+//   const XMLCh* GetNamespaceURI(Node) const;
+//   const XMLCh* GetAttributeValue(Node, const XMLChString& namespaceURI, const XMLCh* localName) const; nullptr when absent
+//   bool IsDocumentElement(Node) const;
+//   bool GetParentElement(Node, Node& parent) const; false when the parent is not an element
+template <typename NodeAccessor>
+class ElementIndex : public ElementIndexBase
+{
+public:
+    typedef typename NodeAccessor::Node Node;
+
+    ElementIndex(const NodeAccessor& accessor)
+        : _accessor(accessor), _elementCount(0)
+    {
+    }
+
+    const NodeAccessor& GetAccessor() const { return _accessor; }
+
+    // After Bind(), in document order so that every list is in document order
+    void Add(Node element)
+    {
+        _elementCount++;
+
+        _elementsByName[MakeName(_accessor.GetNamespaceURI(element), _accessor.GetLocalName(element))].push_back(element);
+
+        for (auto it = _indexedAttributes.begin(); it != _indexedAttributes.end(); it++)
+        {
+            const XMLCh* value = _accessor.GetAttributeValue(element, it->namespaceURI, it->localName.c_str());
+
+            if (value != nullptr)
+                _elementsByAttributeValue[MakeAttributeValue(it->name, value)].push_back(element);
+        }
+    }
+
+    // Returns false when xpath is outside the shapes the index can answer.
+    // Relative paths start at the root element.
+    bool TryEvaluate(const std::string& xpath, std::vector<Node>& resultList) const
+    {
+        StreamingXPath compiled;
+
+        if (!StreamingXPath::Compile(xpath, compiled))
+            return false;
+
+        const std::vector<StreamingXPath::Step>& steps = compiled.GetSteps();
+
+        if (!CanAnswer(steps))
+            return false;
+
+        static const Nodes NO_NODES;
+        const Nodes* candidates = nullptr;
+        const StreamingXPath::Step& last = steps.back();
+
+        XMLChString key;
+
+        // An indexed attribute value is usually far more selective than the element name
+        if (GetAttributeValueKey(last, key))
+        {
+            auto found = _elementsByAttributeValue.find(key);
+            candidates = found != _elementsByAttributeValue.end() ? &found->second : &NO_NODES;
+        }
+        else
+        {
+            if (last.anyName)
+                return false;
+
+            XMLChString namespaceURI;
+            ResolvePrefix(last.prefix, namespaceURI);
+
+            auto found = _elementsByName.find(MakeName(namespaceURI.c_str(), last.localName.c_str()));
+            candidates = found != _elementsByName.end() ? &found->second : &NO_NODES;
+        }
+
+        resultList.clear();
+
+        for (auto it = candidates->begin(); it != candidates->end(); it++)
+            if (Matches(*it, steps, steps.size() - 1))
+                resultList.push_back(*it);
+
+        return true;
+    }
+
+    Statistics GetStatistics() const
+    {
+        Statistics statistics;
+        statistics.elements = _elementCount;
+        statistics.names = _elementsByName.size();
+        statistics.attributeValues = _elementsByAttributeValue.size();
+
+        return statistics;
+    }
+
+private:
+    typedef std::vector<Node> Nodes;
+
+    bool Matches(Node element, const std::vector<StreamingXPath::Step>& steps, size_t stepIndex) const
+    {
+        if (!MatchesStep(element, steps[stepIndex]))
+            return false;
+
+        if (stepIndex == 0)
+            return steps[0].descendant || _accessor.IsDocumentElement(element);
+
+        Node parent;
+
+        if (!steps[stepIndex].descendant)
+            return _accessor.GetParentElement(element, parent) && Matches(parent, steps, stepIndex - 1);
+
+        for (Node child = element; _accessor.GetParentElement(child, parent); child = parent)
+            if (Matches(parent, steps, stepIndex - 1))
+                return true;
+
+        return false;
+    }
+
+    bool MatchesStep(Node element, const StreamingXPath::Step& step) const
+    {
+        XMLChString namespaceURI;
+
+        if (!step.anyName)
+        {
+            ResolvePrefix(step.prefix, namespaceURI);
+
+            if (!XMLString::equals(_accessor.GetLocalName(element), step.localName.c_str()) || !SameNamespace(_accessor.GetNamespaceURI(element), namespaceURI))
+                return false;
+        }
+
+        for (auto predicate = step.predicates.begin(); predicate != step.predicates.end(); predicate++)
+        {
+            ResolvePrefix(predicate->attributePrefix, namespaceURI);
+
+            const XMLCh* value = _accessor.GetAttributeValue(element, namespaceURI, predicate->attributeLocalName.c_str());
+
+            if (value == nullptr)
+                return false;
+
+            if (predicate->kind == StreamingXPath::Predicate::ATTRIBUTE_EQUALS && predicate->attributeValue != value)
+                return false;
+        }
+
+        return true;
+    }
+
+    NodeAccessor _accessor;
+
+    size_t _elementCount;
+    std::unordered_map<XMLChString, Nodes> _elementsByName;
+    std::unordered_map<XMLChString, Nodes> _elementsByAttributeValue;
+};
@@ -0,0 +1,571 @@
+#include "partitionedxpath.h"
+#include "fasttranscode.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+    // More partitions than threads so that one dense subtree does not hold up the others
+    const size_t PARTITIONS_PER_THREAD(4);
+
+    // Tokens that reach outside the partition or depend on the position of a node among its siblings.
+    // The namespace, base URI and language functions read the ancestors, which a fragment does not have.
+    const char* const UNSAFE_TOKENS[] = {
+        "..", "ancestor", "parent::", "preceding", "following",
+        "root(", "id(", "idref(", "doc(", "collection(",
+        "position(", "last(", "$",
+        "lang(", "namespace-uri-for-prefix(", "in-scope-prefixes(", "resolve-QName(", "base-uri("
+    };
+
+    bool IsSpace(char c)
+    {
+        return std::isspace(static_cast<unsigned char>(c)) != 0;
+    }
+
+    // The expression with the contents of string literals blanked out
+    std::string StripLiterals(const std::string& xpath)
+    {
+        std::string code(xpath);
+        char quote = 0;
+
+        for (size_t i = 0; i < code.size(); i++)
+        {
+            if (quote != 0)
+            {
+                if (code[i] == quote)
+                    quote = 0;
+                else
+                    code[i] = ' ';
+            }
+            else if (code[i] == '"' || code[i] == '\'')
+                quote = code[i];
+        }
+
+        return code;
+    }
+
+    std::string LocalName(const std::string& qname)
+    {
+        size_t colon = qname.find(':');
+        return colon == std::string::npos ? qname : qname.substr(colon + 1);
+    }
+
+    // Functions whose result is a boolean, a predicate made of one call to them is never positional
+    const char* const BOOLEAN_FUNCTIONS[] = {
+        "not", "boolean", "true", "false", "exists", "empty", "contains", "starts-with",
+        "ends-with", "matches", "deep-equal"
+    };
+
+    // Node tests written like function calls, they belong to a step
+    const char* const NODE_TESTS[] = {
+        "node", "text", "comment", "processing-instruction", "element", "attribute",
+        "document-node", "schema-element", "schema-attribute"
+    };
+
+    // Comparisons and logical operators, a predicate using one at its top level is boolean
+    const char* const BOOLEAN_OPERATORS[] = {
+        "=", "!=", "<", "<=", ">", ">=", "eq", "ne", "lt", "le", "gt", "ge", "and", "or"
+    };
+
+    struct Token
+    {
+        enum Kind
+        {
+            NAME,
+            NUMBER,
+            LITERAL,
+            VARIABLE,
+            SYMBOL
+        };
+
+        Kind kind;
+        std::string text;
+        // Ends a value or a step, what follows it is an operator or a step separator
+        bool operand;
+    };
+
+    bool IsNameStart(char c)
+    {
+        return std::isalpha(static_cast<unsigned char>(c)) != 0 || c == '_';
+    }
+
+    bool IsNameChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '_' || c == '-' || c == '.';
+    }
+
+    bool IsOneOf(const std::string& text, const char* const* begin, const char* const* end)
+    {
+        for (auto it = begin; it != end; it++)
+            if (text == *it)
+                return true;
+
+        return false;
+    }
+
+    template <size_t N>
+    bool IsOneOf(const std::string& text, const char* const (&list)[N])
+    {
+        return IsOneOf(text, list, list + N);
+    }
+
+    // Splits the expression into tokens and tells operands from operators the way
+    // the XPath grammar does: a name or '*' right after an operand is an operator.
+    // False on characters the check does not know.
+    bool Tokenize(const std::string& xpath, std::vector<Token>& tokens)
+    {
+        static const char* const TWO_CHAR_SYMBOLS[] = { "//", "::", "..", "!=", "<=", ">=", "<<", ">>" };
+
+        size_t i = 0;
+
+        while (i < xpath.size())
+        {
+            char c = xpath[i];
+
+            if (IsSpace(c))
+            {
+                i++;
+                continue;
+            }
+
+            bool previousOperand = !tokens.empty() && tokens.back().operand;
+            Token token;
+            size_t begin = i;
+
+            if (c == '"' || c == '\'')
+            {
+                size_t end = xpath.find(c, i + 1);
+
+                if (end == std::string::npos)
+                    return false;
+
+                token.kind = Token::LITERAL;
+                i = end + 1;
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < xpath.size() && std::isdigit(static_cast<unsigned char>(xpath[i + 1]))))
+            {
+                while (i < xpath.size() && (std::isalnum(static_cast<unsigned char>(xpath[i])) || xpath[i] == '.'))
+                    i++;
+
+                token.kind = Token::NUMBER;
+            }
+            else if (c == '$')
+            {
+                i++;
+
+                while (i < xpath.size() && (IsNameChar(xpath[i]) || xpath[i] == ':'))
+                    i++;
+
+                token.kind = Token::VARIABLE;
+            }
+            else if (IsNameStart(c))
+            {
+                while (i < xpath.size() && IsNameChar(xpath[i]))
+                    i++;
+
+                // prefix:local and prefix:*, but not the axis separator
+                if (i + 1 < xpath.size() && xpath[i] == ':' && (IsNameStart(xpath[i + 1]) || xpath[i + 1] == '*'))
+                {
+                    i++;
+
+                    if (xpath[i] == '*')
+                        i++;
+                    else
+                        while (i < xpath.size() && IsNameChar(xpath[i]))
+                            i++;
+                }
+
+                token.kind = Token::NAME;
+            }
+            else
+            {
+                token.kind = Token::SYMBOL;
+                i += i + 1 < xpath.size() && IsOneOf(xpath.substr(i, 2), TWO_CHAR_SYMBOLS) ? 2 : 1;
+
+                if (std::string("/()[]@,|=<>!*+-.:").find(c) == std::string::npos)
+                    return false;
+            }
+
+            token.text = xpath.substr(begin, i - begin);
+
+            switch (token.kind)
+            {
+                case Token::NAME:
+                {
+                    size_t next = i;
+                    while (next < xpath.size() && IsSpace(xpath[next]))
+                        next++;
+
+                    // Function names and axes are completed by what follows them
+                    bool followedByCall = next < xpath.size() && (xpath[next] == '(' || xpath.compare(next, 2, "::") == 0);
+                    token.operand = !previousOperand && !followedByCall;
+                    break;
+                }
+                case Token::SYMBOL:
+                    if (token.text == "*")
+                        token.operand = !previousOperand;
+                    else
+                        token.operand = token.text == ")" || token.text == "]" || token.text == "." || token.text == "..";
+                    break;
+                default:
+                    token.operand = true;
+                    break;
+            }
+
+            tokens.push_back(token);
+        }
+
+        return true;
+    }
+
+    bool IsOperator(const Token& token, bool previousOperand)
+    {
+        if (token.kind == Token::NAME)
+            return previousOperand;
+
+        return token.kind == Token::SYMBOL && (token.text == "*" ? previousOperand : IsOneOf(token.text, BOOLEAN_OPERATORS) ||
+            token.text == "+" || token.text == "-" || token.text == "|" || token.text == "," || token.text == "<<" || token.text == ">>");
+    }
+
+    // The predicate tokens [begin, end) are clearly boolean: a comparison or logical
+    // operator at their top level, one call to a boolean function, or a relative path
+    // (true when it selects nodes). A number would select by position.
+    bool IsBooleanPredicate(const std::vector<Token>& tokens, size_t begin, size_t end)
+    {
+        if (begin == end)
+            return false;
+
+        int depth = 0;
+        bool comparison = false;
+        bool path = true;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const Token& token = tokens[i];
+            bool previousOperand = i > begin && tokens[i - 1].operand;
+
+            if (token.text == "[" || token.text == "(")
+            {
+                // A '(' at the top level of a path only follows a node test
+                if (depth == 0 && token.text == "(" && !(i > begin && tokens[i - 1].kind == Token::NAME && IsOneOf(tokens[i - 1].text, NODE_TESTS)))
+                    path = false;
+
+                depth++;
+                continue;
+            }
+
+            if (token.text == "]" || token.text == ")")
+            {
+                depth--;
+                continue;
+            }
+
+            if (depth > 0)
+                continue;
+
+            if (IsOperator(token, previousOperand))
+            {
+                // Sequences and if/then/else bind looser than a comparison, a branch may still be a number
+                if (token.text == "," || token.text == "then" || token.text == "else")
+                    return false;
+
+                if (IsOneOf(token.text, BOOLEAN_OPERATORS))
+                    comparison = true;
+
+                path = false;
+            }
+            else if (token.kind != Token::NAME && token.text != "/" && token.text != "//" && token.text != "@" &&
+                     token.text != "::" && token.text != "*" && token.text != ".")
+                path = false;
+        }
+
+        if (comparison || path)
+            return true;
+
+        // fn:not(...), contains(...): the name, its argument list and nothing after it
+        const Token& name = tokens[begin];
+
+        if (name.kind != Token::NAME || begin + 1 >= end || tokens[begin + 1].text != "(" || tokens[end - 1].text != ")" ||
+            !IsOneOf(LocalName(name.text), BOOLEAN_FUNCTIONS))
+            return false;
+
+        depth = 0;
+
+        for (size_t i = begin + 1; i < end; i++)
+        {
+            if (tokens[i].text == "(" || tokens[i].text == "[")
+                depth++;
+            else if (tokens[i].text == ")" || tokens[i].text == "]")
+                depth--;
+
+            // The argument list closes before the end, something else follows the call
+            if (depth == 0 && i + 1 < end)
+                return false;
+        }
+
+        return true;
+    }
+
+    struct Partition
+    {
+        DOMDocumentFragment* fragment = nullptr;
+        std::vector<DOMElement*> elements;
+        std::exception_ptr error;
+    };
+
+    void EvaluatePartition(const DOMXPathExpression& expression, Partition& partition)
+    {
+        AutoRelease<DOMXPathResult> result(
+            expression.evaluate(
+                partition.fragment,
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr
+            )
+        );
+
+        size_t nLength = result->getSnapshotLength();
+        partition.elements.reserve(nLength);
+
+        for (size_t i = 0; i < nLength; i++)
+        {
+            result->snapshotItem(i);
+
+            auto tempNode = result->getNodeValue();
+
+            if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+                throw std::runtime_error("Result contain non-element node");
+
+            partition.elements.push_back(static_cast<DOMElement*>(tempNode));
+        }
+    }
+}
+
+bool IsPartitionSafeXPath(const std::string& xpath, const DOMElement* root)
+{
+    if (xpath.size() < 3 || xpath.compare(0, 2, "//") != 0 || xpath[2] == '/')
+        return false;
+
+    std::string code(StripLiterals(xpath));
+
+    // 'lang (...)' and 'parent ::' are the same tokens
+    for (size_t i = code.find_first_of("(:"); i != std::string::npos; i = code.find_first_of("(:", i + 1))
+    {
+        size_t spaceBegin = i;
+
+        while (spaceBegin > 0 && IsSpace(code[spaceBegin - 1]))
+            spaceBegin--;
+
+        code.erase(spaceBegin, i - spaceBegin);
+        i = spaceBegin;
+    }
+
+    for (auto token : UNSAFE_TOKENS)
+        if (code.find(token) != std::string::npos)
+            return false;
+
+    std::vector<Token> tokens;
+
+    if (!Tokenize(xpath, tokens))
+        return false;
+
+    // Index of the bracket closing each '[' and '('
+    std::vector<size_t> closing(tokens.size(), std::string::npos);
+    std::vector<size_t> open;
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        if (tokens[i].text == "[" || tokens[i].text == "(")
+            open.push_back(i);
+        else if (tokens[i].text == "]" || tokens[i].text == ")")
+        {
+            if (open.empty() || (tokens[open.back()].text == "[") != (tokens[i].text == "]"))
+                return false;
+
+            closing[open.back()] = i;
+            open.pop_back();
+        }
+    }
+
+    if (!open.empty())
+        return false;
+
+    int depth = 0;
+    size_t firstStepEnd = tokens.size();
+
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+        const Token& token = tokens[i];
+
+        // A path that does not continue a step starts from the document root,
+        // in a predicate or an argument as much as anywhere else
+        if ((token.text == "/" || token.text == "//") && !tokens[i - 1].operand)
+            return false;
+
+        if (token.text == "[" || token.text == "(")
+        {
+            if (depth == 0 && firstStepEnd == tokens.size())
+                firstStepEnd = i;
+
+            if (token.text == "[" && !IsBooleanPredicate(tokens, i + 1, closing[i]))
+                return false;
+
+            depth++;
+        }
+        else if (token.text == "]" || token.text == ")")
+            depth--;
+        else if (depth == 0)
+        {
+            // Only steps at the top level, no union, sequence, comparison or arithmetic
+            if (IsOperator(token, tokens[i - 1].operand))
+                return false;
+
+            if ((token.text == "/" || token.text == "//") && firstStepEnd == tokens.size())
+                firstStepEnd = i;
+        }
+    }
+
+    // The first step is a plain element name, child:: at most. Wildcards, node tests
+    // and other axes could select the root element itself.
+    size_t nameIndex = 1;
+
+    if (firstStepEnd == 4 && tokens[1].text == "child" && tokens[2].text == "::")
+        nameIndex = 3;
+    else if (firstStepEnd != 2)
+        return false;
+
+    const Token& firstStep = tokens[nameIndex];
+
+    if (firstStep.kind != Token::NAME || !firstStep.operand || firstStep.text.find('*') != std::string::npos)
+        return false;
+
+    return LocalName(firstStep.text) != ::ToUTF8(root->getLocalName() != nullptr ? root->getLocalName() : root->getTagName());
+}
+
+std::string MakePartitionXPath(const std::string& xpath)
+{
+    return "." + xpath;
+}
+
+std::string MakeSubtreeXPath(const std::string& xpath)
+{
+    std::string steps(xpath.substr(2));
+
+    steps.erase(0, std::min(steps.size(), steps.find_first_not_of(" \t\r\n")));
+
+    // '//child::a' is '//a', a partition safe first step has no other axis
+    if (steps.compare(0, 5, "child") == 0)
+    {
+        size_t axis = steps.find_first_not_of(" \t\r\n", 5);
+
+        if (axis != std::string::npos && steps.compare(axis, 2, "::") == 0)
+            steps.erase(0, axis + 2);
+    }
+
+    return "descendant-or-self::" + steps;
+}
+
+void EvaluatePartitioned(const DOMXPathExpression& expression, DOMElement* root, unsigned threadCount, std::vector<DOMElement*>& resultList)
+{
+    resultList.clear();
+
+    DOMDocument* document = root->getOwnerDocument();
+
+    std::vector<DOMNode*> children;
+    for (DOMNode* child = root->getFirstChild(); child != nullptr; child = child->getNextSibling())
+        children.push_back(child);
+
+    if (children.empty())
+        return;
+
+    threadCount = std::max(1u, threadCount > 0 ? threadCount : std::thread::hardware_concurrency());
+
+    // Contiguous runs of children, whitespace included, so that putting them back restores the tree exactly
+    std::vector<Partition> partitions(std::min(children.size(), threadCount * PARTITIONS_PER_THREAD));
+
+    std::atomic<size_t> nextPartition(0);
+
+    auto worker = [&]()
+    {
+        for (size_t p = nextPartition++; p < partitions.size(); p = nextPartition++)
+        {
+            try
+            {
+                EvaluatePartition(expression, partitions[p]);
+            }
+            catch (...)
+            {
+                partitions[p].error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    // Also after a failure part way: the detached children are a prefix of
+    // children, so they go back in front of those never taken out
+    auto restore = [&]()
+    {
+        for (auto it = workers.begin(); it != workers.end(); it++)
+            it->join();
+
+        DOMNode* firstAttached = root->getFirstChild();
+
+        for (auto it = partitions.begin(); it != partitions.end() && it->fragment != nullptr; it++)
+        {
+            // Inserting a fragment moves its children, in order
+            root->insertBefore(it->fragment, firstAttached);
+            it->fragment->release();
+            it->fragment = nullptr;
+        }
+    };
+
+    try
+    {
+        for (size_t p = 0; p < partitions.size(); p++)
+        {
+            partitions[p].fragment = document->createDocumentFragment();
+
+            size_t begin = children.size() * p / partitions.size();
+            size_t end = children.size() * (p + 1) / partitions.size();
+
+            for (size_t i = begin; i < end; i++)
+                partitions[p].fragment->appendChild(children[i]);
+        }
+
+        // The tree is only read from here until the children are put back
+        for (unsigned i = 1; i < std::min<size_t>(threadCount, partitions.size()); i++)
+            workers.emplace_back(worker);
+
+        worker();
+    }
+    catch (...)
+    {
+        // The workers already started stop after their current partition
+        nextPartition = partitions.size();
+        restore();
+        throw;
+    }
+
+    restore();
+
+    size_t total = 0;
+
+    for (auto it = partitions.begin(); it != partitions.end(); it++)
+        total += it->elements.size();
+
+    for (auto it = partitions.begin(); it != partitions.end(); it++)
+        if (it->error != nullptr)
+            std::rethrow_exception(it->error);
+
+    resultList.reserve(total);
+
+    for (auto it = partitions.begin(); it != partitions.end(); it++)
+        resultList.insert(resultList.end(), it->elements.begin(), it->elements.end());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// A descendant search '//step...' is partition safe when its first step cannot
+// match the root element and nothing in it looks outside the subtree or at
+// sibling positions: no '..', reverse or following axes, id()/root()/doc(),
+// position(), last() or top-level unions, no '/' that does not continue a step
+// (an absolute path, in a predicate or an argument as well), and every predicate
+// clearly boolean - a comparison, and/or, a boolean function such as not() or
+// contains(), or a relative path. The check works on tokens and errs on the
+// side of false.
+bool IsPartitionSafeXPath(const std::string& xpath, const DOMElement* root);
+
+// The relative form of a partition safe xpath, '//a/b' becomes './/a/b'.
+// Evaluated with a partition as context it finds the matches below that partition.
+std::string MakePartitionXPath(const std::string& xpath);
+
+// The form of a partition safe xpath evaluated with a child of the root element
+// as context, in place: '//a/b' becomes 'descendant-or-self::a/b'. It finds the
+// same matches as MakePartitionXPath on that child alone in a fragment, without
+// taking the child out of the tree.
+std::string MakeSubtreeXPath(const std::string& xpath);
+
+// Moves the children of root into contiguous document fragments, evaluates
+// the expression (compiled from MakePartitionXPath) on every fragment from
+// threadCount threads, puts the children back and appends the matches to
+// resultList in document order. 0 threads uses every core. The children are
+// back in place when it throws as well.
+void EvaluatePartitioned(const DOMXPathExpression& expression, DOMElement* root, unsigned threadCount, std::vector<DOMElement*>& resultList);
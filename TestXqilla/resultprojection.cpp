@@ -0,0 +1,480 @@
+#include "resultprojection.h"
+#include "fasttranscode.h"
+#include "xpathcursor.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+    typedef std::basic_string<XMLCh> XMLChString;
+
+    const char COLUMNAR_MAGIC[8] = { 'X', 'C', 'O', 'L', '0', '0', '0', '1' };
+    const uint32_t COLUMNAR_BYTE_ORDER_MARK(0x01020304);
+
+    struct CompiledColumn
+    {
+        ColumnType type;
+
+        // Child element names then an optional attribute name, when the XPath is that simple
+        bool direct;
+        std::vector<XMLChString> elementNames;
+        XMLChString attributeName;
+
+        std::shared_ptr<const DOMXPathExpression> expression;
+    };
+
+    bool IsNameCharacter(char c, bool first)
+    {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_' ||
+            (!first && (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '.'));
+    }
+
+    bool IsPlainName(const std::string& name)
+    {
+        if (name.empty())
+            return false;
+
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            if (!IsNameCharacter(name[i], i == 0))
+                return false;
+        }
+
+        return true;
+    }
+
+    // name('/'name)*, optionally ending in '@'name, or just '@'name
+    bool CompileDirectPath(const std::string& xpath, CompiledColumn& column)
+    {
+        size_t start = 0;
+
+        while (start <= xpath.size())
+        {
+            size_t slash = xpath.find('/', start);
+            std::string step(xpath.substr(start, slash == std::string::npos ? std::string::npos : slash - start));
+
+            if (!step.empty() && step[0] == '@')
+            {
+                if (slash != std::string::npos || !IsPlainName(step.substr(1)))
+                    return false;
+
+                column.attributeName = ::ScratchXMLCh(step.substr(1));
+                return true;
+            }
+
+            if (!IsPlainName(step))
+                return false;
+
+            column.elementNames.push_back(::ScratchXMLCh(step));
+
+            if (slash == std::string::npos)
+                return true;
+
+            start = slash + 1;
+        }
+
+        return false;
+    }
+
+    const DOMElement* FindChild(const DOMNode* parent, const XMLChString& localName)
+    {
+        // Unprefixed XPath names only match elements in no namespace
+        for (const DOMNode* child = parent->getFirstChild(); child != nullptr; child = child->getNextSibling())
+        {
+            if (child->getNodeType() == DOMNode::ELEMENT_NODE &&
+                child->getNamespaceURI() == nullptr &&
+                localName == (child->getLocalName() != nullptr ? child->getLocalName() : child->getNodeName()))
+                return static_cast<const DOMElement*>(child);
+        }
+
+        return nullptr;
+    }
+
+    // Same text as getTextContent(), without allocating the copy in the document heap
+    void AppendTextContent(const DOMNode* node, XMLChString& text)
+    {
+        switch (node->getNodeType())
+        {
+            case DOMNode::ELEMENT_NODE:
+            case DOMNode::ENTITY_REFERENCE_NODE:
+            case DOMNode::DOCUMENT_FRAGMENT_NODE:
+            {
+                for (const DOMNode* child = node->getFirstChild(); child != nullptr; child = child->getNextSibling())
+                {
+                    if (child->getNodeType() != DOMNode::COMMENT_NODE &&
+                        child->getNodeType() != DOMNode::PROCESSING_INSTRUCTION_NODE)
+                        AppendTextContent(child, text);
+                }
+                break;
+            }
+            case DOMNode::DOCUMENT_NODE:
+            {
+                const DOMNode* root = static_cast<const DOMDocument*>(node)->getDocumentElement();
+
+                if (root != nullptr)
+                    AppendTextContent(root, text);
+                break;
+            }
+            default:
+            {
+                const XMLCh* value = node->getNodeValue();
+
+                if (value != nullptr)
+                    text.append(value);
+                break;
+            }
+        }
+    }
+
+    // The node selected for column in row, nullptr when there is none
+    const DOMNode* SelectValue(const CompiledColumn& column, const DOMNode* row)
+    {
+        if (!column.direct)
+        {
+            XPathCursor cursor(column.expression, row, 0, 1);
+
+            return cursor.Next() ? cursor.Current() : nullptr;
+        }
+
+        const DOMNode* node = row;
+
+        for (auto it = column.elementNames.begin(); it != column.elementNames.end() && node != nullptr; it++)
+            node = FindChild(node, *it);
+
+        if (node == nullptr || column.attributeName.empty())
+            return node;
+
+        if (node->getNodeType() != DOMNode::ELEMENT_NODE)
+            return nullptr;
+
+        return static_cast<const DOMElement*>(node)->getAttributeNodeNS(nullptr, column.attributeName.c_str());
+    }
+
+    bool ParseNumber(const std::string& text, double& number)
+    {
+        const char* begin = text.c_str();
+        char* end = nullptr;
+
+        number = std::strtod(begin, &end);
+
+        if (end == begin)
+            return false;
+
+        while (*end != '\0' && std::isspace(static_cast<unsigned char>(*end)))
+            end++;
+
+        return *end == '\0' && !std::isnan(number);
+    }
+
+    std::string FormatNumber(double number)
+    {
+        char buffer[32];
+
+        // Shortest of the two precisions that reads back as the same double
+        std::snprintf(buffer, sizeof(buffer), "%.15g", number);
+
+        if (std::strtod(buffer, nullptr) != number)
+            std::snprintf(buffer, sizeof(buffer), "%.17g", number);
+
+        return buffer;
+    }
+}
+
+ProjectionColumn ParseProjectionColumn(const std::string& specification)
+{
+    ProjectionColumn column;
+    column.type = ColumnType::STRING;
+
+    size_t equals = specification.find('=');
+
+    // An '=' inside a predicate is part of the XPath
+    if (equals == std::string::npos || specification.find_first_of("[(/@", 0) < equals)
+    {
+        column.name = specification;
+        column.xpath = specification;
+        return column;
+    }
+
+    column.name = specification.substr(0, equals);
+    column.xpath = specification.substr(equals + 1);
+
+    size_t colon = column.name.find(':');
+
+    if (colon != std::string::npos)
+    {
+        std::string type(column.name.substr(colon + 1));
+
+        if (type == "number")
+            column.type = ColumnType::NUMBER;
+        else if (type != "string")
+            throw std::runtime_error("Unknown column type " + type);
+
+        column.name.erase(colon);
+    }
+
+    return column;
+}
+
+void RecordBatch::Clear()
+{
+    rows = 0;
+
+    for (auto it = columns.begin(); it != columns.end(); it++)
+    {
+        it->present.clear();
+        it->numbers.clear();
+        it->offsets.assign(1, 0);
+        it->bytes.clear();
+    }
+}
+
+CsvRecordWriter::CsvRecordWriter(const std::string& file, const std::vector<ProjectionColumn>& columns)
+    : _columns(columns), _stream(file, std::ios::binary)
+{
+    if (!_stream)
+        throw std::runtime_error("Cannot create " + file);
+
+    for (size_t i = 0; i < _columns.size(); i++)
+    {
+        if (i > 0)
+            _line.push_back(',');
+
+        WriteField(_columns[i].name.data(), _columns[i].name.size());
+    }
+
+    _line.append("\r\n");
+    _stream.write(_line.data(), _line.size());
+}
+
+void CsvRecordWriter::WriteBatch(const RecordBatch& batch)
+{
+    for (size_t row = 0; row < batch.rows; row++)
+    {
+        _line.clear();
+
+        for (size_t i = 0; i < batch.columns.size(); i++)
+        {
+            const RecordBatch::Column& column = batch.columns[i];
+
+            if (i > 0)
+                _line.push_back(',');
+
+            if (!column.present[row])
+                continue;
+
+            if (_columns[i].type == ColumnType::NUMBER)
+                _line.append(FormatNumber(column.numbers[row]));
+            else
+                WriteField(column.bytes.data() + column.offsets[row], column.offsets[row + 1] - column.offsets[row]);
+        }
+
+        _line.append("\r\n");
+        _stream.write(_line.data(), _line.size());
+    }
+
+    if (!_stream)
+        throw std::runtime_error("Cannot write CSV records");
+}
+
+void CsvRecordWriter::Finish()
+{
+    _stream.flush();
+
+    if (!_stream)
+        throw std::runtime_error("Cannot write CSV records");
+}
+
+void CsvRecordWriter::WriteField(const char* data, size_t length)
+{
+    bool quote = false;
+
+    for (size_t i = 0; i < length && !quote; i++)
+        quote = data[i] == ',' || data[i] == '"' || data[i] == '\r' || data[i] == '\n';
+
+    if (!quote)
+    {
+        _line.append(data, length);
+        return;
+    }
+
+    _line.push_back('"');
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == '"')
+            _line.push_back('"');
+
+        _line.push_back(data[i]);
+    }
+
+    _line.push_back('"');
+}
+
+ColumnarRecordWriter::ColumnarRecordWriter(const std::string& file, const std::vector<ProjectionColumn>& columns)
+    : _columns(columns), _stream(file, std::ios::binary)
+{
+    if (!_stream)
+        throw std::runtime_error("Cannot create " + file);
+
+    WriteBytes(COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+    WriteUInt32(COLUMNAR_BYTE_ORDER_MARK);
+    WriteUInt32(static_cast<uint32_t>(_columns.size()));
+
+    for (auto it = _columns.begin(); it != _columns.end(); it++)
+    {
+        WriteUInt32(static_cast<uint32_t>(it->type));
+        WriteUInt32(static_cast<uint32_t>(it->name.size()));
+        WriteBytes(it->name.data(), it->name.size());
+    }
+}
+
+void ColumnarRecordWriter::WriteBatch(const RecordBatch& batch)
+{
+    if (batch.rows == 0)
+        return;
+
+    WriteUInt32(static_cast<uint32_t>(batch.rows));
+
+    for (size_t i = 0; i < batch.columns.size(); i++)
+    {
+        const RecordBatch::Column& column = batch.columns[i];
+
+        WriteBytes(column.present.data(), batch.rows);
+
+        if (_columns[i].type == ColumnType::NUMBER)
+        {
+            WriteBytes(column.numbers.data(), batch.rows * sizeof(double));
+        }
+        else
+        {
+            WriteBytes(column.offsets.data(), (batch.rows + 1) * sizeof(uint32_t));
+            WriteBytes(column.bytes.data(), column.bytes.size());
+        }
+    }
+
+    if (!_stream)
+        throw std::runtime_error("Cannot write columnar records");
+}
+
+void ColumnarRecordWriter::Finish()
+{
+    WriteUInt32(0);
+    _stream.flush();
+
+    if (!_stream)
+        throw std::runtime_error("Cannot write columnar records");
+}
+
+void ColumnarRecordWriter::WriteBytes(const void* data, size_t size)
+{
+    _stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+}
+
+void ColumnarRecordWriter::WriteUInt32(uint32_t value)
+{
+    WriteBytes(&value, sizeof(value));
+}
+
+size_t ProjectRecords(const DOMNode* contextNode, const std::string& rowXPath, const std::vector<ProjectionColumn>& columns,
+                      XPathExpressionCache& cache, RecordWriter& writer, size_t batchRows)
+{
+    if (batchRows == 0)
+        batchRows = 1;
+
+    const DOMNode* bindingNode = contextNode->getNodeType() == DOMNode::DOCUMENT_NODE
+        ? static_cast<const DOMDocument*>(contextNode)->getDocumentElement()
+        : contextNode;
+
+    XPathExpressionCache::NamespaceBindings bindings(XPathExpressionCache::CollectNamespaceBindings(bindingNode));
+
+    std::vector<CompiledColumn> compiledColumns(columns.size());
+
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        CompiledColumn& compiled = compiledColumns[i];
+        compiled.type = columns[i].type;
+        compiled.direct = CompileDirectPath(columns[i].xpath, compiled);
+
+        if (!compiled.direct)
+            compiled.expression = cache.Get(columns[i].xpath, bindings);
+    }
+
+    RecordBatch batch;
+    batch.columns.resize(columns.size());
+    batch.Clear();
+
+    XMLChString text;
+    std::string utf8;
+    size_t rows = 0;
+
+    try
+    {
+        XPathCursor cursor(cache.Get(rowXPath, bindings), contextNode);
+
+        while (cursor.Next())
+        {
+            const DOMNode* row = cursor.Current();
+
+            for (size_t i = 0; i < compiledColumns.size(); i++)
+            {
+                RecordBatch::Column& column = batch.columns[i];
+                const DOMNode* value = SelectValue(compiledColumns[i], row);
+
+                text.clear();
+
+                if (value != nullptr)
+                    AppendTextContent(value, text);
+
+                ::TranscodeXMLCh(text.data(), text.size(), utf8);
+
+                if (compiledColumns[i].type == ColumnType::NUMBER)
+                {
+                    double number = 0;
+                    bool present = value != nullptr && ParseNumber(utf8, number);
+
+                    column.present.push_back(present ? 1 : 0);
+                    column.numbers.push_back(present ? number : 0);
+                }
+                else
+                {
+                    column.present.push_back(value != nullptr ? 1 : 0);
+                    column.bytes.append(utf8);
+                    column.offsets.push_back(static_cast<uint32_t>(column.bytes.size()));
+                }
+            }
+
+            rows++;
+
+            if (++batch.rows == batchRows)
+            {
+                writer.WriteBatch(batch);
+                batch.Clear();
+            }
+        }
+    }
+    catch (const XQillaException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+
+    writer.WriteBatch(batch);
+    writer.Finish();
+
+    return rows;
+}
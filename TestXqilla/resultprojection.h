@@ -0,0 +1,111 @@
+#pragma once
+
+#include "xpathexpressioncache.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Flat records projected from query results: one row per node selected by a
+// row XPath, one column per relative XPath evaluated with that row as context.
+// Values are read straight from the DOM and handed to a RecordWriter in
+// batches, nothing is serialized to XML on the way.
+
+enum class ColumnType
+{
+    STRING,
+    NUMBER
+};
+
+struct ProjectionColumn
+{
+    std::string name;
+    std::string xpath;
+    ColumnType type;
+};
+
+// "name=xpath" or "name:number=xpath", a bare "xpath" is a string column of the same name.
+ProjectionColumn ParseProjectionColumn(const std::string& specification);
+
+// Column-major values of the rows projected since the last flush.
+struct RecordBatch
+{
+    struct Column
+    {
+        // 0 when the column XPath selected nothing, or a NUMBER column is not a number
+        std::vector<uint8_t> present;
+        // NUMBER columns
+        std::vector<double> numbers;
+        // STRING columns, row i is bytes[offsets[i], offsets[i + 1]) in UTF-8
+        std::vector<uint32_t> offsets;
+        std::string bytes;
+    };
+
+    size_t rows;
+    std::vector<Column> columns;
+
+    // Keeps the capacity of every column
+    void Clear();
+};
+
+class RecordWriter
+{
+public:
+    virtual ~RecordWriter() {}
+
+    virtual void WriteBatch(const RecordBatch& batch) = 0;
+    virtual void Finish() = 0;
+};
+
+// RFC 4180 text with a header line, missing values are empty fields.
+class CsvRecordWriter : public RecordWriter
+{
+public:
+    CsvRecordWriter(const std::string& file, const std::vector<ProjectionColumn>& columns);
+
+    void WriteBatch(const RecordBatch& batch) override;
+    void Finish() override;
+
+private:
+    void WriteField(const char* data, size_t length);
+
+    std::vector<ProjectionColumn> _columns;
+    std::ofstream _stream;
+    std::string _line;
+};
+
+// Binary columns in the byte order of the writer, every batch is one block:
+//
+//   header  magic "XCOL0001", byte order mark 0x01020304, column count,
+//           then per column its type (uint32) and name (uint32 length, UTF-8)
+//   block   row count (uint32), then per column the presence bytes, then
+//           the doubles of a NUMBER column or the row count + 1 offsets
+//           (uint32) and the UTF-8 bytes of a STRING column
+//   end     a block with a row count of 0
+class ColumnarRecordWriter : public RecordWriter
+{
+public:
+    ColumnarRecordWriter(const std::string& file, const std::vector<ProjectionColumn>& columns);
+
+    void WriteBatch(const RecordBatch& batch) override;
+    void Finish() override;
+
+private:
+    void WriteBytes(const void* data, size_t size);
+    void WriteUInt32(uint32_t value);
+
+    std::vector<ProjectionColumn> _columns;
+    std::ofstream _stream;
+};
+
+// Evaluates rowXPath from contextNode and writes one record per selected
+// node, batchRows at a time. Column XPaths made of plain child and attribute
+// names are followed on the DOM directly, the others are compiled through
+// cache. Returns the number of rows. Throws std::runtime_error.
+size_t ProjectRecords(const DOMNode* contextNode, const std::string& rowXPath, const std::vector<ProjectionColumn>& columns,
+                      XPathExpressionCache& cache, RecordWriter& writer, size_t batchRows = 4096);
@@ -0,0 +1,135 @@
+#include "snapshotindex.h"
+#include "fasttranscode.h"
+
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLUni.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+SnapshotIndex::SnapshotIndex(const DOMSnapshotView& view, const std::vector<std::string>& indexedAttributes)
+    : _view(view), _parents(view.GetNodeCount(), DOMSnapshotView::NO_NODE), _index(NodeAccessor(_view, _parents))
+{
+    // Every node of a sound image is reached through one link, more visits
+    // than nodes mean that the links of a corrupt one are shared or cyclic
+    size_t visited = 0;
+
+    auto visit = [&]()
+    {
+        if (++visited > _view.GetNodeCount())
+            throw std::runtime_error("DOM snapshot is corrupt");
+    };
+
+    uint32_t root = _view.GetFirstChild(0);
+
+    while (root != DOMSnapshotView::NO_NODE && _view.GetNodeType(root) != DOMNode::ELEMENT_NODE)
+    {
+        visit();
+        root = _view.GetNextSibling(root);
+    }
+
+    if (root == DOMSnapshotView::NO_NODE)
+        return;
+
+    visit();
+
+    // Pre-order walk, so every list is in document order. The attribute lists
+    // are checked here too, the matcher follows them without a bound.
+    std::vector<uint32_t> elements;
+    std::vector<uint32_t> pending(1, root);
+
+    _parents[root] = 0;
+
+    while (!pending.empty())
+    {
+        uint32_t element = pending.back();
+        pending.pop_back();
+
+        elements.push_back(element);
+
+        for (uint32_t attribute = _view.GetFirstAttribute(element); attribute != DOMSnapshotView::NO_NODE; attribute = _view.GetNextSibling(attribute))
+            visit();
+
+        size_t firstChild = pending.size();
+
+        for (uint32_t child = _view.GetFirstChild(element); child != DOMSnapshotView::NO_NODE; child = _view.GetNextSibling(child))
+        {
+            visit();
+
+            // GetNodeType checks the index before it is used
+            if (_view.GetNodeType(child) != DOMNode::ELEMENT_NODE)
+                continue;
+
+            _parents[child] = element;
+            pending.push_back(child);
+        }
+
+        std::reverse(pending.begin() + firstChild, pending.end());
+    }
+
+    // Prefixes bound on the root element, like XPathExpressionCache::CollectNamespaceBindings
+    ElementIndexBase::Namespaces namespaces;
+
+    for (uint32_t attribute = _view.GetFirstAttribute(root); attribute != DOMSnapshotView::NO_NODE; attribute = _view.GetNextSibling(attribute))
+    {
+        const XMLCh* namespaceURI = _view.GetNamespaceURI(attribute);
+        const XMLCh* name = _view.GetName(attribute);
+
+        if (XMLString::equals(namespaceURI, XMLUni::fgXMLNSURIName) && XMLString::indexOf(name, chColon) != -1)
+            namespaces[::ToUTF8(_index.GetAccessor().GetLocalName(attribute))] = _view.GetValue(attribute);
+    }
+
+    _index.Bind(namespaces, indexedAttributes);
+
+    for (auto it = elements.begin(); it != elements.end(); it++)
+        _index.Add(*it);
+}
+
+bool SnapshotIndex::TryEvaluate(const std::string& xpath, std::vector<uint32_t>& resultList) const
+{
+    return _index.TryEvaluate(xpath, resultList);
+}
+
+SnapshotIndex::Statistics SnapshotIndex::GetStatistics() const
+{
+    return _index.GetStatistics();
+}
+
+const XMLCh* SnapshotIndex::NodeAccessor::GetLocalName(uint32_t node) const
+{
+    const XMLCh* name = _view.GetName(node);
+
+    if (_view.GetNamespaceURI(node) == nullptr)
+        return name;
+
+    int colon = XMLString::indexOf(name, chColon);
+
+    return colon == -1 ? name : name + colon + 1;
+}
+
+const XMLCh* SnapshotIndex::NodeAccessor::GetNamespaceURI(uint32_t node) const
+{
+    return _view.GetNamespaceURI(node);
+}
+
+const XMLCh* SnapshotIndex::NodeAccessor::GetAttributeValue(uint32_t element, const XMLChString& namespaceURI, const XMLCh* localName) const
+{
+    for (uint32_t attribute = _view.GetFirstAttribute(element); attribute != DOMSnapshotView::NO_NODE; attribute = _view.GetNextSibling(attribute))
+        if (XMLString::equals(GetLocalName(attribute), localName) && ElementIndexBase::SameNamespace(_view.GetNamespaceURI(attribute), namespaceURI))
+            return _view.GetValue(attribute);
+
+    return nullptr;
+}
+
+bool SnapshotIndex::NodeAccessor::IsDocumentElement(uint32_t element) const
+{
+    // Node 0 is the document
+    return _parents[element] == 0;
+}
+
+bool SnapshotIndex::NodeAccessor::GetParentElement(uint32_t element, uint32_t& parent) const
+{
+    parent = _parents[element];
+
+    return parent != 0;
+}
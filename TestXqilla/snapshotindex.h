@@ -0,0 +1,65 @@
+#pragma once
+
+#include "domsnapshot.h"
+#include "elementindex.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// DocumentIndex built on a DOM snapshot image (see domsnapshot.h) where it
+// lies, no DOM is created. The tables hold node indexes into the image, so a
+// worker attached to a SharedDocumentStore keeps the document itself in the
+// shared pages and only pays for the tables. Answers the same xpath shapes as
+// DocumentIndex, with the same semantics. The image must outlive the index.
+// Throws std::runtime_error when the links of the image are corrupt.
+class SnapshotIndex
+{
+public:
+    typedef ElementIndexBase::XMLChString XMLChString;
+    typedef ElementIndexBase::Statistics Statistics;
+
+    SnapshotIndex(const DOMSnapshotView& view, const std::vector<std::string>& indexedAttributes);
+
+    SnapshotIndex(const SnapshotIndex&) = delete;
+    SnapshotIndex& operator=(const SnapshotIndex&) = delete;
+
+    const DOMSnapshotView& GetView() const { return _view; }
+
+    // Returns false when xpath is outside the shapes the index can answer.
+    // Matches are element node indexes of the image, in document order.
+    bool TryEvaluate(const std::string& xpath, std::vector<uint32_t>& resultList) const;
+
+    Statistics GetStatistics() const;
+
+private:
+    // The ElementIndex view of an element of the image, refers to the members of the index
+    class NodeAccessor
+    {
+    public:
+        typedef uint32_t Node;
+
+        NodeAccessor(const DOMSnapshotView& view, const std::vector<uint32_t>& parents)
+            : _view(view), _parents(parents)
+        {
+        }
+
+        // Like DOMNode::getLocalName(), the qualified name when the node has no namespace
+        const XMLCh* GetLocalName(uint32_t node) const;
+        const XMLCh* GetNamespaceURI(uint32_t node) const;
+        const XMLCh* GetAttributeValue(uint32_t element, const XMLChString& namespaceURI, const XMLCh* localName) const;
+        bool IsDocumentElement(uint32_t element) const;
+        bool GetParentElement(uint32_t element, uint32_t& parent) const;
+
+    private:
+        const DOMSnapshotView& _view;
+        const std::vector<uint32_t>& _parents;
+    };
+
+    DOMSnapshotView _view;
+
+    // The image only links downwards
+    std::vector<uint32_t> _parents;
+
+    ElementIndex<NodeAccessor> _index;
+};
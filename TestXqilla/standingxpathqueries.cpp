@@ -0,0 +1,262 @@
+#include "standingxpathqueries.h"
+#include "partitionedxpath.h"
+#include "fasttranscode.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <stdexcept>
+
+StandingXPathQueries::StandingXPathQueries(DOMDocument* document, XPathExpressionCache& cache)
+    : _document(document), _cache(cache), _nextId(0)
+{
+    _statistics.fullEvaluations = 0;
+    _statistics.partitionEvaluations = 0;
+}
+
+StandingXPathQueries::QueryId StandingXPathQueries::Register(const std::string& xpath)
+{
+    std::unique_ptr<Query> query(new Query());
+    query->xpath = xpath;
+    query->partitioned = false;
+    query->fullDirty = true;
+    query->resultsDirty = true;
+
+    // Compile now so that a bad expression fails at registration
+    query->expression = _cache.Get(xpath, XPathExpressionCache::CollectNamespaceBindings(_document->getDocumentElement()));
+
+    QueryId id = _nextId++;
+    _queries.emplace(id, std::move(query));
+
+    return id;
+}
+
+void StandingXPathQueries::Unregister(QueryId id)
+{
+    _queries.erase(id);
+}
+
+void StandingXPathQueries::NodeChanged(const DOMNode* node)
+{
+    const DOMNode* partition = FindPartition(node);
+
+    if (partition == nullptr)
+        DocumentChanged();
+    else
+        MarkPartitionDirty(partition);
+}
+
+void StandingXPathQueries::ChildInserted(const DOMNode* child)
+{
+    // A new child of the root is a new partition, FindPartition returns the child itself
+    NodeChanged(child);
+}
+
+void StandingXPathQueries::ChildRemoving(const DOMNode* child)
+{
+    const DOMNode* partition = FindPartition(child);
+
+    if (partition == nullptr)
+    {
+        DocumentChanged();
+        return;
+    }
+
+    if (partition != child)
+    {
+        MarkPartitionDirty(partition);
+        return;
+    }
+
+    // The whole partition goes, its node may be released and its address reused
+    for (auto it = _queries.begin(); it != _queries.end(); it++)
+    {
+        Query& query = *it->second;
+
+        query.partitionResults.erase(child);
+        query.dirtyPartitions.erase(child);
+        query.resultsDirty = true;
+
+        if (!query.partitioned)
+            query.fullDirty = true;
+    }
+}
+
+void StandingXPathQueries::DocumentChanged()
+{
+    for (auto it = _queries.begin(); it != _queries.end(); it++)
+    {
+        Query& query = *it->second;
+
+        query.fullDirty = true;
+        query.resultsDirty = true;
+        query.partitionResults.clear();
+        query.dirtyPartitions.clear();
+    }
+}
+
+const std::vector<DOMElement*>& StandingXPathQueries::GetResults(QueryId id)
+{
+    auto found = _queries.find(id);
+
+    if (found == _queries.end())
+        throw std::runtime_error("Unknown standing query");
+
+    Query& query = *found->second;
+
+    if (!query.resultsDirty)
+        return query.results;
+
+    if (query.fullDirty)
+        EvaluateFull(query);
+    else
+    {
+        for (auto it = query.dirtyPartitions.begin(); it != query.dirtyPartitions.end(); it++)
+            EvaluatePartition(query, *it);
+
+        query.dirtyPartitions.clear();
+
+        // Partitions in the order of the root children, so the results stay in document order
+        query.results.clear();
+
+        for (DOMNode* child = _document->getDocumentElement()->getFirstChild(); child != nullptr; child = child->getNextSibling())
+        {
+            auto partition = query.partitionResults.find(child);
+
+            if (partition != query.partitionResults.end())
+                query.results.insert(query.results.end(), partition->second.begin(), partition->second.end());
+        }
+    }
+
+    query.resultsDirty = false;
+
+    return query.results;
+}
+
+StandingXPathQueries::Statistics StandingXPathQueries::GetStatistics() const
+{
+    return _statistics;
+}
+
+const DOMNode* StandingXPathQueries::FindPartition(const DOMNode* node) const
+{
+    const DOMElement* root = _document->getDocumentElement();
+
+    if (root == nullptr || node == nullptr)
+        return nullptr;
+
+    // Attributes are not children, they belong to the partition of their element
+    if (node->getNodeType() == DOMNode::ATTRIBUTE_NODE)
+        node = static_cast<const DOMAttr*>(node)->getOwnerElement();
+
+    while (node != nullptr && node->getParentNode() != root)
+        node = node->getParentNode();
+
+    return node;
+}
+
+void StandingXPathQueries::MarkPartitionDirty(const DOMNode* partition)
+{
+    for (auto it = _queries.begin(); it != _queries.end(); it++)
+    {
+        Query& query = *it->second;
+
+        query.resultsDirty = true;
+
+        if (query.partitioned)
+            query.dirtyPartitions.insert(partition);
+        else
+            query.fullDirty = true;
+    }
+}
+
+void StandingXPathQueries::EvaluateFull(Query& query)
+{
+    DOMElement* root = _document->getDocumentElement();
+
+    query.fullDirty = false;
+    query.partitionResults.clear();
+    query.dirtyPartitions.clear();
+    query.results.clear();
+
+    if (root == nullptr)
+    {
+        query.partitioned = false;
+        return;
+    }
+
+    // The root may have been replaced since the last evaluation
+    auto bindings = XPathExpressionCache::CollectNamespaceBindings(root);
+
+    query.expression = _cache.Get(query.xpath, bindings);
+    query.partitioned = ::IsPartitionSafeXPath(query.xpath, root);
+
+    if (query.partitioned)
+        query.partitionExpression = _cache.Get(::MakeSubtreeXPath(query.xpath), bindings);
+
+    Evaluate(*query.expression, root, query.results);
+    _statistics.fullEvaluations++;
+
+    if (!query.partitioned)
+        return;
+
+    for (auto it = query.results.begin(); it != query.results.end(); it++)
+        query.partitionResults[FindPartition(*it)].push_back(*it);
+}
+
+void StandingXPathQueries::EvaluatePartition(Query& query, const DOMNode* partition)
+{
+    // Moved elsewhere after it was marked, the notification for the move covers it
+    if (partition->getParentNode() != _document->getDocumentElement())
+    {
+        query.partitionResults.erase(partition);
+        return;
+    }
+
+    // Evaluated in place, the document is only read
+    Evaluate(*query.partitionExpression, partition, query.partitionResults[partition]);
+
+    _statistics.partitionEvaluations++;
+}
+
+void StandingXPathQueries::Evaluate(const DOMXPathExpression& expression, const DOMNode* contextNode, Elements& elements)
+{
+    elements.clear();
+
+    try
+    {
+        AutoRelease<DOMXPathResult> result(
+            expression.evaluate(
+                contextNode,
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr
+            )
+        );
+
+        size_t nLength = result->getSnapshotLength();
+        elements.reserve(nLength);
+
+        for (size_t i = 0; i < nLength; i++)
+        {
+            result->snapshotItem(i);
+
+            auto tempNode = result->getNodeValue();
+
+            if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+                throw std::runtime_error("Result contain non-element node");
+
+            elements.push_back(static_cast<DOMElement*>(tempNode));
+        }
+    }
+    catch (const XQillaException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "xpathexpressioncache.h"
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Fixed set of XPath rules re-checked after small edits of one document.
+//
+// Results of partition safe queries (see partitionedxpath.h) are kept per
+// child of the root element, so an edit only re-evaluates the partition it
+// touched, in place with MakeSubtreeXPath: GetResults() never modifies the
+// tree. Other queries are evaluated again in full after any edit.
+//
+// Xerces-C does not implement DOM mutation events, code that edits the
+// document reports the change through the notification methods. Results are
+// brought up to date lazily by GetResults().
+class StandingXPathQueries
+{
+public:
+    typedef size_t QueryId;
+
+    struct Statistics
+    {
+        size_t fullEvaluations;
+        size_t partitionEvaluations;
+    };
+
+    StandingXPathQueries(DOMDocument* document, XPathExpressionCache& cache);
+
+    DOMDocument* GetDocument() const { return _document; }
+
+    QueryId Register(const std::string& xpath);
+    void Unregister(QueryId id);
+
+    // The content, attributes or children of node changed, node is in the document.
+    void NodeChanged(const DOMNode* node);
+    // child was inserted into the document.
+    void ChildInserted(const DOMNode* child);
+    // child is about to be removed, call before removeChild so its partition is known.
+    void ChildRemoving(const DOMNode* child);
+    // The document element itself was replaced, detached or moved.
+    void DocumentChanged();
+
+    // Matches in document order, valid until the next notification.
+    const std::vector<DOMElement*>& GetResults(QueryId id);
+
+    Statistics GetStatistics() const;
+
+private:
+    typedef std::vector<DOMElement*> Elements;
+
+    struct Query
+    {
+        std::string xpath;
+        bool partitioned;
+        std::shared_ptr<const DOMXPathExpression> expression;
+        std::shared_ptr<const DOMXPathExpression> partitionExpression;
+
+        bool fullDirty;
+        bool resultsDirty;
+        std::unordered_map<const DOMNode*, Elements> partitionResults;
+        std::unordered_set<const DOMNode*> dirtyPartitions;
+        Elements results;
+    };
+
+    // Child of the root element that contains node, nullptr for the root and above
+    const DOMNode* FindPartition(const DOMNode* node) const;
+
+    void MarkPartitionDirty(const DOMNode* partition);
+    void EvaluateFull(Query& query);
+    void EvaluatePartition(Query& query, const DOMNode* partition);
+    void Evaluate(const DOMXPathExpression& expression, const DOMNode* contextNode, Elements& elements);
+
+    DOMDocument* _document;
+    XPathExpressionCache& _cache;
+
+    QueryId _nextId;
+    std::unordered_map<QueryId, std::unique_ptr<Query>> _queries;
+
+    Statistics _statistics;
+};
@@ -0,0 +1,556 @@
+#include "streamingxpath.h"
+#include "fasttranscode.h"
+
+#include <xercesc/sax2/SAX2XMLReader.hpp>
+#include <xercesc/sax2/XMLReaderFactory.hpp>
+#include <xercesc/sax2/DefaultHandler.hpp>
+#include <xercesc/sax2/Attributes.hpp>
+#include <xercesc/sax/SAXParseException.hpp>
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLUni.hpp>
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+    // The scratch document only grows, so it is replaced once it has held this many nodes
+    const size_t CAPTURE_DOCUMENT_NODE_LIMIT(4096);
+
+    const XMLCh EMPTY_STRING[] = { 0 };
+
+    class XPathLexer
+    {
+    public:
+        explicit XPathLexer(const std::string& text) : _text(text), _pos(0) {}
+
+        void SkipSpaces()
+        {
+            while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos])))
+                _pos++;
+        }
+
+        bool AtEnd() const { return _pos >= _text.size(); }
+        char Peek() const { return AtEnd() ? '\0' : _text[_pos]; }
+
+        bool Accept(char c)
+        {
+            if (Peek() != c)
+                return false;
+
+            _pos++;
+            return true;
+        }
+
+        // QName of letters, digits, '_', '-', '.' and non-ASCII bytes, with at most one ':'
+        bool ReadQName(std::string& prefix, std::string& localName)
+        {
+            std::string name;
+
+            while (!AtEnd())
+            {
+                unsigned char c = static_cast<unsigned char>(Peek());
+
+                if (std::isalnum(c) || c == '_' || c == '-' || c == '.' || c == ':' || c >= 0x80)
+                    name.push_back(_text[_pos++]);
+                else
+                    break;
+            }
+
+            if (name.empty() || name[0] == '.' || name[0] == '-' || std::isdigit(static_cast<unsigned char>(name[0])))
+                return false;
+
+            size_t colon = name.find(':');
+
+            if (colon == std::string::npos)
+            {
+                prefix.clear();
+                localName = name;
+                return true;
+            }
+
+            if (colon == 0 || colon + 1 == name.size() || name.find(':', colon + 1) != std::string::npos)
+                return false;
+
+            prefix = name.substr(0, colon);
+            localName = name.substr(colon + 1);
+            return true;
+        }
+
+        bool ReadInteger(size_t& value)
+        {
+            if (!std::isdigit(static_cast<unsigned char>(Peek())))
+                return false;
+
+            value = 0;
+            while (std::isdigit(static_cast<unsigned char>(Peek())))
+                value = value * 10 + static_cast<size_t>(_text[_pos++] - '0');
+
+            return true;
+        }
+
+        bool ReadLiteral(std::string& value)
+        {
+            char quote = Peek();
+
+            if (quote != '\'' && quote != '"')
+                return false;
+
+            size_t end = _text.find(quote, _pos + 1);
+
+            if (end == std::string::npos)
+                return false;
+
+            value = _text.substr(_pos + 1, end - _pos - 1);
+            _pos = end + 1;
+            return true;
+        }
+
+    private:
+        const std::string& _text;
+        size_t _pos;
+    };
+
+    bool ReadPredicate(XPathLexer& lexer, StreamingXPath::Predicate& predicate)
+    {
+        lexer.SkipSpaces();
+
+        if (lexer.ReadInteger(predicate.position))
+        {
+            predicate.kind = StreamingXPath::Predicate::POSITION;
+
+            lexer.SkipSpaces();
+            return predicate.position > 0 && lexer.Accept(']');
+        }
+
+        if (!lexer.Accept('@'))
+            return false;
+
+        std::string localName;
+        if (!lexer.ReadQName(predicate.attributePrefix, localName))
+            return false;
+
+        predicate.attributeLocalName = X(localName.c_str());
+
+        lexer.SkipSpaces();
+
+        if (lexer.Accept(']'))
+        {
+            predicate.kind = StreamingXPath::Predicate::ATTRIBUTE_EXISTS;
+            return true;
+        }
+
+        if (!lexer.Accept('='))
+            return false;
+
+        lexer.SkipSpaces();
+
+        std::string value;
+        if (!lexer.ReadLiteral(value))
+            return false;
+
+        predicate.kind = StreamingXPath::Predicate::ATTRIBUTE_EQUALS;
+        predicate.attributeValue = X(value.c_str());
+
+        lexer.SkipSpaces();
+        return lexer.Accept(']');
+    }
+
+    class StreamingXPathHandler : public DefaultHandler
+    {
+    public:
+        StreamingXPathHandler(const StreamingXPath& xpath, DOMImplementation* impl, const StreamingMatchHandler& handler)
+            : _steps(xpath.GetSteps()),
+              _impl(impl),
+              _handler(handler),
+              _resolved(false),
+              _depth(0),
+              _captureDepth(0),
+              _captureDocument(nullptr),
+              _captureFragment(nullptr),
+              _capturedNodeCount(0),
+              _matchCount(0)
+        {
+            // Frame 0 is the document node, its children are tested against the first step
+            _frames.resize(1);
+            AddState(_frames[0], 0);
+        }
+
+        ~StreamingXPathHandler()
+        {
+            if (_captureDocument != nullptr)
+                _captureDocument->release();
+        }
+
+        size_t GetMatchCount() const { return _matchCount; }
+
+        void startPrefixMapping(const XMLCh* const prefix, const XMLCh* const uri) override
+        {
+            // Name tests are resolved against the root element bindings, as in GetElementByXpath
+            if (_depth == 0)
+                _prefixes[::ToUTF8(prefix)] = uri;
+        }
+
+        void startElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname, const Attributes& attrs) override
+        {
+            if (!_resolved)
+                ResolvePrefixes();
+
+            // Grow the stack before taking references into it, frames are reused between siblings
+            if (_frames.size() <= _depth + 1)
+                _frames.resize(_depth + 2);
+
+            Frame& parent = _frames[_depth];
+
+            _depth++;
+
+            Frame& frame = _frames[_depth];
+            frame.states.clear();
+            frame.counterOffsets.clear();
+            frame.counters.clear();
+
+            bool matched = false;
+
+            for (size_t k = 0; k < parent.states.size(); k++)
+            {
+                size_t stepIndex = parent.states[k];
+                const StreamingXPath::Step& step = _steps[stepIndex];
+
+                if (step.descendant)
+                    AddState(frame, stepIndex);
+
+                if (!MatchStep(stepIndex, uri, localname, attrs, parent.counters.data() + parent.counterOffsets[k]))
+                    continue;
+
+                if (stepIndex + 1 == _steps.size())
+                    matched = true;
+                else
+                    AddState(frame, stepIndex + 1);
+            }
+
+            if (matched && _captureDepth == 0)
+                StartCapture();
+
+            if (_captureDepth != 0)
+            {
+                DOMElement* element = _captureDocument->createElementNS(uri, qname);
+
+                for (XMLSize_t i = 0; i < attrs.getLength(); i++)
+                    element->setAttributeNS(attrs.getURI(i), attrs.getQName(i), attrs.getValue(i));
+
+                _captureStack.back()->appendChild(element);
+                _captureStack.push_back(element);
+                _capturedNodeCount++;
+
+                if (matched)
+                    _pendingMatches.push_back(element);
+            }
+        }
+
+        void endElement(const XMLCh* const, const XMLCh* const, const XMLCh* const) override
+        {
+            if (_captureDepth != 0)
+            {
+                _captureStack.pop_back();
+
+                if (_depth == _captureDepth)
+                    FinishCapture();
+            }
+
+            _depth--;
+        }
+
+        void characters(const XMLCh* const chars, const XMLSize_t length) override
+        {
+            if (_captureDepth == 0)
+                return;
+
+            _captureText.assign(chars, length);
+            _captureStack.back()->appendChild(_captureDocument->createTextNode(_captureText.c_str()));
+            _capturedNodeCount++;
+        }
+
+        void comment(const XMLCh* const chars, const XMLSize_t length) override
+        {
+            if (_captureDepth == 0)
+                return;
+
+            _captureText.assign(chars, length);
+            _captureStack.back()->appendChild(_captureDocument->createComment(_captureText.c_str()));
+            _capturedNodeCount++;
+        }
+
+        void processingInstruction(const XMLCh* const target, const XMLCh* const data) override
+        {
+            if (_captureDepth == 0)
+                return;
+
+            _captureStack.back()->appendChild(_captureDocument->createProcessingInstruction(target, data));
+            _capturedNodeCount++;
+        }
+
+        void fatalError(const SAXParseException& ex) override
+        {
+            std::string fatal(UTF8(ex.getMessage()));
+            fatal = "The Xml file format is not well formed or encoded incorrectly: " + fatal;
+
+            throw std::runtime_error(fatal);
+        }
+
+    private:
+        struct Frame
+        {
+            std::vector<size_t> states;
+            std::vector<size_t> counterOffsets;
+            // Positional counters of every predicate of every state, flattened
+            std::vector<size_t> counters;
+        };
+
+        void AddState(Frame& frame, size_t stepIndex)
+        {
+            if (std::find(frame.states.begin(), frame.states.end(), stepIndex) != frame.states.end())
+                return;
+
+            frame.states.push_back(stepIndex);
+            frame.counterOffsets.push_back(frame.counters.size());
+            frame.counters.resize(frame.counters.size() + _steps[stepIndex].predicates.size(), 0);
+        }
+
+        const XMLCh* ResolvePrefix(const std::string& prefix) const
+        {
+            if (prefix.empty())
+                return EMPTY_STRING;
+
+            if (prefix == "xml")
+                return XMLUni::fgXMLURIName;
+
+            auto found = _prefixes.find(prefix);
+
+            if (found == _prefixes.end())
+                throw std::runtime_error("Unresolved namespace prefix: " + prefix);
+
+            return found->second.c_str();
+        }
+
+        void ResolvePrefixes()
+        {
+            _stepUris.clear();
+            _predicateUris.clear();
+
+            for (auto step = _steps.begin(); step != _steps.end(); step++)
+            {
+                _stepUris.push_back(step->anyName ? EMPTY_STRING : ResolvePrefix(step->prefix));
+
+                std::vector<StreamingXPath::XMLChString> uris;
+                for (auto predicate = step->predicates.begin(); predicate != step->predicates.end(); predicate++)
+                {
+                    if (predicate->kind == StreamingXPath::Predicate::POSITION)
+                        uris.push_back(EMPTY_STRING);
+                    else
+                        uris.push_back(ResolvePrefix(predicate->attributePrefix));
+                }
+
+                _predicateUris.push_back(uris);
+            }
+
+            _resolved = true;
+        }
+
+        bool MatchStep(size_t stepIndex, const XMLCh* uri, const XMLCh* localname, const Attributes& attrs, size_t* counters) const
+        {
+            const StreamingXPath::Step& step = _steps[stepIndex];
+
+            if (!step.anyName)
+            {
+                if (!XMLString::equals(localname, step.localName.c_str()))
+                    return false;
+
+                if (!XMLString::equals(uri, _stepUris[stepIndex].c_str()))
+                    return false;
+            }
+
+            // Predicates filter in order, a position counts only the candidates that passed the previous ones
+            for (size_t j = 0; j < step.predicates.size(); j++)
+            {
+                const StreamingXPath::Predicate& predicate = step.predicates[j];
+
+                switch (predicate.kind)
+                {
+                    case StreamingXPath::Predicate::POSITION:
+                    {
+                        if (++counters[j] != predicate.position)
+                            return false;
+                        break;
+                    }
+                    case StreamingXPath::Predicate::ATTRIBUTE_EXISTS:
+                    case StreamingXPath::Predicate::ATTRIBUTE_EQUALS:
+                    {
+                        const XMLCh* value = attrs.getValue(_predicateUris[stepIndex][j].c_str(), predicate.attributeLocalName.c_str());
+
+                        if (value == nullptr)
+                            return false;
+
+                        if (predicate.kind == StreamingXPath::Predicate::ATTRIBUTE_EQUALS &&
+                            !XMLString::equals(value, predicate.attributeValue.c_str()))
+                            return false;
+                        break;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        void StartCapture()
+        {
+            if (_captureDocument != nullptr && _capturedNodeCount >= CAPTURE_DOCUMENT_NODE_LIMIT)
+            {
+                _captureDocument->release();
+                _captureDocument = nullptr;
+            }
+
+            if (_captureDocument == nullptr)
+            {
+                _captureDocument = _impl->createDocument();
+                _capturedNodeCount = 0;
+            }
+
+            _captureFragment = _captureDocument->createDocumentFragment();
+            _captureStack.assign(1, _captureFragment);
+            _captureDepth = _depth;
+        }
+
+        void FinishCapture()
+        {
+            // Nested matches were recorded in start order, the outermost one first
+            for (auto it = _pendingMatches.begin(); it != _pendingMatches.end(); it++)
+            {
+                _matchCount++;
+                _handler(*it);
+            }
+
+            _pendingMatches.clear();
+            _captureStack.clear();
+            _captureDepth = 0;
+
+            _captureFragment->removeChild(_captureFragment->getFirstChild());
+            _captureFragment = nullptr;
+        }
+
+        const std::vector<StreamingXPath::Step>& _steps;
+        DOMImplementation* _impl;
+        const StreamingMatchHandler& _handler;
+
+        std::map<std::string, StreamingXPath::XMLChString> _prefixes;
+        bool _resolved;
+        std::vector<StreamingXPath::XMLChString> _stepUris;
+        std::vector<std::vector<StreamingXPath::XMLChString>> _predicateUris;
+
+        std::vector<Frame> _frames;
+        size_t _depth;
+
+        size_t _captureDepth;
+        DOMDocument* _captureDocument;
+        DOMDocumentFragment* _captureFragment;
+        std::vector<DOMNode*> _captureStack;
+        std::vector<DOMElement*> _pendingMatches;
+        StreamingXPath::XMLChString _captureText;
+        size_t _capturedNodeCount;
+
+        size_t _matchCount;
+    };
+}
+
+bool StreamingXPath::Compile(const std::string& xpath, StreamingXPath& compiled)
+{
+    XPathLexer lexer(xpath);
+    std::vector<Step> steps;
+
+    lexer.SkipSpaces();
+
+    if (lexer.AtEnd())
+        return false;
+
+    bool first = true;
+
+    if (lexer.Peek() != '/')
+    {
+        // Relative path: the context node is the root element
+        Step root;
+        root.descendant = false;
+        root.anyName = true;
+        steps.push_back(root);
+    }
+
+    while (!lexer.AtEnd())
+    {
+        Step step;
+        step.descendant = false;
+        step.anyName = false;
+
+        if (!first || lexer.Peek() == '/')
+        {
+            if (!lexer.Accept('/'))
+                return false;
+
+            step.descendant = lexer.Accept('/');
+        }
+
+        first = false;
+        lexer.SkipSpaces();
+
+        if (lexer.Accept('*'))
+        {
+            step.anyName = true;
+        }
+        else
+        {
+            std::string localName;
+
+            if (!lexer.ReadQName(step.prefix, localName))
+                return false;
+
+            step.localName = X(localName.c_str());
+        }
+
+        lexer.SkipSpaces();
+
+        while (lexer.Accept('['))
+        {
+            Predicate predicate;
+
+            if (!ReadPredicate(lexer, predicate))
+                return false;
+
+            step.predicates.push_back(predicate);
+            lexer.SkipSpaces();
+        }
+
+        steps.push_back(step);
+    }
+
+    compiled._steps.swap(steps);
+
+    return true;
+}
+
+size_t StreamXPath(const StreamingXPath& xpath, const InputSource& source, DOMImplementation* impl, const StreamingMatchHandler& handler)
+{
+    StreamingXPathHandler saxHandler(xpath, impl, handler);
+
+    std::unique_ptr<SAX2XMLReader> reader(XMLReaderFactory::createXMLReader());
+    reader->setFeature(XMLUni::fgSAX2CoreNameSpaces, true);
+    reader->setFeature(XMLUni::fgSAX2CoreValidation, false);
+    reader->setContentHandler(&saxHandler);
+    reader->setErrorHandler(&saxHandler);
+    reader->setLexicalHandler(&saxHandler);
+
+    reader->parse(source);
+
+    return saxHandler.GetMatchCount();
+}
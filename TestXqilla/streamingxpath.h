@@ -0,0 +1,63 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/sax/InputSource.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Forward-only XPath subset that can be evaluated on SAX2 events:
+//   ('/' | '//')? step (('/' | '//') step)*
+//   step      := ('*' | QName) predicate*
+//   predicate := '[' integer ']' | '[@' QName ']' | '[@' QName '=' literal ']'
+// A relative path is evaluated with the root element as context node, like GetElementByXpath.
+class StreamingXPath
+{
+public:
+    typedef std::basic_string<XMLCh> XMLChString;
+
+    struct Predicate
+    {
+        enum Kind
+        {
+            POSITION,
+            ATTRIBUTE_EXISTS,
+            ATTRIBUTE_EQUALS
+        };
+
+        Kind kind;
+        size_t position;
+        std::string attributePrefix;
+        XMLChString attributeLocalName;
+        XMLChString attributeValue;
+    };
+
+    struct Step
+    {
+        bool descendant;
+        bool anyName;
+        std::string prefix;
+        XMLChString localName;
+        std::vector<Predicate> predicates;
+    };
+
+    // Returns false when xpath is outside the streamable subset.
+    static bool Compile(const std::string& xpath, StreamingXPath& compiled);
+
+    const std::vector<Step>& GetSteps() const { return _steps; }
+
+private:
+    std::vector<Step> _steps;
+};
+
+// Called once per match, in document order. The element lives in a scratch
+// document that is recycled after the call, import or serialize it to keep it.
+typedef std::function<void(DOMElement*)> StreamingMatchHandler;
+
+// Runs the SAX2 scanner over source and hands every matching subtree to handler.
+// Only the open-element stack and the subtree being captured are kept in memory.
+// Returns the number of matches.
+size_t StreamXPath(const StreamingXPath& xpath, const InputSource& source, DOMImplementation* impl, const StreamingMatchHandler& handler);
@@ -1,4 +1,25 @@
 #include "testxqilla.h"
+#include "xpathexpressioncache.h"
+#include "xpathbatch.h"
+#include "xpathpipeline.h"
+#include "streamingxpath.h"
+#include "phasetimer.h"
+#include "xpathcursor.h"
+#include "partitionedxpath.h"
+#include "documentindex.h"
+#include "snapshotindex.h"
+#include "compressedinputsource.h"
+#include "grammarpool.h"
+#include "domlsparserpool.h"
+#include "arenamemorymanager.h"
+#include "parallelrecordparser.h"
+#include "domsnapshot.h"
+#include "shareddocumentstore.h"
+#include "standingxpathqueries.h"
+#include "resultprojection.h"
+#include "streamingserializer.h"
+#include "fasttranscode.h"
+#include "commandline.h"
 
 #include <xercesc/dom/DOM.hpp>
 
@@ -18,10 +39,17 @@ XERCES_CPP_NAMESPACE_USE
 #include <xqilla/xqilla-dom3.hpp>
 
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <sstream>
 #include <stdexcept>
-#include <list>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <chrono>
 
@@ -29,7 +57,7 @@ XERCES_CPP_NAMESPACE_USE
 
 long long GetTimestamp()
 {
-    auto duration = std::chrono::system_clock::now().time_since_epoch();
+    auto duration = std::chrono::steady_clock::now().time_since_epoch();
     long long millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
     return millis;
 }
@@ -52,9 +80,7 @@ public:
         else
             std::cerr << "\nFatal Message: ";
 
-        char* msg = XMLString::transcode(domError.getMessage());
-        std::cerr << msg << std::endl;
-        XMLString::release(&msg);
+        std::cerr << ::ScratchUTF8(domError.getMessage()) << std::endl;
 
         // Instructs the serializer to continue serialization if possible.
         return true;
@@ -63,26 +89,57 @@ public:
     void resetErrors() {};
 };
 
-DOMDocument* ParseFile(const std::string& file);
-void PrintDOMElements(const std::list<DOMElement*>& elementsList);
+DOMDocument* ParseFile(const std::string& file, MemoryManager* const manager = XMLPlatformUtils::fgMemoryManager);
+// Contiguous result storage, clear() keeps the capacity so one instance can serve many queries
+typedef std::vector<DOMElement*> XPathElements;
+
+void PrintDOMElements(const XPathElements& elementsList);
 
 void PrintDOMNode(DOMNode* domNode);
 
 DOMDocument* XQillaParseFile(const std::string& file);
+DOMDocument* ParallelParseFile(const std::string& file, unsigned threadCount = 0, bool stitchWithContext = false);
+// Parses file, or loads it when it is a DOM snapshot (.xsnap)
+DOMDocument* LoadFile(const std::string& file);
 
 DOMImplementation* GetDOMImplementation();
 
 void PrintNodeType(const DOMNode::NodeType& nodeType);
 
-int mainXpathTest(const int argc, const char* argv[]);
+size_t CountNodes(const DOMNode* node);
 
-std::list<DOMElement*> GetElementByXpath(DOMDocument* document, const std::string& xpath);
+int mainXpathTest(const int argc, const char* argv[]);
+int mainXpathBatch(const int argc, const char* argv[]);
+int mainXpathPipeline(const int argc, const char* argv[]);
+int mainXpathStream(const int argc, const char* argv[]);
+int mainXpathProfile(const int argc, const char* argv[]);
+int mainXpathSnapshot(const int argc, const char* argv[]);
+int mainXpathShared(const int argc, const char* argv[]);
+int mainXpathStanding(const int argc, const char* argv[]);
+int mainXpathProject(const int argc, const char* argv[]);
+int mainXpathVerifyPartitioned(const int argc, const char* argv[]);
+int mainXpathVerifyCursor(const int argc, const char* argv[]);
+
+void GetElementByXpath(DOMDocument* document, const std::string& xpath, XPathElements& resultList);
+void GetElementByXpathInParallel(DOMDocument* document, const std::string& xpath, XPathElements& resultList, unsigned threadCount = 0);
 
 DOMElement* DetachRootElement(DOMDocument* document);
 DOMDocumentFragment* DetachRootAndAddToDocumentFragment(DOMDocument* document);
 
-std::list<DOMElement*> GetElementByXpathFromDetachedElement(DOMDocument* document, DOMElement* element, const std::string& xpath);
-std::list<DOMElement*> GetElementByXpathFromDocumentFragment(DOMDocument* document, DOMDocumentFragment* docFragment, const std::string& xpath);
+void GetElementByXpathFromDetachedElement(DOMDocument* document, DOMElement* element, const std::string& xpath, XPathElements& resultList);
+void GetElementByXpathFromDocumentFragment(DOMDocument* document, DOMDocumentFragment* docFragment, const std::string& xpath, XPathElements& resultList);
+
+void CollectSnapshotElements(DOMXPathResult* result, XPathElements& resultList);
+
+// Answers xpath from documentIndex when the index was built for document and covers the expression
+bool GetElementByIndex(DOMDocument* document, const std::string& xpath, XPathElements& resultList);
+
+// Lazy lookups, evaluation stops as soon as the requested nodes are found
+DOMElement* GetFirstElementByXpath(DOMDocument* document, const std::string& xpath);
+bool ExistsByXpath(DOMDocument* document, const std::string& xpath);
+void GetElementByXpathRange(DOMDocument* document, const std::string& xpath, size_t offset, size_t limit, XPathElements& resultList);
+
+size_t StreamElementsByXpath(const std::string& file, const std::string& xpath, const std::function<void(DOMElement*)>& handler);
 
 
 void Initialize();
@@ -100,14 +157,69 @@ const XMLCh* DEFAULT_FEATURES = u"";
 const XMLCh* XPATH_FEATURES = u"XPath2";
 
 const bool PRINT_RESULT = false;
+const bool PRETTY_PRINT_RESULT = true;
+
+// Allocate the test document from an arena that is freed in one step after release()
+const bool USE_DOCUMENT_ARENA = false;
+
+// Split the test document at its top-level records and parse the pieces on every core
+const bool PARSE_IN_PARALLEL = false;
+
+// Build a name and attribute value index after parsing, simple paths are answered from it
+const bool USE_DOCUMENT_INDEX = false;
+const std::vector<std::string> INDEXED_ATTRIBUTES = { "id" };
 
 const short XPATH_CASE_1(1);
 const short XPATH_CASE_2(2);
 const short XPATH_CASE_3(3);
 const short XPATH_CASE_4(4);
+const short XPATH_CASE_5(5);
 
 const short TEST_XPATH_CASE = XPATH_CASE_1;
 
+const size_t XPATH_EXPRESSION_CACHE_CAPACITY(64);
+
+// Limits of the counts taken from the command line
+const long long MAX_THREAD_COUNT(1024);
+const long long MAX_QUEUE_CAPACITY(1024);
+const long long MAX_ITERATIONS(1000000);
+const long long MAX_TIMEOUT_MS(24LL * 60 * 60 * 1000);
+
+// Validate ParseFile, XQillaParseFile, ParallelParseFile, --batch and --pipeline
+// against grammars compiled once in Initialize()
+const bool VALIDATE_WITH_GRAMMAR_POOL = false;
+const std::vector<std::string> PRELOADED_GRAMMARS = { RESOURCES_DIR "sample.xsd" };
+
+// Shapes checked by --verify-partitioned when no xpath is given, the partition safe
+// ones must find what the serial evaluation finds, the others must be rejected.
+// The root gets an xml:lang for them, which lang() only finds on the ancestors.
+const std::vector<std::string> PARTITION_CHECK_XPATHS = {
+    "//book", "//book/title", "//book[@id]", "//book[price > 30]", "//book[title/@lang = 'en' and price]",
+    "//book[contains(title, 'XML')]", "//book[count(title) > 0]", "//book[not(@id)]//price",
+    "//book[@id = /bookstore/book/@id]", "//book[price and //onePerson]", "//book[count(title)]",
+    "//book[number(@id)]", "//book[1]", "//book[last()]", "//*[title]", "//book | //onePerson",
+    "//book[lang('en')]", "//book[lang ('en') and price]"
+};
+
+// Shapes checked by --verify-cursor when no xpath is given, both with and without
+// the document index: the first ones are answered from it, the others are not
+const std::vector<std::string> CURSOR_CHECK_XPATHS = {
+    "//book", "//book/title", "//book[@id = '1']", "//title[@lang]", "//nothing",
+    "//book[price > 30]", "/bookstore/book/price", "//book[title = 'Learning XML']"
+};
+
+const int STDOUT_DESCRIPTOR(1);
+
+std::unique_ptr<XPathExpressionCache> xpathExpressionCache;
+std::unique_ptr<SharedGrammarPool> sharedGrammarPool;
+std::unique_ptr<DOMLSParserPool> domLSParserPool;
+std::unique_ptr<DocumentIndex> documentIndex;
+
+// Serializer and stdout target shared by the print helpers
+DOMPrintErrorHandler consoleErrorHandler;
+std::unique_ptr<StdOutFormatTarget> consoleFormatTarget;
+std::unique_ptr<StreamingSerializer> consoleSerializer;
+
 DOMImplementation* GetDOMImplementation()
 {
     switch (CURRENT_IMPL_NAME)
@@ -138,8 +250,40 @@ int main(const int argc, const char* argv[])
               << UTF8(eXerces.getMessage()) << std::endl;
         return 1;
     }
+    catch (const std::exception& e)
+    {
+        // Preloaded grammars that do not compile
+        std::cerr << "Error during initialisation: " << e.what() << std::endl;
+        ::Terminate();
+        return 1;
+    }
 
-    int result = ::mainXpathTest(argc, argv);
+    std::string mode(argc > 1 ? argv[1] : "");
+
+    int result;
+
+    if (mode == "--batch")
+        result = ::mainXpathBatch(argc, argv);
+    else if (mode == "--pipeline")
+        result = ::mainXpathPipeline(argc, argv);
+    else if (mode == "--stream")
+        result = ::mainXpathStream(argc, argv);
+    else if (mode == "--profile")
+        result = ::mainXpathProfile(argc, argv);
+    else if (mode == "--snapshot")
+        result = ::mainXpathSnapshot(argc, argv);
+    else if (mode == "--shared")
+        result = ::mainXpathShared(argc, argv);
+    else if (mode == "--standing")
+        result = ::mainXpathStanding(argc, argv);
+    else if (mode == "--project")
+        result = ::mainXpathProject(argc, argv);
+    else if (mode == "--verify-partitioned")
+        result = ::mainXpathVerifyPartitioned(argc, argv);
+    else if (mode == "--verify-cursor")
+        result = ::mainXpathVerifyCursor(argc, argv);
+    else
+        result = ::mainXpathTest(argc, argv);
 
     ::Terminate();
 
@@ -163,10 +307,45 @@ void Initialize()
             break;
         }
     }
+
+    xpathExpressionCache.reset(new XPathExpressionCache(::GetDOMImplementation(), XPATH_EXPRESSION_CACHE_CAPACITY));
+
+    if (VALIDATE_WITH_GRAMMAR_POOL)
+    {
+        sharedGrammarPool.reset(new SharedGrammarPool());
+        sharedGrammarPool->Load(PRELOADED_GRAMMARS);
+        sharedGrammarPool->Lock();
+
+        std::cout << "Grammar pool: " << sharedGrammarPool->GetGrammarCount() << " grammars" << std::endl;
+    }
+
+    domLSParserPool.reset(new DOMLSParserPool(::GetDOMImplementation(), 8, sharedGrammarPool.get()));
+
+    consoleFormatTarget.reset(new StdOutFormatTarget());
+    consoleSerializer.reset(new StreamingSerializer(::GetDOMImplementation(), PRETTY_PRINT_RESULT, &consoleErrorHandler));
+    consoleSerializer->SetTarget(consoleFormatTarget.get());
 }
 
 void Terminate()
 {
+    // Compiled expressions must be released before the platform is terminated
+    if (xpathExpressionCache)
+    {
+        auto statistics = xpathExpressionCache->GetStatistics();
+        std::cout << "XPath cache: " << statistics.hits << " hits, "
+            << statistics.misses << " misses, "
+            << statistics.evictions << " evictions" << std::endl;
+
+        xpathExpressionCache.reset();
+    }
+
+    // Pooled parsers hold on to the grammar pool
+    domLSParserPool.reset();
+    sharedGrammarPool.reset();
+
+    consoleSerializer.reset();
+    consoleFormatTarget.reset();
+
     switch (CURRENT_IMPL_NAME)
     {
         case DOMImplName::XERCESC:
@@ -204,40 +383,58 @@ int mainXpathTest(const int argc, const char* argv[])
 
     std::cout << "\nXPath: " << xpathExpression << std::endl;
 
-    DOMDocument* xercesDoc;
+    DOMDocument* xercesDoc = nullptr;
+    ArenaMemoryManager documentArena;
 
     try
     {
-        std::list<DOMElement*> xercesElementsList;
+        XPathElements xercesElementsList;
 
         long long startTime(GetTimestamp());
 
-        xercesDoc = ::ParseFile(xmlFile);
+        if (PARSE_IN_PARALLEL)
+            xercesDoc = ::ParallelParseFile(xmlFile);
+        else
+            xercesDoc = ::ParseFile(xmlFile, USE_DOCUMENT_ARENA ? &documentArena : XMLPlatformUtils::fgMemoryManager);
         //xercesDoc = ::XQillaParseFile(xmlFile);
 
         std::cout << "Finish parsing" << std::endl;
 
+        if (USE_DOCUMENT_INDEX)
+        {
+            long long beforeIndexing(GetTimestamp());
+            documentIndex.reset(new DocumentIndex(xercesDoc, INDEXED_ATTRIBUTES));
+
+            auto statistics = documentIndex->GetStatistics();
+            std::cout << "Document index: " << statistics.elements << " elements, "
+                << statistics.names << " names, "
+                << statistics.attributeValues << " attribute values, in "
+                << (GetTimestamp() - beforeIndexing) << std::endl;
+        }
+
         long long afterParsingAFile(GetTimestamp());
 
         if (TEST_XPATH_CASE == XPATH_CASE_1)
-            xercesElementsList = ::GetElementByXpath(xercesDoc, xpathExpression);
+            ::GetElementByXpath(xercesDoc, xpathExpression, xercesElementsList);
         else if (TEST_XPATH_CASE == XPATH_CASE_2)
         {
             DOMElement* root = ::DetachRootElement(xercesDoc);
-            xercesElementsList = ::GetElementByXpathFromDetachedElement(xercesDoc, root, xpathExpression);
+            ::GetElementByXpathFromDetachedElement(xercesDoc, root, xpathExpression, xercesElementsList);
         }
         else if (TEST_XPATH_CASE == XPATH_CASE_3)
         {
             DOMElement* root = ::DetachRootElement(xercesDoc);
             DOMDocumentFragment* docFragment = xercesDoc->createDocumentFragment();
             docFragment->appendChild(root);
-            xercesElementsList = ::GetElementByXpathFromDetachedElement(xercesDoc, root, xpathExpression);
+            ::GetElementByXpathFromDetachedElement(xercesDoc, root, xpathExpression, xercesElementsList);
         }
         else if (TEST_XPATH_CASE == XPATH_CASE_4)
         {
             DOMDocumentFragment* docFragment = ::DetachRootAndAddToDocumentFragment(xercesDoc);
-            xercesElementsList = ::GetElementByXpathFromDocumentFragment(xercesDoc, docFragment, xpathExpression);
+            ::GetElementByXpathFromDocumentFragment(xercesDoc, docFragment, xpathExpression, xercesElementsList);
         }
+        else if (TEST_XPATH_CASE == XPATH_CASE_5)
+            ::GetElementByXpathInParallel(xercesDoc, xpathExpression, xercesElementsList);
 
         long long afterAnXPathExpression(GetTimestamp());
 
@@ -272,6 +469,8 @@ int mainXpathTest(const int argc, const char* argv[])
         returnCode = 1;
     }
 
+    documentIndex.reset();
+
     if (xercesDoc == nullptr)
         std::cout << "Fail to load doc!" << std::endl;
     else
@@ -280,309 +479,1128 @@ int mainXpathTest(const int argc, const char* argv[])
         xercesDoc->release();
     }
 
+    if (USE_DOCUMENT_ARENA)
+    {
+        auto statistics = documentArena.GetStatistics();
+        std::cout << "Document arena: " << statistics.allocations << " allocations, "
+            << statistics.totalBytes << " total bytes, "
+            << statistics.chunkBytes << " chunk bytes, "
+            << statistics.peakChunkBytes << " peak chunk bytes" << std::endl;
+
+        long long beforeReset(GetTimestampNanos());
+        documentArena.Reset();
+        std::cout << "Arena reset time (ns): " << (GetTimestampNanos() - beforeReset) << std::endl;
+    }
+
     return returnCode;
 }
 
-DOMDocument* ParseFile(const std::string& file)
+int mainXpathBatch(const int argc, const char* argv[])
 {
-    XercesDOMParser parser;
-    parser.setValidationScheme(XercesDOMParser::Val_Auto);
-    parser.setDoNamespaces(true);
+    // TestXqilla --batch <directory|manifest> [--threads N] <xpath> [<xpath> ...]
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --batch <directory|manifest> [--threads N] <xpath> [<xpath> ...]" << std::endl;
+        return 1;
+    }
 
-    parser.useImplementation(XPATH_FEATURES);
+    XPathBatchOptions options;
+    options.threadCount = std::thread::hardware_concurrency();
+    options.implementationFeatures = XPATH_FEATURES;
+    options.grammarPool = sharedGrammarPool.get();
 
-    parser.parse(file.c_str());
+    try
+    {
+        for (int i = 3; i < argc; i++)
+        {
+            std::string argument(argv[i]);
 
-    return parser.adoptDocument();
-}
+            if (argument == "--threads" && i + 1 < argc)
+                options.threadCount = static_cast<unsigned>(::ParseCount(argv[++i], 1, MAX_THREAD_COUNT));
+            else
+                options.xpaths.push_back(argument);
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        std::cout << "Usage: " << argv[0] << " --batch <directory|manifest> [--threads N] <xpath> [<xpath> ...]" << std::endl;
+        return 1;
+    }
 
-DOMDocument* XQillaParseFile(const std::string& file)
-{
-    DOMImplementation* impl = ::GetDOMImplementation();
-    DOMLSParser* parser = impl->createLSParser(DOMImplementationLS::MODE_SYNCHRONOUS, 0);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMNamespaces, true);
-    parser->getDomConfig()->setParameter(XMLUni::fgDOMValidateIfSchema, false);
-    parser->getDomConfig()->setParameter(XMLUni::fgXercesUserAdoptsDOMDocument, true);
+    if (options.xpaths.empty())
+    {
+        std::cout << "Please pass in a XPath argument" << std::endl;
+        return 1;
+    }
 
-    DOMLSInput* input = impl->createLSInput();
+    try
+    {
+        options.files = ::ListXPathBatchInputs(argv[2]);
 
-    LocalFileInputSource fileInputSource(X(file.c_str()));
-    input->setByteStream(&fileInputSource);
+        long long startTime(GetTimestamp());
 
-    auto document = parser->parse(input);
+        size_t failedCount = ::RunXPathBatch(options, *xpathExpressionCache, std::cout);
 
-    input->release();
-    parser->release();
+        std::cerr << "Processed " << options.files.size() << " files, "
+            << failedCount << " failed, in " << (GetTimestamp() - startTime) << std::endl;
 
-    return document;
+        return failedCount == 0 ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
 
-void PrintDOMElements(const std::list<DOMElement*>& elementsList)
+int mainXpathPipeline(const int argc, const char* argv[])
 {
-    // DOMImpl
-    DOMImplementation* domImpl = ::GetDOMImplementation();
-    //-----------------------------------------------------
-
-    // DOMLSOutput-----------------------------------------
-    DOMLSOutput* theOutPut = domImpl->createLSOutput();
-    theOutPut->setEncoding(X("UTF-8"));
-    //-----------------------------------------------------
+    // TestXqilla --pipeline <directory|manifest> [--threads read,parse,evaluate,serialize] [--queue N]
+    //            [--timeout ms] [--print] <xpath> [<xpath> ...]
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --pipeline <directory|manifest> [--threads read,parse,evaluate,serialize] [--queue N]"
+            << " [--timeout ms] [--print] <xpath> [<xpath> ...]" << std::endl;
+        return 1;
+    }
 
-    // DOMLSSerializer-------------------------------------
-    DOMLSSerializer* theSerializer = domImpl->createLSSerializer();
-    //-----------------------------------------------------
+    XPathPipelineOptions options;
+    options.implementationFeatures = XPATH_FEATURES;
+    options.grammarPool = sharedGrammarPool.get();
+    options.parseThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    options.evaluateThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
 
-    // Error Handler---------------------------------------
-    DOMPrintErrorHandler myErrorHandler;
-    //-----------------------------------------------------
+    long long timeout = 0;
 
-    // Configure-------------------------------------------
-    DOMConfiguration* serializerConfig = theSerializer->getDomConfig();
-    //-----------------------------------------------------
+    try
+    {
+        for (int i = 3; i < argc; i++)
+        {
+            std::string argument(argv[i]);
 
-    // Set Error Handler-----------------------------------
-    serializerConfig->setParameter(XMLUni::fgDOMErrorHandler, &myErrorHandler);
-    //-----------------------------------------------------
+            if (argument == "--threads" && i + 1 < argc)
+            {
+                unsigned* counts[] = { &options.readThreads, &options.parseThreads, &options.evaluateThreads, &options.serializeThreads };
+                std::istringstream list(argv[++i]);
+                std::string count;
 
-    // Set Pretty Print------------------------------------
-    if (serializerConfig->canSetParameter(XMLUni::fgDOMWRTFormatPrettyPrint, true))
-        serializerConfig->setParameter(XMLUni::fgDOMWRTFormatPrettyPrint, true);
-    //-----------------------------------------------------
+                for (size_t stage = 0; stage < 4 && std::getline(list, count, ','); stage++)
+                    *counts[stage] = static_cast<unsigned>(::ParseCount(count, 1, MAX_THREAD_COUNT));
+            }
+            else if (argument == "--queue" && i + 1 < argc)
+                options.queueCapacity = static_cast<size_t>(::ParseCount(argv[++i], 1, MAX_QUEUE_CAPACITY));
+            else if (argument == "--timeout" && i + 1 < argc)
+                timeout = ::ParseCount(argv[++i], 0, MAX_TIMEOUT_MS);
+            else if (argument == "--print")
+                options.serializeMatches = true;
+            else
+                options.xpaths.push_back(argument);
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        std::cout << "Usage: " << argv[0] << " --pipeline <directory|manifest> [--threads read,parse,evaluate,serialize] [--queue N]"
+            << " [--timeout ms] [--print] <xpath> [<xpath> ...]" << std::endl;
+        return 1;
+    }
 
-    // Format Target---------------------------------------
-    StdOutFormatTarget consoleOutputFormatTarget;
-    //-----------------------------------------------------
+    if (options.xpaths.empty())
+    {
+        std::cout << "Please pass in a XPath argument" << std::endl;
+        return 1;
+    }
 
-    //-----------------------------------------------------
-    theOutPut->setByteStream(&consoleOutputFormatTarget);
+    try
+    {
+        options.files = ::ListXPathBatchInputs(argv[2]);
 
-    // Print-----------------------------------------------
-    for (auto it = elementsList.begin(); it != elementsList.end(); it++)
-        theSerializer->write(*it, theOutPut);
-    //-----------------------------------------------------
+        XPathPipeline pipeline(options, *xpathExpressionCache, std::cout);
 
-    // Release memory--------------------------------------
-    consoleOutputFormatTarget.flush();
-    theOutPut->release();
-    theSerializer->release();
-    //-----------------------------------------------------
+        // Cancels the run when it takes longer than the timeout
+        std::mutex watchdogMutex;
+        std::condition_variable watchdogWakeUp;
+        bool finished = false;
 
-    std::cout << "\n";
-}
+        std::thread watchdog([&]()
+        {
+            if (timeout <= 0)
+                return;
 
-void PrintDOMNode(DOMNode* node)
-{
-    // DOMImpl
-    DOMImplementation* domImpl = ::GetDOMImplementation();
-    //-----------------------------------------------------
+            std::unique_lock<std::mutex> lock(watchdogMutex);
 
-    // DOMLSOutput-----------------------------------------
-    DOMLSOutput* theOutPut = domImpl->createLSOutput();
-    theOutPut->setEncoding(XMLString::transcode("UTF-8"));
-    //-----------------------------------------------------
+            if (!watchdogWakeUp.wait_for(lock, std::chrono::milliseconds(timeout), [&]() { return finished; }))
+                pipeline.Cancel();
+        });
 
-    // DOMLSSerializer-------------------------------------
-    DOMLSSerializer* theSerializer = domImpl->createLSSerializer();
-    //-----------------------------------------------------
+        // A joinable thread must not be destroyed, Run() may throw
+        auto stopWatchdog = [&]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(watchdogMutex);
+                finished = true;
+            }
 
-    // Error Handler---------------------------------------
-    DOMPrintErrorHandler myErrorHandler;
-    //-----------------------------------------------------
+            watchdogWakeUp.notify_one();
+            watchdog.join();
+        };
 
-    // Configure-------------------------------------------
-    DOMConfiguration* serializerConfig = theSerializer->getDomConfig();
-    //-----------------------------------------------------
+        long long startTime(GetTimestamp());
 
-    // Set Error Handler-----------------------------------
-    serializerConfig->setParameter(XMLUni::fgDOMErrorHandler, &myErrorHandler);
-    //-----------------------------------------------------
+        size_t failedCount;
 
-    // Set Pretty Print------------------------------------
-    if (serializerConfig->canSetParameter(XMLUni::fgDOMWRTFormatPrettyPrint, true))
-        serializerConfig->setParameter(XMLUni::fgDOMWRTFormatPrettyPrint, true);
-    //-----------------------------------------------------
+        try
+        {
+            failedCount = pipeline.Run();
+        }
+        catch (...)
+        {
+            stopWatchdog();
+            throw;
+        }
 
-    // Format Target---------------------------------------
-    StdOutFormatTarget consoleOutputFormatTarget;
-    //-----------------------------------------------------
+        stopWatchdog();
 
-    //-----------------------------------------------------
-    theOutPut->setByteStream(&consoleOutputFormatTarget);
+        std::cerr << "Processed " << options.files.size() << " files, "
+            << failedCount << " failed, in " << (GetTimestamp() - startTime)
+            << (pipeline.IsCancelled() ? " (cancelled)" : "") << std::endl;
 
-    // Print-----------------------------------------------
-    theSerializer->write(node, theOutPut);
-    //-----------------------------------------------------
+        auto metrics = pipeline.GetMetrics();
 
-    // Release memory--------------------------------------
-    theOutPut->release();
-    theSerializer->release();
-    consoleOutputFormatTarget.flush();
-    //-----------------------------------------------------
+        for (auto it = metrics.begin(); it != metrics.end(); it++)
+        {
+            std::cerr << "Stage " << it->name << ": " << it->threads << " threads, "
+                << it->items << " items, "
+                << static_cast<int>(it->Utilization() * 100) << "% busy, "
+                << "starved " << (it->starvedNs / 1000000) << " ms, "
+                << "blocked " << (it->blockedNs / 1000000) << " ms" << std::endl;
+        }
 
-    std::cout << "\n";
+        return failedCount == 0 && !pipeline.IsCancelled() ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
 
-std::list<DOMElement*> GetElementByXpath(DOMDocument* document, const std::string& xpath)
+int mainXpathStream(const int argc, const char* argv[])
 {
+    // TestXqilla --stream <file> <xpath>
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --stream <file> <xpath>" << std::endl;
+        return 1;
+    }
+
+    std::string xmlFile(argv[2]);
+    std::string xpathExpression(argv[3]);
+
+    std::cout << "\nXPath: " << xpathExpression << std::endl;
+
     try
     {
-        std::list<DOMElement*> resultList;
+        long long startTime(GetTimestamp());
 
-        // TODO: release manually
+        size_t count = ::StreamElementsByXpath(xmlFile, xpathExpression, [](DOMElement* element)
+        {
+            if (PRINT_RESULT)
+                ::PrintDOMNode(element);
+        });
 
-        AutoRelease<DOMXPathNSResolver> resolver(document->createNSResolver(document->getDocumentElement()));
-        AutoRelease<DOMXPathExpression> parsedExpression(document->createExpression(X(xpath.c_str()), resolver));
+        std::cout << "Found " << count << " elements" << std::endl;
+        std::cout << "Streaming time: " << (GetTimestamp() - startTime) << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const XMLException& e)
+    {
+        std::cerr << "XMLException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
 
-        AutoRelease<DOMXPathResult> result(
-            parsedExpression->evaluate(
-                document->getDocumentElement(),
-                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
-                nullptr
-            )
-        );
+    return 0;
+}
 
-        size_t nLength = result->getSnapshotLength();
+int mainXpathProfile(const int argc, const char* argv[])
+{
+    // TestXqilla --profile <file> <xpath> --output report.json [--iterations N] [--parse-threads N] [--stitch import|context] [--serialize-output file|-]
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --profile <file> <xpath> --output report.json [--iterations N] [--parse-threads N] [--stitch import|context] [--serialize-output file|-]" << std::endl;
+        return 1;
+    }
 
-        if (nLength == 0)
-            throw std::runtime_error("No result");
+    std::string xmlFile(argv[2]);
+    std::string xpathExpression(argv[3]);
+    size_t iterations = 10;
+    std::string outputFile;
+    unsigned parseThreads = 1;
+    // With --parse-threads, how the chunks are put together, see ParallelParseOptions::stitchWithContext
+    bool stitchWithContext = false;
+    // Empty serializes into memory, "-" to stdout, anything else into a mapped file
+    std::string serializeOutput;
 
-        for (size_t i = 0; i < nLength; i++)
+    try
+    {
+        for (int i = 4; i < argc; i++)
         {
-            result->snapshotItem(i);
+            std::string argument(argv[i]);
 
-            auto tempNode = result->getNodeValue();
+            // Every option takes a value
+            if (i + 1 == argc)
+                throw std::invalid_argument("Missing value of " + argument);
 
-            if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+            std::string value(argv[++i]);
+
+            if (argument == "--iterations")
+                iterations = static_cast<size_t>(::ParseCount(value, 1, MAX_ITERATIONS));
+            else if (argument == "--output")
+                outputFile = value;
+            else if (argument == "--parse-threads")
+                parseThreads = static_cast<unsigned>(::ParseCount(value, 1, MAX_THREAD_COUNT));
+            else if (argument == "--stitch")
             {
-                PrintNodeType(tempNode->getNodeType());
-                throw std::runtime_error("Result contain non-element node");
-            }
+                if (value != "import" && value != "context")
+                    throw std::invalid_argument("Unknown stitch " + value);
 
-            resultList.push_back(dynamic_cast<DOMElement*>(tempNode));
+                stitchWithContext = value == "context";
+            }
+            else if (argument == "--serialize-output")
+                serializeOutput = value;
+            else
+                throw std::invalid_argument("Unknown option " + argument);
         }
 
-        return resultList;
-    }
-    catch (const XQillaException& ex)
-    {
-        std::cout << "\n" << "XQillaException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        // stdout carries the initialization messages and --serialize-output -, the report needs a file of its own
+        if (outputFile.empty())
+            throw std::invalid_argument("Missing --output");
     }
-    catch (const DOMXPathException& ex)
+    catch (const std::logic_error&)
     {
-        std::cout << "\n" << "DOMXPathException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        std::cout << "Usage: " << argv[0] << " --profile <file> <xpath> --output report.json [--iterations N] [--parse-threads N] [--stitch import|context] [--serialize-output file|-]" << std::endl;
+        return 1;
     }
-    catch (const DOMException& ex)
+
+    PhaseTimer timer;
+    size_t documentNodes = 0;
+    size_t resultNodes = 0;
+
+    std::ifstream sizeStream(xmlFile, std::ios::binary | std::ios::ate);
+    long long fileBytes = sizeStream ? static_cast<long long>(sizeStream.tellg()) : 0;
+
+    try
     {
-        std::cout << "\n" << "DOMException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
-    }
-}
+        DOMImplementation* domImpl = ::GetDOMImplementation();
 
-DOMElement* DetachRootElement(DOMDocument* document)
-{
-    DOMElement* rootElement = document->getDocumentElement();
-    document->removeChild(rootElement);
+        // Reused by every iteration, only the first one pays for the serializer setup and buffer growth
+        std::vector<XMLByte> serializedBuffer;
+        GrowableBufferFormatTarget bufferFormatTarget(serializedBuffer);
+        StreamingSerializer serializer(domImpl);
 
-    if (rootElement->getParentNode() != nullptr)
-        std::cout << "Fail to detach root element out of document" << std::endl;
-    else
-        std::cout << "Success on detach root element" << std::endl;
+        // Opened once, outside the timed phase, so "serialize" only measures the writes
+        std::unique_ptr<XMLFormatTarget> outputFormatTarget;
+        MappedFileFormatTarget* mappedFormatTarget = nullptr;
 
-    return rootElement;
-}
+        if (serializeOutput == "-")
+            outputFormatTarget.reset(new FileDescriptorFormatTarget(STDOUT_DESCRIPTOR));
+        else if (!serializeOutput.empty())
+            outputFormatTarget.reset(mappedFormatTarget = new MappedFileFormatTarget(serializeOutput));
 
-DOMDocumentFragment* DetachRootAndAddToDocumentFragment(DOMDocument* document)
-{
-    DOMElement* root = DetachRootElement(document);
-    DOMDocumentFragment* documentFragment = document->createDocumentFragment();
-    documentFragment->appendChild(root);
+        serializer.SetTarget(outputFormatTarget ? outputFormatTarget.get() : &bufferFormatTarget);
 
-    return documentFragment;
-}
+        for (size_t iteration = 0; iteration < iterations; iteration++)
+        {
+            DOMDocument* rawDocument;
+            {
+                PhaseTimer::Scope scope(timer, "parse");
+                // 1 keeps the plain XercesDOMParser path, 0 uses every core
+                rawDocument = parseThreads == 1 ? ::LoadFile(xmlFile) : ::ParallelParseFile(xmlFile, parseThreads, stitchWithContext);
+            }
 
-std::list<DOMElement*> GetElementByXpathFromDetachedElement(DOMDocument* document, DOMElement* element, const std::string& xpath)
-{
-    try
-    {
-        std::list<DOMElement*> resultList;
+            AutoRelease<DOMDocument> document(rawDocument);
 
-        // TODO: release manually
+            if (iteration == 0)
+                documentNodes = ::CountNodes(document);
 
-        AutoRelease<DOMXPathNSResolver> resolver(document->createNSResolver(element));
-        AutoRelease<DOMXPathExpression> parsedExpression(document->createExpression(X(xpath.c_str()), resolver));
+            // Compile without the expression cache, this phase measures the compile itself
+            long long compileStart(GetTimestampNanos());
 
-        AutoRelease<DOMXPathResult> result(
-            parsedExpression->evaluate(
-                element,
-                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
-                nullptr
-            )
-        );
+            AutoRelease<DOMXPathNSResolver> resolver(document->createNSResolver(document->getDocumentElement()));
+            AutoRelease<DOMXPathExpression> parsedExpression(document->createExpression(::CachedXMLCh(xpathExpression), resolver));
 
-        size_t nLength = result->getSnapshotLength();
+            timer.Record("compile", GetTimestampNanos() - compileStart);
 
-        if (nLength == 0)
-            throw std::runtime_error("No result");
+            long long evaluateStart(GetTimestampNanos());
 
-        for (size_t i = 0; i < nLength; i++)
-        {
-            result->snapshotItem(i);
+            AutoRelease<DOMXPathResult> result(
+                parsedExpression->evaluate(
+                    document->getDocumentElement(),
+                    DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                    nullptr
+                )
+            );
 
-            auto tempNode = result->getNodeValue();
+            timer.Record("evaluate", GetTimestampNanos() - evaluateStart);
 
-            if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+            std::vector<DOMNode*> nodes;
             {
-                PrintNodeType(tempNode->getNodeType());
-                throw std::runtime_error("Result contain non-element node");
+                PhaseTimer::Scope scope(timer, "iterate");
+
+                size_t nLength = result->getSnapshotLength();
+                nodes.reserve(nLength);
+
+                for (size_t i = 0; i < nLength; i++)
+                {
+                    result->snapshotItem(i);
+                    nodes.push_back(result->getNodeValue());
+                }
             }
 
-            resultList.push_back(dynamic_cast<DOMElement*>(tempNode));
-        }
+            resultNodes = nodes.size();
 
-        return resultList;
+            {
+                PhaseTimer::Scope scope(timer, "serialize");
+
+                // Every iteration leaves the output of one run, stdout gets them all
+                if (mappedFormatTarget != nullptr)
+                    mappedFormatTarget->Rewind();
+                else if (!outputFormatTarget)
+                    serializedBuffer.clear();
+
+                serializer.Write(nodes.begin(), nodes.end());
+                serializer.Flush();
+            }
+        }
     }
-    catch (const XQillaException& ex)
+    catch (const std::exception& e)
     {
-        std::cout << "\n" << "XQillaException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
     }
-    catch (const DOMXPathException& ex)
+    catch (const XQillaException& e)
     {
-        std::cout << "\n" << "DOMXPathException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        std::cerr << "XQillaException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
     }
-    catch (const DOMException& ex)
+    catch (const DOMXPathException& e)
     {
-        std::cout << "\n" << "DOMException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        std::cerr << "DOMXPathException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    // Throughput is based on the median so that a single slow iteration does not skew it.
+    // Evaluation visits the document, not just the matches, so both rates are per document node.
+    double parseSeconds = timer.Summarize("parse").p50Ns / 1e9;
+    double evaluateSeconds = (timer.Summarize("evaluate").p50Ns + timer.Summarize("iterate").p50Ns) / 1e9;
+
+    std::ostringstream report;
+    report << "{\n"
+        << "  \"file\": \"" << EscapeJson(xmlFile) << "\",\n"
+        << "  \"xpath\": \"" << EscapeJson(xpathExpression) << "\",\n"
+        << "  \"iterations\": " << iterations << ",\n"
+        << "  \"parse_threads\": " << parseThreads << ",\n"
+        << "  \"stitch\": \"" << (stitchWithContext ? "context" : "import") << "\",\n"
+        << "  \"file_bytes\": " << fileBytes << ",\n"
+        << "  \"document_nodes\": " << documentNodes << ",\n"
+        << "  \"result_nodes\": " << resultNodes << ",\n"
+        << "  \"phases\": ";
+    timer.WriteJson(report);
+    report << ",\n"
+        << "  \"throughput\": {"
+        << "\"parse_mb_per_s\": " << (parseSeconds > 0 ? fileBytes / 1e6 / parseSeconds : 0)
+        << ", \"parse_nodes_per_s\": " << (parseSeconds > 0 ? documentNodes / parseSeconds : 0)
+        << ", \"evaluate_nodes_per_s\": " << (evaluateSeconds > 0 ? documentNodes / evaluateSeconds : 0)
+        << "}\n"
+        << "}\n";
+
+    std::ofstream reportStream(outputFile);
+    reportStream << report.str();
+    reportStream.close();
+
+    if (!reportStream)
+    {
+        std::cout << "\n" << "Error: Cannot write the report to " << outputFile << std::endl;
+        return 1;
     }
+
+    return 0;
 }
 
-std::list<DOMElement*> GetElementByXpathFromDocumentFragment(DOMDocument* document, DOMDocumentFragment* docFragment, const std::string& xpath)
+int mainXpathSnapshot(const int argc, const char* argv[])
 {
+    // TestXqilla --snapshot <file.xml> <file.xsnap>
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --snapshot <file.xml> <file.xsnap>" << std::endl;
+        return 1;
+    }
+
+    std::string xmlFile(argv[2]);
+    std::string snapshotFile(argv[3]);
+
     try
     {
-        std::list<DOMElement*> resultList;
+        long long startTime(GetTimestamp());
 
-        // TODO: release manually
+        AutoRelease<DOMDocument> parsedDocument(::ParseFile(xmlFile));
 
-        AutoRelease<DOMXPathNSResolver> resolver(document->createNSResolver(docFragment));
-        AutoRelease<DOMXPathExpression> parsedExpression(document->createExpression(X(xpath.c_str()), resolver));
+        long long afterParsingAFile(GetTimestamp());
 
-        AutoRelease<DOMXPathResult> result(
-            parsedExpression->evaluate(
-                docFragment,
+        ::WriteDOMSnapshot(parsedDocument, snapshotFile);
+
+        long long afterWritingSnapshot(GetTimestamp());
+
+        AutoRelease<DOMDocument> loadedDocument(::LoadDOMSnapshot(snapshotFile, ::GetDOMImplementation()));
+
+        long long afterLoadingSnapshot(GetTimestamp());
+
+        std::cout << "Parsing time: " << (afterParsingAFile - startTime) << std::endl;
+        std::cout << "Snapshot write time: " << (afterWritingSnapshot - afterParsingAFile) << std::endl;
+        std::cout << "Snapshot load time: " << (afterLoadingSnapshot - afterWritingSnapshot) << std::endl;
+        std::cout << "Nodes parsed: " << ::CountNodes(parsedDocument)
+            << ", loaded: " << ::CountNodes(loadedDocument) << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int mainXpathShared(const int argc, const char* argv[])
+{
+    // TestXqilla --shared publish <file.xml> <name>
+    // TestXqilla --shared query <name> <xpath>
+    std::string action(argc > 2 ? argv[2] : "");
+
+    if (argc < 5 || (action != "publish" && action != "query"))
+    {
+        std::cout << "Usage: " << argv[0] << " --shared publish <file.xml> <name>\n"
+            << "       " << argv[0] << " --shared query <name> <xpath>" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        if (action == "publish")
+        {
+            std::string name(argv[4]);
+
+            long long startTime(GetTimestamp());
+
+            std::unique_ptr<SharedDocumentStore> store;
+            {
+                AutoRelease<DOMDocument> document(::ParseFile(argv[3]));
+                store = SharedDocumentStore::Publish(name, document);
+            }
+
+            std::cout << "Published " << store->GetSize() << " bytes as " << name
+                << " in " << (GetTimestamp() - startTime) << std::endl;
+            std::cout << "Press Enter to remove it" << std::endl;
+
+            std::cin.get();
+
+            SharedDocumentStore::Remove(name);
+
+            return 0;
+        }
+
+        std::string xpathExpression(argv[4]);
+
+        long long startTime(GetTimestamp());
+
+        auto store = SharedDocumentStore::Attach(argv[3]);
+
+        // Index shapes are answered from the shared pages, no private DOM is built
+        {
+            SnapshotIndex snapshotIndex(store->GetView(), INDEXED_ATTRIBUTES);
+            long long afterIndexing(GetTimestamp());
+
+            std::vector<uint32_t> nodes;
+
+            if (snapshotIndex.TryEvaluate(xpathExpression, nodes))
+            {
+                std::cout << "Found " << nodes.size() << " elements in the shared image" << std::endl;
+                std::cout << "Attach and index time: " << (afterIndexing - startTime) << std::endl;
+                std::cout << "XPath time: " << (GetTimestamp() - afterIndexing) << std::endl;
+
+                return 0;
+            }
+        }
+
+        std::cout << "XPath is not an index lookup, load a private DOM" << std::endl;
+
+        AutoRelease<DOMDocument> document(store->Load(::GetDOMImplementation()));
+
+        long long afterLoading(GetTimestamp());
+
+        XPathElements xercesElementsList;
+        ::GetElementByXpath(document, xpathExpression, xercesElementsList);
+
+        std::cout << "Found " << xercesElementsList.size() << " elements" << std::endl;
+        std::cout << "Attach and load time: " << (afterLoading - startTime) << std::endl;
+        std::cout << "XPath time: " << (GetTimestamp() - afterLoading) << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int mainXpathStanding(const int argc, const char* argv[])
+{
+    // TestXqilla --standing <file.xml> <xpath> [<xpath>...]
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " --standing <file.xml> <xpath> [<xpath>...]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        AutoRelease<DOMDocument> document(::ParseFile(argv[2]));
+        DOMElement* root = document->getDocumentElement();
+
+        StandingXPathQueries standingQueries(document, *xpathExpressionCache);
+        std::vector<StandingXPathQueries::QueryId> queryIds;
+
+        for (int i = 3; i < argc; i++)
+            queryIds.push_back(standingQueries.Register(argv[i]));
+
+        auto evaluateAll = [&](const char* label)
+        {
+            long long startTime(GetTimestamp());
+
+            for (size_t i = 0; i < queryIds.size(); i++)
+                std::cout << label << " " << argv[i + 3] << ": " << standingQueries.GetResults(queryIds[i]).size() << " elements" << std::endl;
+
+            std::cout << label << " time: " << (GetTimestamp() - startTime) << std::endl;
+        };
+
+        evaluateAll("Initial");
+
+        DOMElement* firstRecord = root != nullptr ? root->getFirstElementChild() : nullptr;
+
+        if (firstRecord != nullptr)
+        {
+            // Duplicate a record at the end, then take it out again
+            DOMNode* copy = root->appendChild(firstRecord->cloneNode(true));
+            standingQueries.ChildInserted(copy);
+
+            evaluateAll("After insert");
+
+            standingQueries.ChildRemoving(copy);
+            root->removeChild(copy)->release();
+
+            evaluateAll("After remove");
+        }
+
+        auto statistics = standingQueries.GetStatistics();
+
+        std::cout << "Full evaluations: " << statistics.fullEvaluations
+            << ", partition evaluations: " << statistics.partitionEvaluations << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int mainXpathVerifyPartitioned(const int argc, const char* argv[])
+{
+    // TestXqilla --verify-partitioned <file.xml> [<xpath>...]
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " --verify-partitioned <file.xml> [<xpath>...]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> xpaths(argv + 3, argv + argc);
+    bool defaultXPaths = xpaths.empty();
+
+    if (defaultXPaths)
+        xpaths = PARTITION_CHECK_XPATHS;
+
+    size_t mismatches = 0;
+
+    try
+    {
+        AutoRelease<DOMDocument> document(::LoadFile(argv[2]));
+        DOMElement* root = document->getDocumentElement();
+
+        if (defaultXPaths && !root->hasAttributeNS(XMLUni::fgXMLURIName, X("lang")))
+            root->setAttributeNS(XMLUni::fgXMLURIName, X("xml:lang"), X("en"));
+
+        auto bindings = XPathExpressionCache::CollectNamespaceBindings(root);
+
+        for (auto it = xpaths.begin(); it != xpaths.end(); it++)
+        {
+            bool partitionSafe = ::IsPartitionSafeXPath(*it, root);
+            XPathElements serialList;
+            XPathElements partitionedList;
+            std::string error;
+
+            // Both evaluations run even for rejected shapes, to show what partitioning them would break
+            try
+            {
+                AutoRelease<DOMXPathResult> result(
+                    xpathExpressionCache->Get(*it, bindings)->evaluate(
+                        root,
+                        DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                        nullptr
+                    )
+                );
+
+                ::CollectSnapshotElements(result, serialList);
+                ::EvaluatePartitioned(*xpathExpressionCache->Get(::MakePartitionXPath(*it), bindings), root, 0, partitionedList);
+            }
+            catch (const XQillaException& ex)
+            {
+                error = ::ToUTF8(ex.getMessage());
+            }
+            catch (const DOMXPathException& ex)
+            {
+                error = ::ToUTF8(ex.getMessage());
+            }
+            catch (const DOMException& ex)
+            {
+                error = ::ToUTF8(ex.getMessage());
+            }
+            catch (const std::runtime_error& e)
+            {
+                error = e.what();
+            }
+
+            bool match = error.empty() && serialList == partitionedList;
+
+            if (partitionSafe && !match)
+                mismatches++;
+
+            std::cout << (partitionSafe ? "safe     " : "rejected ") << (match ? "MATCH    " : "MISMATCH ")
+                << serialList.size() << "/" << partitionedList.size() << " " << *it;
+
+            if (!error.empty())
+                std::cout << " (" << error << ")";
+
+            std::cout << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    std::cout << mismatches << " partition safe xpaths differ from the serial evaluation" << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+int mainXpathVerifyCursor(const int argc, const char* argv[])
+{
+    // TestXqilla --verify-cursor <file.xml> [<xpath>...]
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " --verify-cursor <file.xml> [<xpath>...]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> xpaths(argv + 3, argv + argc);
+
+    if (xpaths.empty())
+        xpaths = CURSOR_CHECK_XPATHS;
+
+    size_t mismatches = 0;
+    int returnCode = 0;
+
+    try
+    {
+        AutoRelease<DOMDocument> document(::LoadFile(argv[2]));
+
+        // The second pass answers the shapes it can from the index, the slicing there is checked too
+        for (int pass = 0; pass < 2; pass++)
+        {
+            if (pass == 1)
+                documentIndex.reset(new DocumentIndex(document, INDEXED_ATTRIBUTES));
+
+            for (auto it = xpaths.begin(); it != xpaths.end(); it++)
+            {
+                XPathElements fullList;
+
+                try
+                {
+                    ::GetElementByXpath(document, *it, fullList);
+                }
+                catch (const std::runtime_error& e)
+                {
+                    // GetElementByXpath reports an empty result as an error, the others are not
+                    if (std::string(e.what()) != "No result")
+                        throw;
+                }
+
+                bool match = ::GetFirstElementByXpath(document, *it) == (fullList.empty() ? nullptr : fullList.front()) &&
+                    ::ExistsByXpath(document, *it) == !fullList.empty();
+
+                // Before, inside, straddling and past the end of the matches
+                const std::pair<size_t, size_t> ranges[] = {
+                    { 0, 1 }, { 0, fullList.size() + 1 }, { 1, 2 }, { fullList.size() / 2, 3 }, { fullList.size(), 1 }
+                };
+
+                for (auto range = std::begin(ranges); range != std::end(ranges); range++)
+                {
+                    XPathElements rangeList;
+                    ::GetElementByXpathRange(document, *it, range->first, range->second, rangeList);
+
+                    size_t begin = std::min(range->first, fullList.size());
+                    size_t end = begin + std::min(range->second, fullList.size() - begin);
+
+                    if (rangeList != XPathElements(fullList.begin() + begin, fullList.begin() + end))
+                        match = false;
+                }
+
+                if (!match)
+                    mismatches++;
+
+                std::cout << (pass == 0 ? "dom   " : "index ") << (match ? "MATCH    " : "MISMATCH ")
+                    << fullList.size() << " " << *it << std::endl;
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        returnCode = 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        returnCode = 1;
+    }
+
+    // Built on the document released above
+    documentIndex.reset();
+
+    if (returnCode != 0)
+        return returnCode;
+
+    std::cout << mismatches << " cursor and range results differ from GetElementByXpath" << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+int mainXpathProject(const int argc, const char* argv[])
+{
+    // TestXqilla --project <file.xml> <row xpath> <output.csv|output.xcol> <column>...
+    // column is name=xpath, name:number=xpath or a bare xpath
+    if (argc < 6)
+    {
+        std::cout << "Usage: " << argv[0] << " --project <file.xml> <row xpath> <output.csv|output.xcol> <column>..." << std::endl;
+        return 1;
+    }
+
+    std::string rowXPath(argv[3]);
+    std::string outputFile(argv[4]);
+    const std::string CSV_EXTENSION(".csv");
+
+    try
+    {
+        std::vector<ProjectionColumn> columns;
+
+        for (int i = 5; i < argc; i++)
+            columns.push_back(::ParseProjectionColumn(argv[i]));
+
+        long long startTime(GetTimestamp());
+
+        AutoRelease<DOMDocument> document(::LoadFile(argv[2]));
+
+        long long afterParsingAFile(GetTimestamp());
+
+        std::unique_ptr<RecordWriter> writer;
+
+        if (outputFile.size() > CSV_EXTENSION.size() &&
+            outputFile.compare(outputFile.size() - CSV_EXTENSION.size(), CSV_EXTENSION.size(), CSV_EXTENSION) == 0)
+            writer.reset(new CsvRecordWriter(outputFile, columns));
+        else
+            writer.reset(new ColumnarRecordWriter(outputFile, columns));
+
+        size_t rows = ::ProjectRecords(document->getDocumentElement(), rowXPath, columns, *xpathExpressionCache, *writer);
+
+        std::cout << "Projected " << rows << " rows of " << columns.size() << " columns into " << outputFile << std::endl;
+        std::cout << "Parsing time: " << (afterParsingAFile - startTime) << std::endl;
+        std::cout << "Projection time: " << (GetTimestamp() - afterParsingAFile) << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "\n" << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const DOMException& e)
+    {
+        std::cerr << "DOMException: " << UTF8(e.getMessage()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+DOMDocument* LoadFile(const std::string& file)
+{
+    const std::string SNAPSHOT_EXTENSION(".xsnap");
+
+    if (file.size() > SNAPSHOT_EXTENSION.size() &&
+        file.compare(file.size() - SNAPSHOT_EXTENSION.size(), SNAPSHOT_EXTENSION.size(), SNAPSHOT_EXTENSION) == 0)
+        return ::LoadDOMSnapshot(file, ::GetDOMImplementation());
+
+    return ::ParseFile(file);
+}
+
+DOMDocument* ParseFile(const std::string& file, MemoryManager* const manager)
+{
+    XercesDOMParser parser(nullptr, manager, sharedGrammarPool ? sharedGrammarPool->Get() : nullptr);
+    parser.setValidationScheme(XercesDOMParser::Val_Auto);
+    parser.setDoNamespaces(true);
+
+    if (sharedGrammarPool)
+        sharedGrammarPool->Configure(parser);
+
+    parser.useImplementation(XPATH_FEATURES);
+
+    // A MappedFileInputSource, or for compressed files a source decoded on
+    // another thread while the parser reads it; the file is opened only once
+    auto fileInputSource = ::CreateFileInputSource(file, manager);
+    parser.parse(*fileInputSource);
+
+    if (sharedGrammarPool && parser.getErrorCount() > 0)
+        throw std::runtime_error(file + " is not valid against the preloaded grammars");
+
+    return parser.adoptDocument();
+}
+
+DOMDocument* XQillaParseFile(const std::string& file)
+{
+    DOMImplementation* impl = ::GetDOMImplementation();
+
+    DOMLSParserConfig parserConfig;
+    parserConfig.validateWithGrammarPool = VALIDATE_WITH_GRAMMAR_POOL;
+
+    auto parser = domLSParserPool->Acquire(parserConfig);
+
+    // Throws before the input exists for an unsupported compression
+    auto fileInputSource = ::CreateFileInputSource(file);
+
+    DOMLSInput* input = impl->createLSInput();
+    input->setByteStream(fileInputSource.get());
+
+    DOMDocument* document = nullptr;
+
+    try
+    {
+        document = parser->parse(input);
+    }
+    catch (...)
+    {
+        input->release();
+        throw;
+    }
+
+    input->release();
+
+    return document;
+}
+
+DOMDocument* ParallelParseFile(const std::string& file, unsigned threadCount, bool stitchWithContext)
+{
+    ParallelParseOptions options;
+    options.threadCount = threadCount;
+    options.stitchWithContext = stitchWithContext;
+    options.validateWithGrammarPool = VALIDATE_WITH_GRAMMAR_POOL;
+
+    ParallelParseStatistics statistics;
+
+    DOMDocument* document = ::ParseRecordsInParallel(file, *domLSParserPool, options, &statistics);
+
+    std::cout << "Parallel parse: " << statistics.chunks << " chunks, "
+        << "scan " << (statistics.scanNs / 1000000) << " ms, "
+        << "stitch " << (statistics.stitchNs / 1000000) << " ms" << std::endl;
+
+    return document;
+}
+
+void PrintDOMElements(const XPathElements& elementsList)
+{
+    consoleSerializer->Write(elementsList.begin(), elementsList.end());
+    consoleSerializer->Flush();
+
+    std::cout << "\n";
+}
+
+void PrintDOMNode(DOMNode* node)
+{
+    consoleSerializer->Write(node);
+    consoleSerializer->Flush();
+
+    std::cout << "\n";
+}
+
+void GetElementByXpath(DOMDocument* document, const std::string& xpath, XPathElements& resultList)
+{
+    // A reused list must not keep the previous matches when this throws
+    resultList.clear();
+
+    if (::GetElementByIndex(document, xpath, resultList))
+    {
+        if (resultList.empty())
+            throw std::runtime_error("No result");
+
+        return;
+    }
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(document->getDocumentElement())
+        );
+
+        AutoRelease<DOMXPathResult> result(
+            parsedExpression->evaluate(
+                document->getDocumentElement(),
                 DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
                 nullptr
             )
         );
 
-        size_t nLength = result->getSnapshotLength();
+        if (result->getSnapshotLength() == 0)
+            throw std::runtime_error("No result");
+
+        ::CollectSnapshotElements(result, resultList);
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+void GetElementByXpathInParallel(DOMDocument* document, const std::string& xpath, XPathElements& resultList, unsigned threadCount)
+{
+    resultList.clear();
+
+    DOMElement* root = document->getDocumentElement();
+
+    if (!::IsPartitionSafeXPath(xpath, root))
+    {
+        std::cout << "XPath is not partition safe, evaluate on one thread" << std::endl;
+        ::GetElementByXpath(document, xpath, resultList);
+        return;
+    }
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            ::MakePartitionXPath(xpath),
+            XPathExpressionCache::CollectNamespaceBindings(root)
+        );
 
-        if (nLength == 0)
+        ::EvaluatePartitioned(*parsedExpression, root, threadCount, resultList);
+
+        if (resultList.empty())
             throw std::runtime_error("No result");
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+size_t StreamElementsByXpath(const std::string& file, const std::string& xpath, const std::function<void(DOMElement*)>& handler)
+{
+    StreamingXPath streamingXPath;
+
+    if (StreamingXPath::Compile(xpath, streamingXPath))
+    {
+        auto fileInputSource = ::CreateFileInputSource(file);
+        return ::StreamXPath(streamingXPath, *fileInputSource, ::GetDOMImplementation(), handler);
+    }
+
+    std::cout << "XPath cannot be streamed, fall back to DOM" << std::endl;
+
+    AutoRelease<DOMDocument> document(::ParseFile(file));
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(document->getDocumentElement())
+        );
+
+        AutoRelease<DOMXPathResult> result(
+            parsedExpression->evaluate(
+                document->getDocumentElement(),
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr
+            )
+        );
+
+        size_t nLength = result->getSnapshotLength();
 
         for (size_t i = 0; i < nLength; i++)
         {
@@ -596,26 +1614,281 @@ std::list<DOMElement*> GetElementByXpathFromDocumentFragment(DOMDocument* docume
                 throw std::runtime_error("Result contain non-element node");
             }
 
-            resultList.push_back(dynamic_cast<DOMElement*>(tempNode));
+            handler(static_cast<DOMElement*>(tempNode));
+        }
+
+        return nLength;
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+void CollectSnapshotElements(DOMXPathResult* result, XPathElements& resultList)
+{
+    size_t nLength = result->getSnapshotLength();
+
+    resultList.clear();
+    resultList.reserve(nLength);
+
+    for (size_t i = 0; i < nLength; i++)
+    {
+        result->snapshotItem(i);
+
+        auto tempNode = result->getNodeValue();
+
+        if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+        {
+            PrintNodeType(tempNode->getNodeType());
+            throw std::runtime_error("Result contain non-element node");
+        }
+
+        // The node type was checked above, no need for a dynamic_cast
+        resultList.push_back(static_cast<DOMElement*>(tempNode));
+    }
+}
+
+bool GetElementByIndex(DOMDocument* document, const std::string& xpath, XPathElements& resultList)
+{
+    return documentIndex && documentIndex->GetDocument() == document && documentIndex->TryEvaluate(xpath, resultList);
+}
+
+DOMElement* GetFirstElementByXpath(DOMDocument* document, const std::string& xpath)
+{
+    XPathElements resultList;
+    ::GetElementByXpathRange(document, xpath, 0, 1, resultList);
+
+    return resultList.empty() ? nullptr : resultList.front();
+}
+
+bool ExistsByXpath(DOMDocument* document, const std::string& xpath)
+{
+    XPathElements indexedElements;
+
+    if (::GetElementByIndex(document, xpath, indexedElements))
+        return !indexedElements.empty();
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(document->getDocumentElement())
+        );
+
+        XPathCursor cursor(parsedExpression, document->getDocumentElement(), 0, 1);
+
+        return cursor.Next();
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+void GetElementByXpathRange(DOMDocument* document, const std::string& xpath, size_t offset, size_t limit, XPathElements& resultList)
+{
+    resultList.clear();
+
+    if (::GetElementByIndex(document, xpath, resultList))
+    {
+        size_t begin = std::min(offset, resultList.size());
+        size_t end = begin + std::min(limit, resultList.size() - begin);
+
+        resultList.erase(resultList.begin() + end, resultList.end());
+        resultList.erase(resultList.begin(), resultList.begin() + begin);
+
+        return;
+    }
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(document->getDocumentElement())
+        );
+
+        XPathCursor cursor(parsedExpression, document->getDocumentElement(), offset, limit);
+
+        while (cursor.Next())
+        {
+            auto tempNode = cursor.Current();
+
+            if (tempNode->getNodeType() != DOMNode::ELEMENT_NODE)
+            {
+                PrintNodeType(tempNode->getNodeType());
+                throw std::runtime_error("Result contain non-element node");
+            }
+
+            resultList.push_back(static_cast<DOMElement*>(tempNode));
         }
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+DOMElement* DetachRootElement(DOMDocument* document)
+{
+    DOMElement* rootElement = document->getDocumentElement();
+    document->removeChild(rootElement);
+
+    if (rootElement->getParentNode() != nullptr)
+        std::cout << "Fail to detach root element out of document" << std::endl;
+    else
+        std::cout << "Success on detach root element" << std::endl;
+
+    return rootElement;
+}
+
+DOMDocumentFragment* DetachRootAndAddToDocumentFragment(DOMDocument* document)
+{
+    DOMElement* root = DetachRootElement(document);
+    DOMDocumentFragment* documentFragment = document->createDocumentFragment();
+    documentFragment->appendChild(root);
+
+    return documentFragment;
+}
+
+void GetElementByXpathFromDetachedElement(DOMDocument* document, DOMElement* element, const std::string& xpath, XPathElements& resultList)
+{
+    resultList.clear();
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(element)
+        );
+
+        AutoRelease<DOMXPathResult> result(
+            parsedExpression->evaluate(
+                element,
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr
+            )
+        );
+
+        if (result->getSnapshotLength() == 0)
+            throw std::runtime_error("No result");
+
+        ::CollectSnapshotElements(result, resultList);
+    }
+    catch (const XQillaException& ex)
+    {
+        std::cout << "\n" << "XQillaException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMXPathException& ex)
+    {
+        std::cout << "\n" << "DOMXPathException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+    catch (const DOMException& ex)
+    {
+        std::cout << "\n" << "DOMException" << std::endl;
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+void GetElementByXpathFromDocumentFragment(DOMDocument* document, DOMDocumentFragment* docFragment, const std::string& xpath, XPathElements& resultList)
+{
+    resultList.clear();
+
+    try
+    {
+        auto parsedExpression = xpathExpressionCache->Get(
+            xpath,
+            XPathExpressionCache::CollectNamespaceBindings(docFragment)
+        );
+
+        AutoRelease<DOMXPathResult> result(
+            parsedExpression->evaluate(
+                docFragment,
+                DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                nullptr
+            )
+        );
+
+        if (result->getSnapshotLength() == 0)
+            throw std::runtime_error("No result");
 
-        return resultList;
+        ::CollectSnapshotElements(result, resultList);
     }
     catch (const XQillaException& ex)
     {
         std::cout << "\n" << "XQillaException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
     }
     catch (const DOMXPathException& ex)
     {
         std::cout << "\n" << "DOMXPathException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
     }
     catch (const DOMException& ex)
     {
         std::cout << "\n" << "DOMException" << std::endl;
-        throw std::runtime_error(UTF8(ex.getMessage()));
+        throw std::runtime_error(::ToUTF8(ex.getMessage()));
+    }
+}
+
+size_t CountNodes(const DOMNode* node)
+{
+    // Walks down and back up through the parent links, deep documents would overflow the stack with recursion
+    size_t count = 0;
+    const DOMNode* current = node;
+
+    while (current != nullptr)
+    {
+        count++;
+
+        if (current->getFirstChild() != nullptr)
+        {
+            current = current->getFirstChild();
+            continue;
+        }
+
+        while (current != node && current->getNextSibling() == nullptr)
+            current = current->getParentNode();
+
+        current = current != node ? current->getNextSibling() : nullptr;
     }
+
+    return count;
 }
 
 void PrintNodeType(const DOMNode::NodeType& nodeType)
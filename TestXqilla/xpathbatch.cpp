@@ -0,0 +1,287 @@
+#include "xpathbatch.h"
+#include "xpathexpressioncache.h"
+#include "grammarpool.h"
+#include "fasttranscode.h"
+
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/internal/MemoryManagerImpl.hpp>
+
+XERCES_CPP_NAMESPACE_USE
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+    struct FileResult
+    {
+        bool done = false;
+        std::string text;
+        bool failed = false;
+    };
+
+    bool IsDirectory(const std::string& path)
+    {
+#ifdef _WIN32
+        DWORD attributes = GetFileAttributesA(path.c_str());
+        return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+    }
+
+    bool HasXmlExtension(const std::string& name)
+    {
+        if (name.size() < 4)
+            return false;
+
+        std::string extension(name.substr(name.size() - 4));
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        return extension == ".xml";
+    }
+
+    std::vector<std::string> ListDirectory(const std::string& directory)
+    {
+        std::vector<std::string> names;
+
+#ifdef _WIN32
+        WIN32_FIND_DATAA findData;
+        HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &findData);
+
+        if (handle == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Cannot open directory " + directory);
+
+        do
+        {
+            if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && HasXmlExtension(findData.cFileName))
+                names.push_back(directory + "\\" + findData.cFileName);
+        } while (FindNextFileA(handle, &findData));
+
+        FindClose(handle);
+#else
+        DIR* dir = opendir(directory.c_str());
+
+        if (dir == nullptr)
+            throw std::runtime_error("Cannot open directory " + directory);
+
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string path(directory + "/" + entry->d_name);
+
+            if (HasXmlExtension(entry->d_name) && !IsDirectory(path))
+                names.push_back(path);
+        }
+
+        closedir(dir);
+#endif
+
+        std::sort(names.begin(), names.end());
+
+        return names;
+    }
+
+    std::vector<std::string> ReadManifest(const std::string& manifest)
+    {
+        std::ifstream stream(manifest);
+
+        if (!stream)
+            throw std::runtime_error("Cannot open manifest " + manifest);
+
+        std::vector<std::string> names;
+        std::string line;
+
+        while (std::getline(stream, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            names.push_back(line);
+        }
+
+        return names;
+    }
+
+    std::string EvaluateFile(XercesDOMParser& parser, XPathExpressionCache& cache, const std::string& file, const std::vector<std::string>& xpaths,
+                             bool validating)
+    {
+        std::ostringstream text;
+
+        parser.parse(file.c_str());
+
+        if (parser.getErrorCount() > 0)
+            throw std::runtime_error(validating ? "The Xml file is not valid against the preloaded grammars"
+                                                : "The Xml file format is not well formed or encoded incorrectly");
+
+        DOMDocument* document = parser.getDocument();
+
+        if (document == nullptr || document->getDocumentElement() == nullptr)
+            throw std::runtime_error("Fail to load doc!");
+
+        auto bindings = XPathExpressionCache::CollectNamespaceBindings(document->getDocumentElement());
+
+        for (auto it = xpaths.begin(); it != xpaths.end(); it++)
+        {
+            auto parsedExpression = cache.Get(*it, bindings);
+
+            AutoRelease<DOMXPathResult> result(
+                parsedExpression->evaluate(
+                    document->getDocumentElement(),
+                    DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                    nullptr
+                )
+            );
+
+            text << file << "\t" << *it << "\t" << result->getSnapshotLength() << "\n";
+        }
+
+        return text.str();
+    }
+}
+
+std::vector<std::string> ListXPathBatchInputs(const std::string& directoryOrManifest)
+{
+    if (IsDirectory(directoryOrManifest))
+        return ListDirectory(directoryOrManifest);
+
+    return ReadManifest(directoryOrManifest);
+}
+
+size_t RunXPathBatch(const XPathBatchOptions& options, XPathExpressionCache& cache, std::ostream& out)
+{
+    std::vector<FileResult> results(options.files.size());
+    std::atomic<size_t> nextFile(0);
+
+    std::mutex resultMutex;
+    std::condition_variable resultReady;
+
+    auto worker = [&]()
+    {
+        MemoryManagerImpl memoryManager;
+
+        XercesDOMParser parser(nullptr, &memoryManager, options.grammarPool ? options.grammarPool->Get() : nullptr);
+        parser.setValidationScheme(XercesDOMParser::Val_Auto);
+        parser.setDoNamespaces(true);
+
+        if (options.grammarPool)
+            options.grammarPool->Configure(parser);
+
+        parser.useImplementation(options.implementationFeatures);
+
+        for (size_t index = nextFile++; index < options.files.size(); index = nextFile++)
+        {
+            const std::string& file = options.files[index];
+
+            std::string text;
+            bool failed = true;
+
+            try
+            {
+                text = EvaluateFile(parser, cache, file, options.xpaths, options.grammarPool != nullptr);
+                failed = false;
+            }
+            catch (const std::exception& e)
+            {
+                text = file + "\t\tERROR: " + e.what() + "\n";
+            }
+            catch (const XQillaException& e)
+            {
+                text = file + "\t\tERROR: " + ::ToUTF8(e.getMessage()) + "\n";
+            }
+            catch (const DOMXPathException& e)
+            {
+                text = file + "\t\tERROR: " + ::ToUTF8(e.getMessage()) + "\n";
+            }
+            catch (const DOMException& e)
+            {
+                text = file + "\t\tERROR: " + ::ToUTF8(e.getMessage()) + "\n";
+            }
+            catch (const XMLException& e)
+            {
+                text = file + "\t\tERROR: " + ::ToUTF8(e.getMessage()) + "\n";
+            }
+            catch (...)
+            {
+                text = file + "\t\tERROR: UNKNOWN error occurred!!\n";
+            }
+
+            // Release the document before the next file instead of keeping it in the pool
+            parser.resetDocumentPool();
+
+            {
+                std::lock_guard<std::mutex> lock(resultMutex);
+                results[index].text = std::move(text);
+                results[index].failed = failed;
+                results[index].done = true;
+            }
+
+            resultReady.notify_one();
+        }
+    };
+
+    // A worker without a file of its own would only be started and joined
+    size_t threadCount = std::min<size_t>(std::max(1u, options.threadCount), options.files.size());
+    std::vector<std::thread> workers;
+
+    // Started workers go through the remaining files on their own, so they always finish
+    auto joinWorkers = [&]()
+    {
+        for (auto it = workers.begin(); it != workers.end(); it++)
+            it->join();
+    };
+
+    size_t failedCount = 0;
+
+    try
+    {
+        for (size_t i = 0; i < threadCount; i++)
+            workers.emplace_back(worker);
+
+        // Stream results out in input order while the workers continue
+        for (size_t index = 0; index < results.size(); index++)
+        {
+            std::unique_lock<std::mutex> lock(resultMutex);
+            resultReady.wait(lock, [&]() { return results[index].done; });
+
+            std::string text(std::move(results[index].text));
+            if (results[index].failed)
+                failedCount++;
+
+            lock.unlock();
+
+            out << text;
+        }
+    }
+    catch (...)
+    {
+        joinWorkers();
+        throw;
+    }
+
+    joinWorkers();
+
+    out.flush();
+
+    return failedCount;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <xercesc/util/XercesDefs.hpp>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class XPathExpressionCache;
+class SharedGrammarPool;
+
+struct XPathBatchOptions
+{
+    std::vector<std::string> files;
+    std::vector<std::string> xpaths;
+    unsigned threadCount;
+    const XMLCh* implementationFeatures;
+
+    // Locked pool every worker validates against, none by default
+    const SharedGrammarPool* grammarPool = nullptr;
+};
+
+// A directory yields its *.xml files sorted by name, any other path is read
+// as a manifest with one file per line ('#' starts a comment line).
+std::vector<std::string> ListXPathBatchInputs(const std::string& directoryOrManifest);
+
+// Parses and evaluates every file on a fixed-size worker pool of at most
+// threadCount threads, never more than there are files. Each worker owns its
+// parser and memory manager. Results are written to out in input order as
+// "<file>\t<xpath>\t<count>" lines, failures as "<file>\t\tERROR: <message>".
+// Returns the number of files that failed.
+size_t RunXPathBatch(const XPathBatchOptions& options, XPathExpressionCache& cache, std::ostream& out);
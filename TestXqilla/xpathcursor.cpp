@@ -0,0 +1,91 @@
+#include "xpathcursor.h"
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <stdexcept>
+
+const size_t XPathCursor::NO_LIMIT(std::numeric_limits<size_t>::max());
+
+XPathCursor::XPathCursor(std::shared_ptr<const DOMXPathExpression> expression, const DOMNode* contextNode, size_t offset, size_t limit)
+    : _expression(expression),
+      _result(nullptr),
+      _snapshot(false),
+      _snapshotIndex(0),
+      _offset(offset),
+      _limit(limit),
+      _returned(0),
+      _current(nullptr)
+{
+    if (_limit == 0)
+        return;
+
+    try
+    {
+        _result = _expression->evaluate(contextNode, DOMXPathResult::ITERATOR_RESULT_TYPE, nullptr);
+    }
+    catch (const DOMXPathException&)
+    {
+        // The Xerces-C implementation only produces snapshots
+        _result = _expression->evaluate(contextNode, DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE, nullptr);
+        _snapshot = true;
+    }
+}
+
+XPathCursor::~XPathCursor()
+{
+    Close();
+}
+
+bool XPathCursor::Next()
+{
+    _current = nullptr;
+
+    if (_result == nullptr)
+        return false;
+
+    if (_returned >= _limit)
+    {
+        Close();
+        return false;
+    }
+
+    for (; _offset > 0; _offset--)
+    {
+        if (!Advance())
+        {
+            Close();
+            return false;
+        }
+    }
+
+    if (!Advance())
+    {
+        Close();
+        return false;
+    }
+
+    if (!_result->isNode())
+        throw std::runtime_error("Result contain non-node item");
+
+    _current = _result->getNodeValue();
+    _returned++;
+
+    return true;
+}
+
+bool XPathCursor::Advance()
+{
+    if (_snapshot)
+        return _result->snapshotItem(_snapshotIndex++);
+
+    return _result->iterateNext();
+}
+
+void XPathCursor::Close()
+{
+    if (_result != nullptr)
+    {
+        _result->release();
+        _result = nullptr;
+    }
+}
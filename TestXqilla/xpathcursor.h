@@ -0,0 +1,48 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Forward-only cursor over an XPath result that yields nodes on demand.
+// The expression is evaluated with an iterator result type, so nothing past
+// the last node read is computed and stopping early skips the remainder.
+// The document must not be modified while the cursor is in use.
+class XPathCursor
+{
+public:
+    static const size_t NO_LIMIT;
+
+    XPathCursor(std::shared_ptr<const DOMXPathExpression> expression, const DOMNode* contextNode,
+                size_t offset = 0, size_t limit = NO_LIMIT);
+    ~XPathCursor();
+
+    XPathCursor(const XPathCursor&) = delete;
+    XPathCursor& operator=(const XPathCursor&) = delete;
+
+    // Moves to the next node, false once the result or the limit is exhausted.
+    bool Next();
+
+    DOMNode* Current() const { return _current; }
+
+    // Number of nodes returned by Next() so far.
+    size_t GetCount() const { return _returned; }
+
+private:
+    bool Advance();
+    void Close();
+
+    std::shared_ptr<const DOMXPathExpression> _expression;
+    DOMXPathResult* _result;
+    bool _snapshot;
+    size_t _snapshotIndex;
+
+    size_t _offset;
+    size_t _limit;
+    size_t _returned;
+    DOMNode* _current;
+};
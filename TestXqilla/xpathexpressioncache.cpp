@@ -0,0 +1,170 @@
+#include "xpathexpressioncache.h"
+#include "fasttranscode.h"
+
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLUni.hpp>
+
+#include <xqilla/xqilla-dom3.hpp>
+
+XPathExpressionCache::Entry::Entry(DOMXPathNSResolver* resolver, DOMXPathExpression* expression)
+    : resolver(resolver), expression(expression)
+{
+}
+
+XPathExpressionCache::Entry::~Entry()
+{
+    // The expression keeps a reference to its resolver, release it first
+    expression->release();
+    resolver->release();
+}
+
+XPathExpressionCache::XPathExpressionCache(DOMImplementation* impl, size_t capacity)
+    : _capacity(capacity == 0 ? 1 : capacity),
+      _hits(0),
+      _misses(0),
+      _evictions(0),
+      _scratchDocument(impl->createDocument())
+{
+}
+
+XPathExpressionCache::~XPathExpressionCache()
+{
+    Clear();
+    _scratchDocument->release();
+}
+
+std::shared_ptr<const DOMXPathExpression> XPathExpressionCache::Get(const std::string& xpath, const NamespaceBindings& bindings)
+{
+    std::string key(MakeKey(xpath, bindings));
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _index.find(key);
+        if (found != _index.end())
+        {
+            _lru.splice(_lru.begin(), _lru, found->second);
+            _hits++;
+
+            auto& entry = found->second->second;
+            return std::shared_ptr<const DOMXPathExpression>(entry, entry->expression);
+        }
+
+        _misses++;
+    }
+
+    // Compile outside of the LRU lock so that hits are never blocked by a slow compile
+    std::shared_ptr<Entry> entry(Compile(xpath, bindings));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto found = _index.find(key);
+    if (found != _index.end())
+    {
+        // Another thread compiled the same expression meanwhile, keep theirs
+        _lru.splice(_lru.begin(), _lru, found->second);
+        entry = found->second->second;
+    }
+    else
+    {
+        _lru.emplace_front(key, entry);
+        _index[key] = _lru.begin();
+
+        while (_lru.size() > _capacity)
+        {
+            _index.erase(_lru.back().first);
+            _lru.pop_back();
+            _evictions++;
+        }
+    }
+
+    return std::shared_ptr<const DOMXPathExpression>(entry, entry->expression);
+}
+
+XPathExpressionCache::NamespaceBindings XPathExpressionCache::CollectNamespaceBindings(const DOMNode* node)
+{
+    NamespaceBindings bindings;
+
+    if (node != nullptr && node->getNodeType() == DOMNode::DOCUMENT_NODE)
+        node = static_cast<const DOMDocument*>(node)->getDocumentElement();
+
+    for (; node != nullptr; node = node->getParentNode())
+    {
+        if (node->getNodeType() != DOMNode::ELEMENT_NODE)
+            continue;
+
+        DOMNamedNodeMap* attributes = node->getAttributes();
+        XMLSize_t nLength = attributes->getLength();
+
+        for (XMLSize_t i = 0; i < nLength; i++)
+        {
+            DOMNode* attribute = attributes->item(i);
+
+            if (!XMLString::equals(attribute->getNamespaceURI(), XMLUni::fgXMLNSURIName))
+                continue;
+
+            // Skip the default namespace "xmlns", it is never used to resolve XPath names
+            const XMLCh* prefix = attribute->getPrefix();
+            if (prefix == nullptr)
+                continue;
+
+            std::string prefixString(::ToUTF8(attribute->getLocalName()));
+            if (bindings.find(prefixString) == bindings.end())
+                bindings[prefixString] = ::ToUTF8(attribute->getNodeValue());
+        }
+    }
+
+    return bindings;
+}
+
+XPathExpressionCache::Statistics XPathExpressionCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Statistics statistics;
+    statistics.hits = _hits;
+    statistics.misses = _misses;
+    statistics.evictions = _evictions;
+    statistics.size = _lru.size();
+    statistics.capacity = _capacity;
+
+    return statistics;
+}
+
+void XPathExpressionCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _index.clear();
+    _lru.clear();
+}
+
+std::string XPathExpressionCache::MakeKey(const std::string& xpath, const NamespaceBindings& bindings)
+{
+    // '\0' cannot appear in an XPath or a namespace URI
+    std::string key(xpath);
+
+    for (auto it = bindings.begin(); it != bindings.end(); it++)
+    {
+        key.push_back('\0');
+        key.append(it->first);
+        key.push_back('=');
+        key.append(it->second);
+    }
+
+    return key;
+}
+
+std::shared_ptr<XPathExpressionCache::Entry> XPathExpressionCache::Compile(const std::string& xpath, const NamespaceBindings& bindings)
+{
+    std::lock_guard<std::mutex> lock(_compileMutex);
+
+    AutoRelease<DOMXPathNSResolver> resolver(_scratchDocument->createNSResolver(nullptr));
+
+    for (auto it = bindings.begin(); it != bindings.end(); it++)
+        resolver->addNamespaceBinding(::ScratchXMLCh(it->first), ::ScratchXMLCh(it->second));
+
+    DOMXPathExpression* expression = _scratchDocument->createExpression(::ScratchXMLCh(xpath), resolver);
+
+    return std::make_shared<Entry>(resolver.adopt(), expression);
+}
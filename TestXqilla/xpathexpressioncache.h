@@ -0,0 +1,74 @@
+#pragma once
+
+#include <xercesc/dom/DOM.hpp>
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+XERCES_CPP_NAMESPACE_USE
+
+// Bounded LRU cache of compiled XPath expressions.
+// Expressions are compiled against a private scratch document so that one
+// compiled expression can be evaluated against any document.
+class XPathExpressionCache
+{
+public:
+    typedef std::map<std::string, std::string> NamespaceBindings;
+
+    struct Statistics
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+        size_t capacity;
+    };
+
+    XPathExpressionCache(DOMImplementation* impl, size_t capacity);
+    ~XPathExpressionCache();
+
+    XPathExpressionCache(const XPathExpressionCache&) = delete;
+    XPathExpressionCache& operator=(const XPathExpressionCache&) = delete;
+
+    // The returned expression stays valid after eviction until the last holder drops it.
+    std::shared_ptr<const DOMXPathExpression> Get(const std::string& xpath, const NamespaceBindings& bindings);
+
+    // In-scope prefixed namespace declarations of node, nearest declaration wins.
+    static NamespaceBindings CollectNamespaceBindings(const DOMNode* node);
+
+    Statistics GetStatistics() const;
+    void Clear();
+
+private:
+    struct Entry
+    {
+        Entry(DOMXPathNSResolver* resolver, DOMXPathExpression* expression);
+        ~Entry();
+
+        DOMXPathNSResolver* resolver;
+        DOMXPathExpression* expression;
+    };
+
+    typedef std::list<std::pair<std::string, std::shared_ptr<Entry>>> LruList;
+
+    static std::string MakeKey(const std::string& xpath, const NamespaceBindings& bindings);
+    std::shared_ptr<Entry> Compile(const std::string& xpath, const NamespaceBindings& bindings);
+
+    const size_t _capacity;
+
+    mutable std::mutex _mutex;
+    LruList _lru;
+    std::unordered_map<std::string, LruList::iterator> _index;
+
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _evictions;
+
+    std::mutex _compileMutex;
+    DOMDocument* _scratchDocument;
+};
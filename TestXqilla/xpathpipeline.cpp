@@ -0,0 +1,428 @@
+#include "xpathpipeline.h"
+#include "xpathexpressioncache.h"
+#include "grammarpool.h"
+#include "boundedqueue.h"
+#include "phasetimer.h"
+#include "fasttranscode.h"
+#include "streamingserializer.h"
+
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/framework/MemBufInputSource.hpp>
+
+XERCES_CPP_NAMESPACE_USE
+
+#include <xqilla/xqilla-dom3.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+    const char* STAGE_NAMES[] = { "read", "parse", "evaluate", "serialize" };
+    const size_t STAGE_COUNT(4);
+
+    struct PipelineItem
+    {
+        size_t index;
+        std::string file;
+        std::vector<XMLByte> bytes;
+        DOMDocument* document = nullptr;
+        std::vector<std::vector<DOMNode*>> matches;
+        std::string output;
+        std::string error;
+
+        ~PipelineItem()
+        {
+            if (document != nullptr)
+                document->release();
+        }
+    };
+
+    typedef std::unique_ptr<PipelineItem> ItemPointer;
+
+    struct StageState
+    {
+        std::atomic<long long> busyNs{ 0 };
+        std::atomic<long long> starvedNs{ 0 };
+        std::atomic<long long> blockedNs{ 0 };
+        std::atomic<size_t> items{ 0 };
+        std::atomic<unsigned> running{ 0 };
+        std::atomic<long long> endNs{ 0 };
+    };
+
+    // Message of the exception being handled, for the error line of a file
+    std::string DescribeCurrentException()
+    {
+        try
+        {
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            return e.what();
+        }
+        catch (const XQillaException& e)
+        {
+            return ::ToUTF8(e.getMessage());
+        }
+        catch (const DOMXPathException& e)
+        {
+            return ::ToUTF8(e.getMessage());
+        }
+        catch (const DOMException& e)
+        {
+            return ::ToUTF8(e.getMessage());
+        }
+        catch (const XMLException& e)
+        {
+            return ::ToUTF8(e.getMessage());
+        }
+        catch (...)
+        {
+            return "UNKNOWN error occurred!!";
+        }
+    }
+
+    void ReadFile(PipelineItem& item)
+    {
+        std::ifstream stream(item.file, std::ios::binary | std::ios::ate);
+
+        if (!stream)
+            throw std::runtime_error("Cannot open " + item.file);
+
+        std::streamoff size = stream.tellg();
+        stream.seekg(0);
+
+        item.bytes.resize(static_cast<size_t>(size));
+
+        if (size > 0 && !stream.read(reinterpret_cast<char*>(item.bytes.data()), size))
+            throw std::runtime_error("Cannot read " + item.file);
+    }
+}
+
+struct XPathPipeline::Implementation
+{
+    Implementation(size_t queueCapacity)
+        : parseQueue(queueCapacity), evaluateQueue(queueCapacity), serializeQueue(queueCapacity),
+          nextFile(0), nextOutput(0), failedCount(0)
+    {
+    }
+
+    BoundedQueue<ItemPointer> parseQueue;
+    BoundedQueue<ItemPointer> evaluateQueue;
+    BoundedQueue<ItemPointer> serializeQueue;
+
+    StageState stages[STAGE_COUNT];
+
+    std::atomic<size_t> nextFile;
+
+    // Finished files wait here until every file before them is written
+    std::mutex outputMutex;
+    std::map<size_t, std::string> pendingOutput;
+    size_t nextOutput;
+    size_t failedCount;
+};
+
+double PipelineStageMetrics::Utilization() const
+{
+    if (wallNs <= 0 || threads == 0)
+        return 0;
+
+    return static_cast<double>(busyNs) / (static_cast<double>(wallNs) * threads);
+}
+
+XPathPipeline::XPathPipeline(const XPathPipelineOptions& options, XPathExpressionCache& cache, std::ostream& out)
+    : _options(options), _cache(cache), _out(out), _cancelled(false),
+      _implementation(new Implementation(options.queueCapacity))
+{
+}
+
+XPathPipeline::~XPathPipeline()
+{
+}
+
+void XPathPipeline::Cancel()
+{
+    _cancelled = true;
+
+    _implementation->parseQueue.Cancel();
+    _implementation->evaluateQueue.Cancel();
+    _implementation->serializeQueue.Cancel();
+}
+
+size_t XPathPipeline::Run()
+{
+    Implementation& state = *_implementation;
+    const long long runStart(GetTimestampNanos());
+
+    // Writes the result of a finished file as soon as every file before it is written
+    auto emit = [&](ItemPointer item)
+    {
+        bool failed = !item->error.empty();
+        size_t index = item->index;
+        std::string text(failed ? item->file + "\t\tERROR: " + item->error + "\n" : std::move(item->output));
+
+        // Release the document before queueing up for the output
+        item.reset();
+
+        std::lock_guard<std::mutex> lock(state.outputMutex);
+
+        if (failed)
+            state.failedCount++;
+
+        state.pendingOutput[index] = std::move(text);
+
+        for (auto it = state.pendingOutput.begin(); it != state.pendingOutput.end() && it->first == state.nextOutput;
+             it = state.pendingOutput.erase(it))
+        {
+            _out << it->second;
+            state.nextOutput++;
+        }
+    };
+
+    // Pulls from input, or from the file list for the read stage, and hands the item on
+    auto runStage = [&](size_t stage, BoundedQueue<ItemPointer>* input, BoundedQueue<ItemPointer>* output,
+                        const std::function<void(PipelineItem&)>& work)
+    {
+        StageState& stageState = state.stages[stage];
+
+        while (!_cancelled)
+        {
+            ItemPointer item;
+            long long waitStart(GetTimestampNanos());
+
+            if (input == nullptr)
+            {
+                size_t index = state.nextFile++;
+
+                if (index >= _options.files.size())
+                    break;
+
+                item.reset(new PipelineItem());
+                item->index = index;
+                item->file = _options.files[index];
+            }
+            else if (!input->Pop(item))
+                break;
+
+            long long workStart(GetTimestampNanos());
+            stageState.starvedNs += workStart - waitStart;
+
+            // A failed file skips the remaining work but still reaches the output
+            if (item->error.empty())
+            {
+                try
+                {
+                    work(*item);
+                }
+                catch (...)
+                {
+                    item->error = DescribeCurrentException();
+                }
+            }
+
+            long long workEnd(GetTimestampNanos());
+            stageState.busyNs += workEnd - workStart;
+            stageState.items++;
+
+            if (output == nullptr)
+            {
+                emit(std::move(item));
+                continue;
+            }
+
+            bool pushed = output->Push(item);
+            stageState.blockedNs += GetTimestampNanos() - workEnd;
+
+            if (!pushed)
+                break;
+        }
+
+        // The last thread of a stage ends the stream for the next one
+        if (--stageState.running == 0)
+        {
+            stageState.endNs = GetTimestampNanos();
+
+            if (output != nullptr)
+                output->Close();
+        }
+    };
+
+    auto parseWorker = [&]()
+    {
+        XercesDOMParser parser(nullptr, XMLPlatformUtils::fgMemoryManager, _options.grammarPool ? _options.grammarPool->Get() : nullptr);
+        parser.setValidationScheme(XercesDOMParser::Val_Auto);
+        parser.setDoNamespaces(true);
+
+        if (_options.grammarPool)
+            _options.grammarPool->Configure(parser);
+
+        parser.useImplementation(_options.implementationFeatures);
+
+        runStage(1, &state.parseQueue, &state.evaluateQueue, [&](PipelineItem& item)
+        {
+            MemBufInputSource source(item.bytes.data(), item.bytes.size(), item.file.c_str(), false);
+
+            parser.parse(source);
+
+            if (parser.getErrorCount() > 0)
+                throw std::runtime_error(_options.grammarPool ? "The Xml file is not valid against the preloaded grammars"
+                                                              : "The Xml file format is not well formed or encoded incorrectly");
+
+            // The document leaves with the item, the parser keeps nothing between files
+            item.document = parser.adoptDocument();
+
+            if (item.document == nullptr || item.document->getDocumentElement() == nullptr)
+                throw std::runtime_error("Fail to load doc!");
+
+            std::vector<XMLByte>().swap(item.bytes);
+        });
+    };
+
+    auto evaluateWorker = [&]()
+    {
+        runStage(2, &state.evaluateQueue, &state.serializeQueue, [&](PipelineItem& item)
+        {
+            DOMElement* root = item.document->getDocumentElement();
+            auto bindings = XPathExpressionCache::CollectNamespaceBindings(root);
+
+            item.matches.resize(_options.xpaths.size());
+
+            for (size_t i = 0; i < _options.xpaths.size(); i++)
+            {
+                auto parsedExpression = _cache.Get(_options.xpaths[i], bindings);
+
+                AutoRelease<DOMXPathResult> result(
+                    parsedExpression->evaluate(
+                        root,
+                        DOMXPathResult::ORDERED_NODE_SNAPSHOT_TYPE,
+                        nullptr
+                    )
+                );
+
+                size_t nLength = result->getSnapshotLength();
+                item.matches[i].reserve(nLength);
+
+                for (size_t j = 0; j < nLength; j++)
+                {
+                    result->snapshotItem(j);
+                    item.matches[i].push_back(result->getNodeValue());
+                }
+            }
+        });
+    };
+
+    auto serializeWorker = [&]()
+    {
+        std::vector<XMLByte> buffer;
+        GrowableBufferFormatTarget bufferFormatTarget(buffer);
+
+        std::unique_ptr<StreamingSerializer> serializer;
+
+        if (_options.serializeMatches)
+        {
+            serializer.reset(new StreamingSerializer(DOMImplementationRegistry::getDOMImplementation(_options.implementationFeatures)));
+            serializer->SetTarget(&bufferFormatTarget);
+        }
+
+        runStage(3, &state.serializeQueue, nullptr, [&](PipelineItem& item)
+        {
+            std::ostringstream text;
+
+            for (size_t i = 0; i < _options.xpaths.size(); i++)
+            {
+                text << item.file << "\t" << _options.xpaths[i] << "\t" << item.matches[i].size() << "\n";
+
+                if (!serializer)
+                    continue;
+
+                for (auto it = item.matches[i].begin(); it != item.matches[i].end(); it++)
+                {
+                    buffer.clear();
+                    serializer->Write(*it);
+
+                    text.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+                    text << "\n";
+                }
+            }
+
+            item.output = text.str();
+        });
+    };
+
+    const unsigned threadCounts[STAGE_COUNT] = {
+        std::max(1u, _options.readThreads),
+        std::max(1u, _options.parseThreads),
+        std::max(1u, _options.evaluateThreads),
+        std::max(1u, _options.serializeThreads)
+    };
+
+    for (size_t stage = 0; stage < STAGE_COUNT; stage++)
+        state.stages[stage].running = threadCounts[stage];
+
+    std::vector<std::thread> workers;
+
+    auto joinWorkers = [&]()
+    {
+        for (auto it = workers.begin(); it != workers.end(); it++)
+            it->join();
+    };
+
+    try
+    {
+        for (unsigned i = 0; i < threadCounts[0]; i++)
+            workers.emplace_back([&]() { runStage(0, nullptr, &state.parseQueue, ReadFile); });
+
+        for (unsigned i = 0; i < threadCounts[1]; i++)
+            workers.emplace_back(parseWorker);
+
+        for (unsigned i = 0; i < threadCounts[2]; i++)
+            workers.emplace_back(evaluateWorker);
+
+        for (unsigned i = 0; i < threadCounts[3]; i++)
+            workers.emplace_back(serializeWorker);
+    }
+    catch (...)
+    {
+        // A stage without threads would leave the others blocked on its queue forever
+        Cancel();
+        joinWorkers();
+        throw;
+    }
+
+    joinWorkers();
+
+    _out.flush();
+
+    _metrics.clear();
+
+    for (size_t stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        const StageState& stageState = state.stages[stage];
+
+        PipelineStageMetrics metrics;
+        metrics.name = STAGE_NAMES[stage];
+        metrics.threads = threadCounts[stage];
+        metrics.items = stageState.items;
+        metrics.busyNs = stageState.busyNs;
+        metrics.starvedNs = stageState.starvedNs;
+        metrics.blockedNs = stageState.blockedNs;
+        metrics.wallNs = stageState.endNs - runStart;
+
+        _metrics.push_back(metrics);
+    }
+
+    return state.failedCount;
+}
+
+std::vector<PipelineStageMetrics> XPathPipeline::GetMetrics() const
+{
+    return _metrics;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <xercesc/util/XercesDefs.hpp>
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class XPathExpressionCache;
+class SharedGrammarPool;
+
+struct XPathPipelineOptions
+{
+    std::vector<std::string> files;
+    std::vector<std::string> xpaths;
+
+    // Worker threads of the read, parse, evaluate and serialize stages
+    unsigned readThreads = 1;
+    unsigned parseThreads = 1;
+    unsigned evaluateThreads = 1;
+    unsigned serializeThreads = 1;
+
+    // Documents waiting between two stages, a full queue stalls the stage before it
+    size_t queueCapacity = 4;
+
+    const XMLCh* implementationFeatures = nullptr;
+
+    // Locked pool the parse stage validates against, none by default
+    const SharedGrammarPool* grammarPool = nullptr;
+
+    // Writes the matched elements as XML after each count line
+    bool serializeMatches = false;
+};
+
+struct PipelineStageMetrics
+{
+    std::string name;
+    unsigned threads;
+    size_t items;
+
+    // Summed over the stage threads
+    long long busyNs;
+    // Waiting for input from the stage before
+    long long starvedNs;
+    // Waiting for room in the queue to the stage after
+    long long blockedNs;
+
+    long long wallNs;
+
+    // Share of the stage's thread time spent working
+    double Utilization() const;
+};
+
+// Read -> parse -> evaluate -> serialize over a stream of documents, each stage
+// on its own threads with bounded queues in between, so file I/O, parsing,
+// XPath evaluation and output overlap. Output has the format of RunXPathBatch
+// and keeps the input order.
+class XPathPipeline
+{
+public:
+    XPathPipeline(const XPathPipelineOptions& options, XPathExpressionCache& cache, std::ostream& out);
+    ~XPathPipeline();
+
+    XPathPipeline(const XPathPipeline&) = delete;
+    XPathPipeline& operator=(const XPathPipeline&) = delete;
+
+    // Blocks until every file went through or the run was cancelled. Returns
+    // the number of files that failed.
+    size_t Run();
+
+    // Safe from any thread. Queued documents are released, the workers stop
+    // after their current item and Run() returns.
+    void Cancel();
+
+    bool IsCancelled() const { return _cancelled; }
+
+    // Valid after Run() returned.
+    std::vector<PipelineStageMetrics> GetMetrics() const;
+
+private:
+    struct Implementation;
+
+    const XPathPipelineOptions _options;
+    XPathExpressionCache& _cache;
+    std::ostream& _out;
+
+    std::atomic<bool> _cancelled;
+    std::unique_ptr<Implementation> _implementation;
+    std::vector<PipelineStageMetrics> _metrics;
+};